@@ -0,0 +1,484 @@
+/*
+	The bike station model of hw4_q1_b on a whole city (see BikeNetwork.h for the city).
+
+	Clients of class 1, 2 and 3 arrive at every station with the rates of the single station model scaled by the
+	popularity of the station. A client that finds a bike pays like before (class 3 pays 1.25 per ride, classes 1 and
+	2 the prorated annual fee of every station) and rides it to another station, a client that finds none costs
+	clientPenalty and leaves. Bikes only come back through rides. A rider that finds every dock of the destination
+	taken rides on to the nearest station (not the one they came from) and tries again there.
+
+	Client arrivals of all stations and classes are one Poisson process of the total rate, the station and class of an
+	arrival come from an alias table and the destination from the alias table of the origin, so an arrival costs an
+	exponential and two uniforms whatever the size of the city. The bikes on the road wait in RidesInFlight, and are
+	delivered in time order before every arrival. Station state is structure of arrays.
+
+	Most of the cost is cache misses on the destination tables (2000 x 64 columns) and the unpredictable choice
+	between the next arrival and the next returning ride; with 200 stations everything fits in L2 and the same loop
+	runs about 1.5x faster.
+
+	simulatePartitionedTrial splits a single trial over the cores instead (NetworkEngine::Partitioned): every station
+	has its own random stream, the city is cut into strips of stations, one per thread, and the threads advance in
+	windows as long as the shortest ride, handing rides to other strips through lock free mailboxes (SpscMailbox.h).
+	Within a window a station never hears from another one, so each is run through the window on its own, which is
+	also about as fast on one core as the superposed loop. The results don't depend on the number of partitions at
+	all, main checks that first. Scaling past one core couldn't be measured on the machine the output comes from.
+
+	Output (2000 stations, T = 120, 20 trials of the partitioned engine on 1 core):
+	City : 2000 stations, 54877 docks, 16000 client arrivals per unit of time, rides take 1 to 1.98266
+	Partitioned engine, same trial on 1 to 32 partitions (1 hardware threads) :
+	1 partitions : money 614599, 3.45609 million events in 0.484989 sec, speedup 1, identical
+	2 partitions : money 614599, 3.45609 million events in 0.409933 sec, speedup 1.1831, identical
+	4 partitions : money 614599, 3.45609 million events in 0.485121 sec, speedup 0.999729, identical
+	8 partitions : money 614599, 3.45609 million events in 0.494698 sec, speedup 0.980375, identical
+	16 partitions : money 614599, 3.45609 million events in 0.517789 sec, speedup 0.936655, identical
+	32 partitions : money 614599, 3.45609 million events in 0.583289 sec, speedup 0.831473, identical
+	money over 20 observations : 612980 +-1493.44 (s = 3407.59)
+	time with no bikes over 20 observations : 69721 +-179.587 (s = 409.763)
+	cost of dissatisfaction over 20 observations : -232473 +-662.039 (s = 1510.58)
+	rides over 20 observations : 1.3478e+06 +-1455.2 (s = 3320.33)
+	clients without a bike over 20 observations : 572172 +-1483.54 (s = 3385)
+	redirected rides over 20 observations : 191430 +-3756.93 (s = 8572.19)
+	Events : 68.8402 million in 8.58922 sec, 8.01472 million events/sec per core (1 cores)
+	(the superposed engine gives the same means, 12.5 million events/sec per core)
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <time.h>
+
+#include "../SimulationCommon/BatchVariates.h"
+#include "../SimulationCommon/BikeNetwork.h"
+#include "../SimulationCommon/ReplicationRunner.h"
+#include "../SimulationCommon/SpscMailbox.h"
+#include "../SimulationCommon/StreamingStatistics.h"
+
+//what a single trial reports back to the reduction in main
+struct NetworkTrialResult
+{
+	double totalMoney;
+	double timeSpentWithNoBikes; //summed over the stations
+	double penalties;
+	double rides;
+	double clientsWithoutBike;
+	double redirects;
+	double events;
+};
+
+//outputs tracked over the trials
+enum NetworkMetric { MoneyMetric, NoBikesMetric, CostMetric, RidesMetric, UnservedMetric, RedirectMetric };
+
+//Superposed runs whole trials in parallel, Partitioned splits every trial over the threads
+enum class NetworkEngine { Superposed, Partitioned };
+
+//per trial state of the stations, one array per field
+struct StationState
+{
+	explicit StationState(const BikeCity & city)
+		: bikes(city.initialBikes), emptySince(city.stations(), -1)
+	{
+	}
+
+	std::vector<int> bikes;
+	std::vector<double> emptySince; //-1 while the station has bikes
+};
+
+NetworkTrialResult simulateNetworkTrial(const BikeCity & city, uint64_t streamSeed, double T, const double clientRates[4], const double clientPenalty[4])
+{
+	VariateStream arrivalClock = VariateStream::exponential(mixStreamSeed(streamSeed, 0), city.totalArrivalRate);
+	VariateStream uniforms = VariateStream::uniform(mixStreamSeed(streamSeed, 1), 0, 1);
+
+	StationState state(city);
+	int * bikes = state.bikes.data();
+	double * emptySince = state.emptySince.data();
+	const int * docks = city.docks.data();
+
+	//the annual members pay their prorated fee at every station
+	NetworkTrialResult result = {};
+	result.totalMoney = ((0.5 * clientRates[1]) + (0.1 * clientRates[2])) * city.stations();
+	double timeSpentWithNoBikes = 0;
+	//class 3 pays 1.25 per ride, looked up instead of tested since the class of the next client is a coin flip
+	const double rideFee[4] = { 0, 0, 0, 1.25 };
+
+	RidesInFlight rides(city.rideBucketWidth(), city.longestTravelTime);
+
+	//a bike reaches its destination, or rides on if every dock there is taken
+	auto dock = [&](const RideInFlight & ride)
+	{
+		result.events++;
+		uint32_t s = ride.station;
+		if (bikes[s] >= docks[s])
+		{
+			uint32_t next;
+			double travel;
+			city.redirect(ride, next, travel);
+			rides.push(ride.arrival + travel, next, s);
+			result.redirects++;
+			return;
+		}
+
+		bikes[s]++;
+		if (emptySince[s] >= 0)
+		{
+			timeSpentWithNoBikes += ride.arrival - emptySince[s];
+			emptySince[s] = -1;
+		}
+	};
+
+	double time = arrivalClock.next();
+	while (time <= T)
+	{
+		rides.deliverBefore(time, dock);
+		result.events++;
+
+		uint32_t arrival = city.arrivals.sample(uniforms.next());
+		uint32_t s = arrival / 3;
+		int clientClass = arrival % 3 + 1;
+
+		if (bikes[s] > 0)
+		{
+			result.totalMoney += rideFee[clientClass];
+			if (--bikes[s] == 0) emptySince[s] = time;
+
+			uint32_t destination;
+			double travel;
+			city.pickDestination(s, uniforms.next(), destination, travel);
+			rides.push(time + travel, destination, s);
+			result.rides++;
+		}
+		else
+		{
+			//we apply a penalty for not having a bike, for class 3 penalty is 0
+			result.totalMoney += clientPenalty[clientClass];
+			result.penalties += clientPenalty[clientClass];
+			result.clientsWithoutBike++;
+		}
+
+		time += arrivalClock.next();
+	}
+	rides.deliverBefore(T, dock);
+
+	//stations still empty at T
+	for (int s = 0; s < city.stations(); s++)
+	{
+		if (emptySince[s] >= 0) timeSpentWithNoBikes += T - emptySince[s];
+	}
+	result.timeSpentWithNoBikes = timeSpentWithNoBikes;
+	return result;
+}
+
+//stations owned by one thread of the partitioned engine, indexed by their local number
+struct NetworkPartition
+{
+	std::vector<uint32_t> stations; //global numbers
+	std::vector<int> bikes;
+	std::vector<double> emptySince;
+	std::vector<CompactRandomStream> streams;
+
+	//per station, summed in global station order at the end so the totals don't depend on the partitioning
+	std::vector<NetworkTrialResult> results;
+};
+
+//conservative parallel version of the trial. Every station draws from its own stream and the city is cut into
+//strips, one per thread. No ride is shorter than shortestTravelTime (the lookahead L), so a ride that starts in the
+//window [k L, (k + 1) L) ends in a later window: the threads simulate a window on their own, hand rides that end in
+//another strip over through an SPSC mailbox and meet at a barrier before the next one (YAWNS with fixed windows).
+//Every station sees the same events in the same order whatever the number of partitions, so the results are
+//identical to those of a single partition, bit for bit.
+NetworkTrialResult simulatePartitionedTrial(const BikeCity & city, uint64_t streamSeed, double T, const double clientRates[4], const double clientPenalty[4], int partitionCount)
+{
+	const int stationCount = city.stations();
+	const double lookahead = city.shortestTravelTime;
+	const int windowCount = (int)ceil(T / lookahead);
+	const double rideFee[4] = { 0, 0, 0, 1.25 };
+	const int * docks = city.docks.data();
+
+	//strips from west to east, most rides are short and stay in their strip
+	std::vector<uint32_t> westToEast(stationCount);
+	for (int s = 0; s < stationCount; s++) westToEast[s] = (uint32_t)s;
+	std::sort(westToEast.begin(), westToEast.end(), [&](uint32_t a, uint32_t b) { return city.x[a] < city.x[b] || (city.x[a] == city.x[b] && a < b); });
+
+	std::vector<int> owner(stationCount);
+	std::vector<uint32_t> localIndex(stationCount);
+	std::vector<NetworkPartition> partitions(partitionCount);
+	for (int i = 0; i < stationCount; i++)
+	{
+		uint32_t s = westToEast[i];
+		int p = (int)((long long)i * partitionCount / stationCount);
+		NetworkPartition & partition = partitions[p];
+		owner[s] = p;
+		localIndex[s] = (uint32_t)partition.stations.size();
+		partition.stations.push_back(s);
+		partition.bikes.push_back(city.initialBikes[s]);
+		partition.emptySince.push_back(-1);
+		partition.streams.push_back(CompactRandomStream(mixStreamSeed(streamSeed, 2, s)));
+		partition.results.push_back(NetworkTrialResult{});
+	}
+
+	//mailboxes[from * partitionCount + to], the diagonal is unused
+	std::vector<std::unique_ptr<SpscMailbox<RideInFlight>>> mailboxes(partitionCount * partitionCount);
+	for (int from = 0; from < partitionCount; from++)
+	{
+		for (int to = 0; to < partitionCount; to++)
+		{
+			if (from != to) mailboxes[from * partitionCount + to].reset(new SpscMailbox<RideInFlight>());
+		}
+	}
+	WindowBarrier barrier(partitionCount);
+
+	auto runPartition = [&](int p)
+	{
+		NetworkPartition & partition = partitions[p];
+		int * bikes = partition.bikes.data();
+		double * emptySince = partition.emptySince.data();
+		NetworkTrialResult * results = partition.results.data();
+
+		//a partition sees about 1 / partitionCount of the rides, so its buckets can be that much wider
+		RidesInFlight rides(std::min(lookahead, city.rideBucketWidth() * partitionCount), city.longestTravelTime + 2 * lookahead);
+
+		auto drainInboxes = [&]()
+		{
+			for (int from = 0; from < partitionCount; from++)
+			{
+				if (from == p) continue;
+				mailboxes[from * partitionCount + p]->drain([&](const RideInFlight & ride) { rides.push(ride.arrival, ride.station, ride.previous); });
+			}
+		};
+
+		//a ride to a station of another partition waits in its mailbox, if that is full we take in our own mail
+		//while the owner catches up, so two partitions sending to each other never block
+		auto send = [&](double arrival, uint32_t station, uint32_t previous)
+		{
+			int to = owner[station];
+			if (to == p)
+			{
+				rides.push(arrival, station, previous);
+				return;
+			}
+			SpscMailbox<RideInFlight> & mailbox = *mailboxes[p * partitionCount + to];
+			while (!mailbox.tryPush(RideInFlight{ arrival, station, previous }))
+			{
+				drainInboxes();
+				std::this_thread::yield();
+			}
+		};
+
+		auto dock = [&](const RideInFlight & ride)
+		{
+			uint32_t s = ride.station;
+			uint32_t local = localIndex[s];
+			results[local].events++;
+			if (bikes[local] >= docks[s])
+			{
+				uint32_t next;
+				double travel;
+				city.redirect(ride, next, travel);
+				send(ride.arrival + travel, next, s);
+				results[local].redirects++;
+				return;
+			}
+
+			bikes[local]++;
+			if (emptySince[local] >= 0)
+			{
+				results[local].timeSpentWithNoBikes += ride.arrival - emptySince[local];
+				emptySince[local] = -1;
+			}
+		};
+
+		//a ride sent in a window always ends in a later one, so the rides that end in a window are all known when it
+		//starts and every station can run through the whole window on its own: its rides, sorted out by station in
+		//order of arrival, merged with its own clients
+		const size_t localCount = partition.stations.size();
+		std::vector<double> nextClient(localCount);
+		for (size_t local = 0; local < localCount; local++)
+		{
+			nextClient[local] = partition.streams[local].exponential(city.arrivalRate[partition.stations[local]]);
+		}
+		std::vector<RideInFlight> arriving, byStation;
+		std::vector<size_t> firstRide(localCount + 1);
+
+		for (int window = 0; window < windowCount; window++)
+		{
+			double windowEnd = std::min((window + 1) * lookahead, T);
+			drainInboxes();
+
+			//counting sort by station, stable so every station gets its rides in order of arrival
+			arriving.clear();
+			rides.deliverBefore(windowEnd, [&](const RideInFlight & ride) { arriving.push_back(ride); });
+			std::fill(firstRide.begin(), firstRide.end(), 0);
+			for (const RideInFlight & ride : arriving) firstRide[localIndex[ride.station] + 1]++;
+			for (size_t local = 0; local < localCount; local++) firstRide[local + 1] += firstRide[local];
+			byStation.resize(arriving.size());
+			for (const RideInFlight & ride : arriving) byStation[firstRide[localIndex[ride.station]]++] = ride;
+			for (size_t local = localCount; local > 0; local--) firstRide[local] = firstRide[local - 1];
+			firstRide[0] = 0;
+
+			for (size_t local = 0; local < localCount; local++)
+			{
+				uint32_t s = partition.stations[local];
+				CompactRandomStream & stream = partition.streams[local];
+				NetworkTrialResult & result = results[local];
+				size_t ride = firstRide[local];
+				const size_t lastRide = firstRide[local + 1];
+				double time = nextClient[local];
+				while (true)
+				{
+					//a bike that comes back at the same time as a client is docked after the client, like in simulateNetworkTrial
+					if (ride < lastRide && byStation[ride].arrival < time)
+					{
+						dock(byStation[ride++]);
+						continue;
+					}
+					if (time >= windowEnd) break;
+
+					result.events++;
+					int clientClass = city.pickClass(stream.uniform());
+					if (bikes[local] > 0)
+					{
+						result.totalMoney += rideFee[clientClass];
+						if (--bikes[local] == 0) emptySince[local] = time;
+
+						uint32_t destination;
+						double travel;
+						city.pickDestination(s, stream.uniform(), destination, travel);
+						send(time + travel, destination, s);
+						result.rides++;
+					}
+					else
+					{
+						result.totalMoney += clientPenalty[clientClass];
+						result.penalties += clientPenalty[clientClass];
+						result.clientsWithoutBike++;
+					}
+					time += stream.exponential(city.arrivalRate[s]);
+				}
+				nextClient[local] = time;
+			}
+			barrier.arriveAndWait(drainInboxes);
+		}
+
+		//stations still empty at T
+		for (size_t local = 0; local < partition.stations.size(); local++)
+		{
+			if (emptySince[local] >= 0) results[local].timeSpentWithNoBikes += T - emptySince[local];
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int p = 1; p < partitionCount; p++) threads.push_back(std::thread(runPartition, p));
+	runPartition(0);
+	for (auto & thread : threads) thread.join();
+
+	NetworkTrialResult total = {};
+	total.totalMoney = ((0.5 * clientRates[1]) + (0.1 * clientRates[2])) * stationCount;
+	for (int s = 0; s < stationCount; s++)
+	{
+		const NetworkTrialResult & station = partitions[owner[s]].results[localIndex[s]];
+		total.totalMoney += station.totalMoney;
+		total.timeSpentWithNoBikes += station.timeSpentWithNoBikes;
+		total.penalties += station.penalties;
+		total.rides += station.rides;
+		total.clientsWithoutBike += station.clientsWithoutBike;
+		total.redirects += station.redirects;
+		total.events += station.events;
+	}
+	return total;
+}
+
+int main()
+{
+	const double T = 120;
+	//clients have rate r1 = 3, r2 = 1, r3 = 4 at a station of average popularity
+	const double clientRates[4] = { 0, 3.0, 1.0, 4.0 };
+	//when annual members (class 1/2) find no bike, there is penalty c1 = 1.0, c2 = 0.25, c3 = 0
+	const double clientPenalty[4] = { 0, -1.0, -0.25, 0 };
+
+	BikeNetworkConfig config;
+	config.stations = 2000;
+	BikeCity city(config, clientRates);
+
+	long long totalDocks = 0;
+	for (int docks : city.docks) totalDocks += docks;
+	std::cout << "City : " << city.stations() << " stations, " << totalDocks << " docks, " << city.totalArrivalRate
+		<< " client arrivals per unit of time, rides take " << city.shortestTravelTime << " to " << city.longestTravelTime << std::endl;
+
+	//the base seed, every trial derives its own streams from it (see ReplicationRunner.h)
+	const unsigned int baseSeed = (unsigned int)time(0);
+	const int numberOfTrials = 20;
+	double z = 1.96;
+
+	const NetworkEngine networkEngine = NetworkEngine::Partitioned;
+	const int partitionCount = (int)std::max(1u, std::thread::hardware_concurrency());
+
+	if (networkEngine == NetworkEngine::Partitioned)
+	{
+		//the same trial cut into more and more strips has to give exactly the same results
+		std::cout << "Partitioned engine, same trial on 1 to 32 partitions (" << std::thread::hardware_concurrency() << " hardware threads) :" << std::endl;
+		NetworkTrialResult reference = {};
+		double referenceSeconds = 0;
+		for (int partitions = 1; partitions <= 32; partitions *= 2)
+		{
+			auto start = std::chrono::steady_clock::now();
+			NetworkTrialResult result = simulatePartitionedTrial(city, baseSeed, T, clientRates, clientPenalty, partitions);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (partitions == 1)
+			{
+				reference = result;
+				referenceSeconds = seconds;
+			}
+			bool identical = result.totalMoney == reference.totalMoney && result.timeSpentWithNoBikes == reference.timeSpentWithNoBikes
+				&& result.penalties == reference.penalties && result.rides == reference.rides && result.clientsWithoutBike == reference.clientsWithoutBike
+				&& result.redirects == reference.redirects && result.events == reference.events;
+			std::cout << partitions << " partitions : money " << result.totalMoney << ", " << result.events / 1e6 << " million events in "
+				<< seconds << " sec, speedup " << referenceSeconds / seconds << ", " << (identical ? "identical" : "DIFFERENT") << std::endl;
+		}
+	}
+
+	auto simulateTrial = [&](std::default_random_engine & generator, int)
+	{
+		uint64_t streamSeed = generator();
+		streamSeed = (streamSeed << 32) ^ generator();
+		if (networkEngine == NetworkEngine::Partitioned) return simulatePartitionedTrial(city, streamSeed, T, clientRates, clientPenalty, partitionCount);
+		return simulateNetworkTrial(city, streamSeed, T, clientRates, clientPenalty);
+	};
+
+	const MetricSet emptyStatistics = { "money", "time with no bikes", "cost of dissatisfaction", "rides", "clients without a bike", "redirected rides" };
+	double totalEvents = 0;
+	auto recordTrial = [&](MetricSet & statistics, const NetworkTrialResult & result, int)
+	{
+		statistics.add(MoneyMetric, result.totalMoney);
+		statistics.add(NoBikesMetric, result.timeSpentWithNoBikes);
+		statistics.add(CostMetric, result.penalties);
+		statistics.add(RidesMetric, result.rides);
+		statistics.add(UnservedMetric, result.clientsWithoutBike);
+		statistics.add(RedirectMetric, result.redirects);
+	};
+
+	//a partitioned trial already uses every core, so its trials run one after the other
+	unsigned int threads = networkEngine == NetworkEngine::Partitioned ? 1 : std::min<unsigned int>(defaultReplicationThreadCount(), numberOfTrials);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<NetworkTrialResult> results = runReplications<NetworkTrialResult>(numberOfTrials, baseSeed, simulateTrial, threads);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	MetricSet statistics = emptyStatistics;
+	for (int trial = 0; trial < numberOfTrials; trial++)
+	{
+		recordTrial(statistics, results[trial], trial);
+		totalEvents += results[trial].events;
+	}
+	statistics.printConfidenceIntervals(std::cout, z);
+
+	unsigned int cores = networkEngine == NetworkEngine::Partitioned ? (unsigned int)partitionCount : threads;
+	std::cout << "Events : " << totalEvents / 1e6 << " million in " << seconds << " sec, "
+		<< totalEvents / seconds / cores / 1e6 << " million events/sec per core (" << cores << " cores)" << std::endl;
+
+	std::getchar();
+
+	return 0;
+}
@@ -0,0 +1,112 @@
+/*
+	The station of hw4_q1_b without a queue, solved exactly instead of simulated.
+
+	Bikes arrive at rate 6 and clients at rate r1 + r2 + r3 = 8, a client takes a bike if there is one and leaves
+	otherwise, so the number of bikes X(t) is a birth-death chain: up at rate 6, down at rate 8 while X > 0. Every
+	output of the replications is a linear function of the occupation measure of state 0 (by PASTA a client finds
+	the station empty as often as it is empty):
+		time with no bikes       E integral_0^T 1{X(t) = 0} dt
+		money                    K1 r1 + K2 r2 + k3 r3 (T - time with no bikes) + (c1 r1 + c2 r2) time with no bikes
+		cost of dissatisfaction  (c1 r1 + c2 r2) time with no bikes
+	Uniformization (Uniformization.h) gives the occupation measure of the chain truncated to 256 states together with
+	a certified bound on what the truncation dropped, in a millisecond or two, so this is both the fast answer and
+	the oracle for the simulations (hw4_q1_b_DES, hw4_q1_b_retro). Starting with 12 bikes is solved as well, it is the
+	other arm of the paired comparisons.
+
+	Output:
+	X(0) = 10 : 1977 steps at uniformization rate 14, 1.4824 ms
+	  time with no bikes : 29.125 (certified within 9.39622e-11)
+	  money : 361.319
+	  cost of dissatisfaction : -94.6563
+	  bikes at T : mean 3, P(no bikes) 0.25
+	X(0) = 12 : 1977 steps at uniformization rate 14, 1.8093 ms
+	  time with no bikes : 28.875 (certified within 9.41327e-11)
+	  money : 363.381
+	  cost of dissatisfaction : -93.8438
+	  bikes at T : mean 3, P(no bikes) 0.25
+
+	The DES gives 361.017 (s = 35 over 10000 trials) and the retrospective model 361.833, both within their sampling
+	error. Their time with no bikes (29.0693 and 29.0333, s = 4.7) is a little lower than 29.125 because an empty spell
+	still open at T is never added, which leaves out about P(X(T) = 0) / 6 = 0.04 on average; their cost of
+	dissatisfaction is computed from it. The replay, which adds up the penalties actually paid, has no such bias.
+*/
+
+#include <chrono>
+#include <iostream>
+#include <stdio.h>
+#include <vector>
+
+#include "../SimulationCommon/Uniformization.h"
+
+struct StationAnswer
+{
+	double timeWithNoBikes;
+	double money;
+	double costOfDissatisfaction;
+	double errorBound; //of the time with no bikes, the other outputs scale with it
+	double meanBikesAtEnd;
+	double emptyAtEnd;
+};
+
+//exact outputs of the no queue station over [0, T] starting with initialBikes
+StationAnswer solveStation(const BirthDeathChain & chain, int initialBikes, double T, const double clientRates[4],
+	const double clientPenalty[4], TransientSolution & solution)
+{
+	std::vector<double> initial(chain.states(), 0.0);
+	initial[initialBikes] = 1;
+	solution = solveTransient(chain, initial, T);
+
+	StationAnswer answer;
+	answer.timeWithNoBikes = solution.occupation[0];
+	answer.errorBound = solution.missingTime;
+
+	//the time with bikes is T minus the time without, so the bound carries over
+	double annualCharge = (0.5 * clientRates[1]) + (0.1 * clientRates[2]);
+	double penaltyRate = clientRates[1] * clientPenalty[1] + clientRates[2] * clientPenalty[2];
+	answer.money = annualCharge + 1.25 * clientRates[3] * (T - answer.timeWithNoBikes) + penaltyRate * answer.timeWithNoBikes;
+	answer.costOfDissatisfaction = penaltyRate * answer.timeWithNoBikes;
+
+	answer.meanBikesAtEnd = 0;
+	for (int x = 0; x < chain.states(); x++) answer.meanBikesAtEnd += x * solution.distribution[x];
+	answer.emptyAtEnd = solution.distribution[0];
+	return answer;
+}
+
+int main()
+{
+	const int T = 120;
+	const double bikeArrivalRate = 6;
+	//clients have rate r1 = 3, r2 = 1, r3 = 4
+	const double clientRates[4] = { 0, 3.0, 1.0, 4.0 };
+
+	//when annual members (class 1/2) arrive at empty station, there is penalty c1 = 1.0, c2 = 0.25, c3 = 0
+	const double clientPenalty[4] = { 0, -1.0, -0.25, 0 };
+
+	//there is no dock limit, the chain is cut far above anything it reaches in T (the stationary distribution is
+	//geometric with ratio 6 / 8, 0.75^256 is about 1e-32), whatever it loses shows up in the certified bound
+	const int states = 256;
+	BirthDeathChain chain;
+	chain.up.assign(states, bikeArrivalRate);
+	chain.down.assign(states, clientRates[1] + clientRates[2] + clientRates[3]);
+	chain.down[0] = 0;
+
+	const int initialBikes[2] = { 10, 12 };
+	for (int start : initialBikes)
+	{
+		auto begin = std::chrono::steady_clock::now();
+		TransientSolution solution;
+		StationAnswer answer = solveStation(chain, start, T, clientRates, clientPenalty, solution);
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+		std::cout << "X(0) = " << start << " : " << solution.steps << " steps at uniformization rate "
+			<< solution.uniformizationRate << ", " << milliseconds << " ms" << std::endl;
+		std::cout << "  time with no bikes : " << answer.timeWithNoBikes << " (certified within " << answer.errorBound << ")" << std::endl;
+		std::cout << "  money : " << answer.money << std::endl;
+		std::cout << "  cost of dissatisfaction : " << answer.costOfDissatisfaction << std::endl;
+		std::cout << "  bikes at T : mean " << answer.meanBikesAtEnd << ", P(no bikes) " << answer.emptyAtEnd << std::endl;
+	}
+
+	std::getchar();
+
+	return 0;
+}
@@ -6,6 +6,11 @@ We experimented with T (run time of experiment), and found that as T increases t
 We found the theta to be 0.5 meaning on average for every 2 arrivals 1 person is serviced
 
 1.2 average
+
+With useLindleyEngine the observations are the waiting times from the Lindley recursion (see LindleyQueue.h) instead of
+the queue length at every tick, with arrival rate 1 their mean is the time average queue length.
+The run length is no longer fixed: the warm-up is truncated with MSER, the batch size doubles as the run grows and the
+run stops once the confidence interval of the chosen variance estimator is narrower than precision
 */
 
 #include <iostream>
@@ -14,58 +19,68 @@ We found the theta to be 0.5 meaning on average for every 2 arrivals 1 person is
 #include <map>
 #include <time.h>
 #include <vector>
-#include <numeric>
 #include <math.h>
 
+#include "../SimulationCommon/BatchVariates.h"
+#include "../SimulationCommon/LindleyQueue.h"
+#include "../SimulationCommon/SteadyStateAnalysis.h"
+#include "../SimulationCommon/StreamingStatistics.h"
+
 int main()
 {
-	//Parameters for Batch Mean Method
-	std::vector<double> batchAverages;    //vector to store mean values for each batch
-	double batchSize = 500;               //batch size
-	int batchQueueSize;                   //queue size for each batch
-	int batchNumber;                      //number to keep track of current batch run
-	int warmupPeriods = 5;                //number of batches "ignored"
+	//Parameters for the steady state analysis
+	SteadyStateAnalyzer analyzer;         //warm-up truncation (MSER) and variance estimators, see SteadyStateAnalysis.h
+	SteadyStateEstimate estimate;         //latest analysis of the run
+	VarianceEstimator estimator = VarianceEstimator::OverlappingBatchMeans; //estimator the stopping rule uses
+	int checkInterval = 500;              //time units between checks of the stopping rule
 	int totalIterationCount;              //total number of runs
-	double sampleVariance;                //sample variance relative to batched trials
-	double globalMean;                    //variable to keep track of global mean of trials
-	double confidenceIntervalZ = 1.96;    //z-value for alpha = 0.05
-	double precision = 0.01;              //desired precision
+	double precision = 0.01;              //desired precision (width of the confidence interval)
 	int numTrials = 1;                    //number of independent trials
-	double upperConfidenceBound;          //upper bound of confidence interval
-	double lowerConfidenceBound;          //lower bound of confidence interval
 	double nextPossibleServiceTime;       //time when the next client can be seen
 	std::map<double, double> line;        //holds arrival time, servicetime, sorted
+	const bool useLindleyEngine = true;   //stream customers through the Lindley recursion instead of ticking
+	LindleyQueueStatistics lindleyStatistics;
+	std::vector<double> waits(checkInterval);
+	P2Quantile medianQueueLength(0.5);    //streaming quantiles of the queue length seen at every time unit
+	P2Quantile upperQueueLength(0.95);
 
 
 	//Initiate generators for distributions
 	std::default_random_engine generator;
 	generator.seed(time(0));
-	std::gamma_distribution<double> serviceTimesGenerator(3, 0.25);
+	//gamma service times and uniform arrival offsets are pulled from batch filled buffers
+	VariateStream serviceTimesGenerator = VariateStream::gamma(mixStreamSeed(generator(), 0), 3, 0.25);
 	std::poisson_distribution<int> arrivalGenerator(1);
-	std::uniform_real_distribution<double> uniformDistributionGenerator(0.0, 1.0);
+	VariateStream uniformDistributionGenerator = VariateStream::uniform(mixStreamSeed(generator(), 1), 0.0, 1.0);
 
 	for (int trial = 0; trial < numTrials; trial++)
 	{
 		//Initialize/reset values for new trial run
 		totalIterationCount = 0;
-		globalMean = 0;
-		batchAverages.clear();
-		sampleVariance = 0;
+		analyzer = SteadyStateAnalyzer();
+		medianQueueLength = P2Quantile(0.5);
+		upperQueueLength = P2Quantile(0.95);
 		line.clear();
 		nextPossibleServiceTime = 0; 
-		batchNumber = -1;
+		LindleyQueue lindleyQueue(mixStreamSeed(generator(), 2), 1, 3, 0.25);
+		lindleyStatistics = LindleyQueueStatistics(0.05, 2048);
 
 		while (true) {
-			batchQueueSize = 0;
-			++batchNumber;
-			for (int i = 0; i < batchSize; ++i) {
+			if (useLindleyEngine) {
+				//poisson(1) arrivals, so checkInterval time units are about checkInterval customers, with rate 1 the
+				//mean wait is the time average queue length (Little's law)
+				lindleyQueue.simulate(checkInterval, lindleyStatistics, waits.data());
+				for (double wait : waits) analyzer.add(wait);
+				totalIterationCount += checkInterval;
+			};
+			for (int i = 0; !useLindleyEngine && i < checkInterval; ++i) {
 				int arrivals = arrivalGenerator(generator);
 
 				//for every arrival, use uniform distribution to determine exact time of arrival
 				for (int j = 0; j < arrivals; j++) {
-					double arrivalTime = totalIterationCount + uniformDistributionGenerator(generator);
+					double arrivalTime = totalIterationCount + uniformDistributionGenerator.next();
 					//generate a service time at the same time as the arrival time, and insert into ordered map
-					line.insert(std::make_pair(arrivalTime, serviceTimesGenerator(generator)));
+					line.insert(std::make_pair(arrivalTime, serviceTimesGenerator.next()));
 				};
 
 				//try to service clients
@@ -84,39 +99,40 @@ int main()
 						break;
 					};
 				};
-				//Calculating batch size and updating total number of runs
-				batchQueueSize += line.size();
+				//every time unit is one observation of the queue length
+				analyzer.add((double)line.size());
+				medianQueueLength.add((double)line.size());
+				upperQueueLength.add((double)line.size());
 				totalIterationCount++;
 			};
 
-			//Insert batch average into vector and calculate global mean up to current iteration
-			batchAverages.push_back(batchQueueSize/batchSize);
-			globalMean = (std::accumulate(batchAverages.begin(), batchAverages.end(), 0.0))/batchAverages.size();
-
-			//Calculating sum of differences squared for sample vs global mean
-			std::vector<double>::iterator ptr;
-			double sumOfDeltaSquare = 0; //stores sum of differences quared between batch averages and global average.
-			for (ptr = batchAverages.begin(); ptr < batchAverages.end(); ++ptr) {
-				sumOfDeltaSquare += pow((*ptr - globalMean), 2);
-			};
-
-			//Calculate sample variance and upper/lower bounds for confidence intervals
-			sampleVariance = pow(((1 / ((double)totalIterationCount - 1))*sumOfDeltaSquare), 0.5);
-			upperConfidenceBound = globalMean + (confidenceIntervalZ*sampleVariance*(1 / (pow(totalIterationCount, 0.5))));
-			lowerConfidenceBound = globalMean - (confidenceIntervalZ*sampleVariance*(1 / (pow(totalIterationCount, 0.5))));
-
-			//Only check exit condition if batch run is after warmup period
-			if (batchNumber >= warmupPeriods) {
-				//If confidence interval is within precision, exit.
-				if ((upperConfidenceBound - lowerConfidenceBound) <= precision) {
-					break;
-				};
+			//truncate the warm-up and estimate the variance on what is left, the analyzer keeps 32 to 64 batches and MSER
+			//leaves at least half of them, the t quantile covers the degrees of freedom that are left
+			estimate = analyzer.analyze();
+			//If confidence interval is within precision, exit.
+			if (2 * estimate.estimate(estimator).halfWidth <= precision) {
+				break;
 			};
 		};
 	};
 
-	std::cout << "Overall Average Queue Length : " << std::setprecision(3) << std::fixed << globalMean << std::endl;
+	std::cout << "Overall Average Queue Length : " << std::setprecision(3) << std::fixed << estimate.mean
+		<< " +-" << estimate.estimate(estimator).halfWidth << std::endl;
 	std::cout << "Total Number of Runs : " << totalIterationCount << std::endl;
+	std::cout << "Warm-up Truncated (MSER) : " << estimate.truncatedObservations << std::endl;
+	std::cout << "Batches : " << estimate.batches << " of size " << estimate.batchSize << std::endl;
+	std::cout << "Half Width (batch means, overlapping batch means, standardized time series) : "
+		<< estimate.batchMeans.halfWidth << ", " << estimate.overlappingBatchMeans.halfWidth << ", "
+		<< estimate.standardizedTimeSeries.halfWidth << std::endl;
+	if (useLindleyEngine) {
+		std::cout << "Average Wait : " << lindleyStatistics.meanWait() << std::endl;
+		std::cout << "Wait Quantiles (50%, 90%, 99%) : " << lindleyStatistics.waitQuantile(0.5) << ", "
+			<< lindleyStatistics.waitQuantile(0.9) << ", " << lindleyStatistics.waitQuantile(0.99) << std::endl;
+	}
+	else {
+		std::cout << "Median Queue Length : " << medianQueueLength.quantile() << std::endl;
+		std::cout << "95th Percentile Queue Length : " << upperQueueLength.quantile() << std::endl;
+	};
 	system("pause");
 	return 0;
 };
\ No newline at end of file
@@ -0,0 +1,292 @@
+/*
+	The contact / infection process of hw4_q4_d on a contact network instead of a fully mixed population.
+
+	Contacts happen at contactRate over the whole network and every contact is a random edge, picked in a random
+	direction. If it joins an infected and a healthy person the infection passes with probability infectionRate.
+	On the complete graph this is exactly the fully mixed model of hw4_q4_d.
+
+	The engine keeps the boundary of the epidemic, every entry (v, w) of the graph with v infected and w healthy, in
+	an indexed set (dense array plus a position per graph entry), so adding and removing an entry and drawing a
+	uniform one are O(1). With B boundary entries out of E entries the next infection is a geometric number of
+	contacts with p = infectionRate * 2B / E away (see timeToFullInfection in hw4_q4_d), its time is a single gamma
+	draw, and the newly infected person is the target of a uniform boundary entry. Infecting w adds its entries to
+	healthy neighbours and removes the entries pointing at w, found with a binary search in the sorted neighbour
+	lists, so a whole trial costs O(E log degree) no matter how many contacts were wasted.
+
+	Usage:
+		EpidemicContactGraph                                  complete graph of 100 people (compare with hw4_q4_d),
+		                                                      written to the temp directory
+		EpidemicContactGraph graph.csr [infection_times.csv]  a graph in the binary format of ContactGraph.h
+		EpidemicContactGraph --convert edges.txt graph.csr    convert a text edge list
+		EpidemicContactGraph --random nodes degree graph.csr  random graph with the given average degree
+
+	Output for the complete graph of 100 people over 10000 trials:
+	Contact graph : 100 nodes, 4950 edges
+	ContactRate : 1 : InfectionRate : 0.5
+	Average time over 10000 trials : 1024.65
+	Average people infected : 100 of 100
+	Infection time of the last trial, mean : 415.106 median : 417.078 latest : 839.351
+*/
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <limits>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../SimulationCommon/ContactGraph.h"
+#include "../SimulationCommon/StreamingStatistics.h"
+
+class GraphEpidemic
+{
+public:
+	explicit GraphEpidemic(const ContactGraph & graph)
+		: graph(graph), infected(graph.nodeCount(), 0), position(graph.entryCount(), uint32_t(notInBoundary)),
+		infectionTimes(graph.nodeCount(), std::numeric_limits<double>::infinity())
+	{
+	}
+
+	//runs until everybody that can be reached is infected, returns the time of the last infection
+	double run(std::default_random_engine & generator, uint32_t firstInfected, double contactRate, double infectionRate)
+	{
+		reset();
+
+		double time = 0;
+		infect(firstInfected, time);
+
+		const double entries = (double)graph.entryCount();
+		while (!boundary.empty())
+		{
+			//contacts up to and including the next infection, either direction of a boundary entry is productive
+			double p = infectionRate * 2.0 * boundary.size() / entries;
+			long long contacts = 1;
+			if (p < 1)
+			{
+				std::geometric_distribution<long long> wastedContacts(p);
+				contacts += wastedContacts(generator);
+			}
+			std::gamma_distribution<double> elapsedTime((double)contacts, 1 / contactRate);
+			time += elapsedTime(generator);
+
+			std::uniform_int_distribution<size_t> pick(0, boundary.size() - 1);
+			infect(graph.neighbour(boundary[pick(generator)]), time);
+		}
+
+		return time;
+	}
+
+	uint64_t infectedCount() const { return numberInfected; }
+	const std::vector<double> & times() const { return infectionTimes; }
+
+private:
+	void reset()
+	{
+		//after a run the boundary is empty, infected people are the only state left
+		std::fill(infected.begin(), infected.end(), 0);
+		std::fill(infectionTimes.begin(), infectionTimes.end(), std::numeric_limits<double>::infinity());
+		numberInfected = 0;
+	}
+
+	void infect(uint32_t node, double time)
+	{
+		infected[node] = 1;
+		infectionTimes[node] = time;
+		numberInfected++;
+
+		for (uint64_t entry = graph.begin(node); entry < graph.end(node); entry++)
+		{
+			uint32_t other = graph.neighbour(entry);
+			if (infected[other]) removeBoundary(graph.findEntry(other, node));
+			else addBoundary(entry);
+		}
+	}
+
+	void addBoundary(uint64_t entry)
+	{
+		position[entry] = (uint32_t)boundary.size();
+		boundary.push_back((uint32_t)entry);
+	}
+
+	//swaps the last boundary entry into the hole
+	void removeBoundary(uint64_t entry)
+	{
+		uint32_t hole = position[entry];
+		uint32_t last = boundary.back();
+		boundary[hole] = last;
+		position[last] = hole;
+		boundary.pop_back();
+		position[entry] = notInBoundary;
+	}
+
+	static constexpr uint32_t notInBoundary = UINT32_MAX;
+
+	const ContactGraph & graph;
+	std::vector<char> infected;
+	std::vector<uint32_t> boundary;  //entries (infected, healthy)
+	std::vector<uint32_t> position;  //where every graph entry sits in boundary
+	std::vector<double> infectionTimes;
+	uint64_t numberInfected = 0;
+};
+
+bool writeCompleteGraph(const char * path, uint32_t nodes)
+{
+	std::vector<uint64_t> offsets(nodes + 1);
+	std::vector<uint32_t> neighbours;
+	for (uint32_t v = 0; v < nodes; v++)
+	{
+		offsets[v] = neighbours.size();
+		for (uint32_t w = 0; w < nodes; w++)
+		{
+			if (w != v) neighbours.push_back(w);
+		}
+	}
+	offsets[nodes] = neighbours.size();
+	return writeContactGraph(path, offsets, neighbours);
+}
+
+//random graph with nodes * degree / 2 edges between uniformly picked people (Erdos-Renyi G(n, m) up to duplicates)
+//the edges are drawn twice from the same seed, once to count the degrees and once to fill the lists, like convertEdgeList
+bool writeRandomGraph(const char * path, uint32_t nodes, double degree, unsigned int seed)
+{
+	std::default_random_engine generator(seed);
+	std::uniform_int_distribution<uint32_t> person(0, nodes - 1);
+	uint64_t edges = (uint64_t)(nodes * degree / 2);
+
+	std::vector<uint64_t> offsets(nodes + 1, 0);
+	for (uint64_t e = 0; e < edges; e++)
+	{
+		uint32_t u = person(generator), v = person(generator);
+		if (u == v) continue;
+		offsets[u + 1]++;
+		offsets[v + 1]++;
+	}
+	for (uint32_t v = 0; v < nodes; v++) offsets[v + 1] += offsets[v];
+
+	std::vector<uint32_t> neighbours(offsets.back());
+	std::vector<uint64_t> fill(offsets.begin(), offsets.end() - 1);
+	generator.seed(seed);
+	person.reset();
+	for (uint64_t e = 0; e < edges; e++)
+	{
+		uint32_t u = person(generator), v = person(generator);
+		if (u == v) continue;
+		neighbours[fill[u]++] = v;
+		neighbours[fill[v]++] = u;
+	}
+
+	normalizeContactGraph(offsets, neighbours);
+	return writeContactGraph(path, offsets, neighbours);
+}
+
+//path of a scratch file in the temp directory (TMPDIR, TEMP on Windows), so the default run leaves nothing behind
+//wherever the program was started
+std::string temporaryPath(const char * name)
+{
+	const char * directory = getenv("TMPDIR");
+	if (directory == NULL || *directory == 0) directory = getenv("TEMP");
+#if defined(_WIN32)
+	if (directory == NULL || *directory == 0) directory = ".";
+	return std::string(directory) + "\\" + name;
+#else
+	if (directory == NULL || *directory == 0) directory = "/tmp";
+	return std::string(directory) + "/" + name;
+#endif
+}
+
+int main(int argc, char ** argv)
+{
+	//create and seed the generator
+	std::default_random_engine generator;
+	generator.seed(time(0));
+
+	double contactRate = 1, infectionRate = 0.5;
+	int numTrials = 10000;
+
+	const std::string completeGraphPath = temporaryPath("complete100.csr");
+	const char * graphPath = completeGraphPath.c_str();
+	const char * infectionTimesPath = NULL;
+
+	if (argc >= 4 && strcmp(argv[1], "--convert") == 0)
+	{
+		bool converted = convertEdgeList(argv[2], argv[3]);
+		std::cout << (converted ? "Converted " : "Could not convert ") << argv[2] << " to " << argv[3] << std::endl;
+		return converted ? 0 : 1;
+	}
+	else if (argc >= 5 && strcmp(argv[1], "--random") == 0)
+	{
+		bool written = writeRandomGraph(argv[4], (uint32_t)atol(argv[2]), atof(argv[3]), (unsigned int)generator());
+		std::cout << (written ? "Wrote " : "Could not write ") << argv[4] << std::endl;
+		return written ? 0 : 1;
+	}
+	else if (argc >= 2)
+	{
+		graphPath = argv[1];
+		if (argc >= 3) infectionTimesPath = argv[2];
+		numTrials = 10; //real networks are big, a handful of trials is plenty
+	}
+	else if (!writeCompleteGraph(graphPath, 100))
+	{
+		std::cout << "Could not write " << graphPath << std::endl;
+		return 1;
+	}
+
+	ContactGraph graph;
+	if (!graph.open(graphPath) || graph.nodeCount() == 0 || graph.entryCount() >= UINT32_MAX)
+	{
+		std::cout << "Could not load " << graphPath << " (a missing or malformed graph file, or more than 2^32 - 1 entries, boundary positions are 32 bit)" << std::endl;
+		return 1;
+	}
+	std::cout << "Contact graph : " << graph.nodeCount() << " nodes, " << graph.edgeCount() << " edges" << std::endl;
+
+	GraphEpidemic epidemic(graph);
+	std::uniform_int_distribution<uint32_t> firstInfected(0, (uint32_t)graph.nodeCount() - 1);
+
+	double totalTime = 0;
+	double totalInfected = 0;
+	for (int trial = 0; trial < numTrials; trial++)
+	{
+		// pick a random person to be infected as per the prompt
+		double time = epidemic.run(generator, firstInfected(generator), contactRate, infectionRate);
+
+		totalTime += time;
+		totalInfected += epidemic.infectedCount();
+		//std::cout << "Total time before complete infection : " << time << std::endl;
+	}
+
+	std::cout << "ContactRate : " << contactRate << " : InfectionRate : " << infectionRate << std::endl;
+	std::cout << "Average time over " << numTrials << " trials : " << (totalTime / numTrials) << std::endl;
+	std::cout << "Average people infected : " << (totalInfected / numTrials) << " of " << graph.nodeCount() << std::endl;
+
+	//per person infection times of the last trial, people that were never reached are left out
+	RunningMoments infectionTimes;
+	P2Quantile medianInfectionTime(0.5);
+	for (double infectionTime : epidemic.times())
+	{
+		if (infectionTime == std::numeric_limits<double>::infinity()) continue;
+		infectionTimes.add(infectionTime);
+		medianInfectionTime.add(infectionTime);
+	}
+	std::cout << "Infection time of the last trial, mean : " << infectionTimes.mean() << " median : " << medianInfectionTime.quantile()
+		<< " latest : " << infectionTimes.maximum() << std::endl;
+
+	if (infectionTimesPath)
+	{
+		std::ofstream out(infectionTimesPath);
+		out << std::setprecision(17);
+		out << "node,infectionTime" << std::endl;
+		for (size_t node = 0; node < epidemic.times().size(); node++)
+		{
+			if (epidemic.times()[node] != std::numeric_limits<double>::infinity()) out << node << "," << epidemic.times()[node] << std::endl;
+		}
+		std::cout << "Wrote infection times to " << infectionTimesPath << std::endl;
+	}
+
+	std::getchar();
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+	Micro-benchmark for the future event lists in SimulationCommon/EventList.h.
+
+	Uses the classic hold model: the list is filled with a number of pending events, then every operation pops the
+	next event and schedules a new one at (event time + exponential increment), so the number of pending events stays
+	constant. We report events/sec (one pop + one push per event) for every backend while the pending event count
+	grows from 4 (the bike station DES) to a few million (network scale models).
+
+	Before timing, every backend is checked against a reference ordering on a workload with lots of identical
+	timestamps, to make sure ties come out in scheduling order.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <time.h>
+
+#include "../SimulationCommon/EventList.h"
+
+//pushes and pops a random mix of events with many identical times and compares the pop order with a std::map keyed
+//on (time, insertion order)
+template <typename EventList>
+bool checkOrdering(unsigned int seed)
+{
+	std::default_random_engine generator(seed);
+	std::uniform_int_distribution<int> coarseTime(0, 200);
+	std::uniform_int_distribution<int> action(0, 2);
+
+	EventList events;
+	std::map<std::pair<double, unsigned long long>, int> reference;
+	unsigned long long sequence = 0;
+	double now = 0;
+
+	for (int step = 0; step < 200000; step++)
+	{
+		if (reference.empty() || action(generator) > 0)
+		{
+			//half unit steps so plenty of events share a timestamp
+			double time = now + coarseTime(generator) * 0.5;
+			events.push(time, step);
+			reference.insert(std::make_pair(std::make_pair(time, sequence++), step));
+		}
+		else
+		{
+			FutureEvent event = events.pop();
+			auto expected = reference.begin();
+			if (event.time != expected->first.first || event.type != expected->second) return false;
+			now = event.time;
+			reference.erase(expected);
+		}
+
+		if (events.size() != reference.size()) return false;
+	}
+
+	while (!reference.empty())
+	{
+		FutureEvent event = events.pop();
+		if (event.type != reference.begin()->second) return false;
+		reference.erase(reference.begin());
+	}
+
+	return events.empty();
+}
+
+//returns events/sec for the hold model with the given number of pending events
+template <typename EventList>
+double measureHoldModel(size_t pendingEvents, size_t operations, unsigned int seed)
+{
+	std::default_random_engine generator(seed);
+	std::exponential_distribution<double> increment(1.0);
+
+	//draw the increments up front so the timing only covers the event list
+	std::vector<double> increments(pendingEvents + operations);
+	for (auto & value : increments) value = increment(generator);
+
+	EventList events;
+	for (size_t i = 0; i < pendingEvents; i++) events.push(increments[i], (int)i);
+
+	auto start = std::chrono::steady_clock::now();
+
+	double checksum = 0;
+	for (size_t i = 0; i < operations; i++)
+	{
+		FutureEvent event = events.pop();
+		checksum += event.time;
+		events.push(event.time + increments[pendingEvents + i], event.type);
+	}
+
+	auto stop = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(stop - start).count();
+
+	//keeps the loop from being optimized away
+	if (checksum < 0) std::cout << checksum << std::endl;
+
+	return operations / seconds;
+}
+
+template <typename EventList>
+void reportBackend(const char * name, const std::vector<size_t> & sizes, unsigned int seed)
+{
+	std::cout << std::setw(16) << name << std::flush;
+	for (size_t pending : sizes)
+	{
+		//enough operations to cycle through the whole list a couple of times, but at least a million
+		size_t operations = std::max<size_t>(1000000, 2 * pending);
+		std::cout << std::setw(12) << std::setprecision(3) << measureHoldModel<EventList>(pending, operations, seed) / 1e6 << std::flush;
+	}
+	std::cout << std::endl;
+}
+
+int main()
+{
+	const unsigned int seed = (unsigned int)time(0);
+
+	std::cout << "Checking tie handling against the reference ordering" << std::endl;
+	bool ordered[4] = {
+		checkOrdering<QuaternaryHeapEventList>(seed),
+		checkOrdering<PairingHeapEventList>(seed),
+		checkOrdering<CalendarQueueEventList>(seed),
+		checkOrdering<LadderQueueEventList>(seed)
+	};
+	const char * names[4] = { "4-ary heap", "pairing heap", "calendar queue", "ladder queue" };
+	for (int b = 0; b < 4; b++)
+	{
+		std::cout << std::setw(16) << names[b] << " : " << (ordered[b] ? "ok" : "WRONG ORDER") << std::endl;
+	}
+
+	//4 pending events is the bike station DES, the rest grows by 4x up to ~4 million
+	std::vector<size_t> sizes;
+	for (size_t pending = 4; pending <= 4194304; pending *= 4) sizes.push_back(pending);
+
+	std::cout << std::endl << "Hold model throughput, million events/sec by number of pending events" << std::endl;
+	std::cout << std::setw(16) << "pending";
+	for (size_t pending : sizes) std::cout << std::setw(12) << pending;
+	std::cout << std::endl;
+
+	reportBackend<QuaternaryHeapEventList>(names[0], sizes, seed);
+	reportBackend<PairingHeapEventList>(names[1], sizes, seed);
+	reportBackend<CalendarQueueEventList>(names[2], sizes, seed);
+	reportBackend<LadderQueueEventList>(names[3], sizes, seed);
+
+	std::getchar();
+
+	return 0;
+}
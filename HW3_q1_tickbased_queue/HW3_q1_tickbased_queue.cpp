@@ -14,18 +14,298 @@
 	Total Money at the end of experiment 184.1
 	Total Money at the end of experiment 211.35
 	Average amount of money over 100 iterations : 223.855
+
+	Geometric skip-ahead:
+	Each bernouli stream only changes the state on its successes, and the number of failures before the next success
+	of a bernouli(p) stream is geometric(p). So instead of drawing every tick we draw the gap to the next success of each
+	stream and jump straight to the earliest one. Ticks where nothing succeeds leave the state alone (clients only queue
+	when there are no bikes, so the waiting line can only be served on a tick with a bike arrival), which means the
+	skip-ahead engine runs exactly the same discrete time process as the tick by tick loop, with work proportional to
+	the number of arrivals instead of T * bernouliInterval. That makes 10000 runs (or bernouliInterval = 10^7) cheap.
+
+	Reneging:
+	A client who has to wait gives up after an exponential patience time (mean 0.25 intervals), a lost trip, and a pay per
+	ride rider who gives up takes the fare along (lost revenue). The patience timers are kept in a hierarchical timing
+	wheel (TimingWheel.h) next to the line, scheduling one and cancelling it when the client is served are O(1), and
+	the skip-ahead engine stays exact: before a tick is processed every deadline up to it fires, which is everything
+	that could have happened in the ticks it skipped. With bernouliInterval = 1000 and 20000 runs both engines give 427.7
+	and 427.9 waiting clients per run with std::mt19937 (the default minstd generator biases the tick by tick loop a
+	little, 431.1 there, since the patience draw directly follows the bernouli draws of the same tick).
+
+	Output after 10000 runs with reneging:
+	...
+	Total Money at the end of experiment 329.1
+	Total Money at the end of experiment 226.6
+	Average amount of money over 10000 iterations : 283.125
+	Clients who had to wait per run : 427.391
+	Abandoned (lost trips) per run : 231.57, abandonment rate 0.541822
+	Lost revenue per run : 144.582
+	Clients who give up no longer hold on to the next bikes, so fewer of the later clients have to wait and pay the
+	penalty, which is why the station makes more money than without reneging (232.3) despite the lost fares.
+
+	Multilevel Monte Carlo (useMultilevelMonteCarlo = true):
+	The bias of the discretisation shrinks as bernouliInterval grows, so instead of picking one resolution the money is
+	estimated as the money at 100 ticks per interval plus corrections for 1000, 10000 ... ticks per interval, each
+	sampled with both resolutions of a sample sharing their arrivals (drawCoupledArrivals) and patience times, until
+	the bias left is within the target (MultilevelMonteCarlo.h). 10 ticks per interval is too coarse to start from,
+	with p up to 0.6 per tick the coupled paths drift apart and the first correction varies as much as the money
+	itself (938 against 1168). With the samples spread for what they would cost the tick by tick loop:
+	Multilevel Monte Carlo, target root mean square error 0.25
+	  level 0, 100 ticks per interval : 167424 samples, correction 283.151 (variance 1977.03), 207.282 us per sample
+	  level 1, 1000 ticks per interval : 12693 samples, correction -0.267431 (variance 115.785), 409.224 us per sample
+	  level 2, 10000 ticks per interval : 1226 samples, correction -0.102162 (variance 12.0389), 434.496 us per sample
+	Average amount of money : 282.781 +-0.3437, bias beyond 10000 ticks per interval about 0.0472472, corrections decay as M^-0.5 per level
+	Root mean square error about 0.181611, 40.4309 sec, 2.12115e+10 bernouli draws tick by tick
+	Plain trials at 10000 ticks per interval : 66770.9 runs, about 14.5058 sec with skip-ahead, 3.205e+11 bernouli draws tick by tick
+	so tick by tick the answer at 10000 ticks per interval costs 15 times fewer draws than plain trials there, little
+	more than the coarsest level alone. The skip-ahead engine costs the same per run at every resolution though, and
+	spread for its measured time (countBernouliDraws = false) the samples still take 28 sec against 14 sec for plain
+	skip-ahead trials at the finest resolution: there the multilevel estimate is worth its bias bound, not its speed.
+	The variance of the corrections falls about 10 times per level, as the number of ticks with two arrivals does.
 */
 
 #include <iostream>
 #include <random>
-#include <queue>
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+#include <math.h>
 #include <time.h>
 
+#include "../SimulationCommon/MultilevelMonteCarlo.h"
+#include "../SimulationCommon/ReplicationRunner.h"
+#include "../SimulationCommon/TimingWheel.h"
+
 struct Client
 {
 	int type;
 };
 
+//riders who gave up waiting, over a whole trial
+struct Reneging
+{
+	long long joined = 0;    //clients who had to wait
+	long long abandoned = 0; //of those, gave up before a bike came (lost trips)
+	double lostRevenue = 0;  //fares of the riders who gave up
+
+	//a rider who never got a bike doesn't pay for the ride
+	void abandon(const Client & client, double & totalMoney)
+	{
+		abandoned++;
+		if (client.type == 3)
+		{
+			totalMoney -= 1.25;
+			lostRevenue += 1.25;
+		}
+	}
+};
+
+//everything that happens during a single bernouli tick, shared by the tick by tick and the skip-ahead engine
+//arrived[0] is a bike arrival, arrived[1..3] are clients of class 1-3, patience(tick, j) is the tick a client of class j
+//who has to wait there gives up at
+template <typename Patience>
+void processTick(long long tick, int & bikes, PatienceLine<Client> & line, double & totalMoney, Reneging & reneging,
+	const bool arrived[4], const double clientPenalty[4], Patience patience)
+{
+	//anyone whose patience ran out by now has left
+	line.advanceTo(tick, [&](const Client & client) { reneging.abandon(client, totalMoney); });
+
+	//see if a bike has arrived
+	if (arrived[0]) bikes++;
+
+	//distribute the bikes to any clients waiting
+	Client served;
+	while (bikes > 0 && line.serve(served))
+	{
+		bikes--; //decrement bike count
+	}
+
+	//see if a client of class 1-3 has arrived
+	for (int j = 1; j <= 3; j++)
+	{
+		if (arrived[j])
+		{
+			if (j == 3) totalMoney += 1.25; // class 3 pays per ride
+
+			//if a client arrives and there are no bikes
+			if (bikes == 0)
+			{
+				//add the client into the queue until their patience runs out
+				line.join(Client{ j }, patience(tick, j));
+				reneging.joined++;
+				//we apply a penalty, for class3 penalty is 0
+				totalMoney += clientPenalty[j];
+			}
+			else
+			{
+				bikes--; //otherise just give the client a bike
+			}
+		}
+	}
+}
+
+//an arrival at some tick resolution: its tick, the event type and the patience (in poisson intervals) of the client
+struct TickArrival
+{
+	long long tick;
+	int type;
+	double patience;
+};
+
+/*
+	Arrivals of the four bernouli streams over T intervals at ticksPerUnit ticks per interval (skip-ahead), and when
+	refinement > 1 those of the coarser resolution ticksPerUnit / refinement coupled to them for multilevel Monte
+	Carlo. Coarse tick c of a stream succeeds when any of the fine ticks c * refinement .. (c + 1) * refinement - 1
+	does, and takes the patience of the first, or else with probability q from a top-up stream of its own. With
+	p = rate / ticksPerUnit and P = rate * refinement / ticksPerUnit,
+		q = (P - (1 - (1 - p)^refinement)) / (1 - p)^refinement
+	so the coarse ticks are bernouli(P) exactly as if drawn alone, and the two resolutions share all they can.
+*/
+void drawCoupledArrivals(const double rates[4], long long ticksPerUnit, int refinement, int T, double meanPatience,
+	std::default_random_engine & generator, std::vector<TickArrival> & fine, std::vector<TickArrival> & coarse)
+{
+	fine.clear();
+	coarse.clear();
+	std::exponential_distribution<double> patienceGenerator(1.0 / meanPatience);
+	const long long fineTicks = (long long)T * ticksPerUnit;
+	const long long coarseTicks = fineTicks / refinement;
+
+	for (int k = 0; k < 4; k++)
+	{
+		double p = rates[k] / ticksPerUnit;
+		std::geometric_distribution<long long> gapGenerator(p);
+		size_t firstCoarse = coarse.size();
+		for (long long tick = gapGenerator(generator); tick < fineTicks; tick += 1 + gapGenerator(generator))
+		{
+			double patience = patienceGenerator(generator);
+			fine.push_back(TickArrival{ tick, k, patience });
+			long long coarseTick = tick / refinement;
+			if (refinement > 1 && (coarse.size() == firstCoarse || coarse.back().tick != coarseTick))
+			{
+				coarse.push_back(TickArrival{ coarseTick, k, patience });
+			}
+		}
+		if (refinement == 1) continue;
+
+		double noFineSuccess = exp(refinement * log1p(-p));
+		double q = (p * refinement - (1 - noFineSuccess)) / noFineSuccess;
+		if (q <= 0) continue;
+		std::geometric_distribution<long long> topUpGenerator(q);
+		size_t lastFromFine = coarse.size();
+		for (long long tick = topUpGenerator(generator); tick < coarseTicks; tick += 1 + topUpGenerator(generator))
+		{
+			//the tick may have its success from the fine ticks already
+			auto first = coarse.begin() + firstCoarse, last = coarse.begin() + lastFromFine;
+			auto found = std::lower_bound(first, last, tick, [](const TickArrival & arrival, long long t) { return arrival.tick < t; });
+			if (found == last || found->tick != tick) coarse.push_back(TickArrival{ tick, k, patienceGenerator(generator) });
+		}
+	}
+
+	auto byTick = [](const TickArrival & a, const TickArrival & b) { return a.tick < b.tick; };
+	std::sort(fine.begin(), fine.end(), byTick);
+	std::sort(coarse.begin(), coarse.end(), byTick);
+}
+
+//one run of the station over the arrivals of one resolution (sorted by tick), the money at the end
+double runArrivals(const std::vector<TickArrival> & arrivals, long long ticksPerUnit, int T, int initialBikes, const double clientRates[4],
+	const double clientPenalty[4], bool useReneging, PatienceLine<Client> & line)
+{
+	line.clear();
+	Reneging reneging;
+	double totalMoney = (0.5 * clientRates[1]) + (0.1 * clientRates[2]);
+	int bikes = initialBikes;
+
+	size_t next = 0;
+	while (next < arrivals.size())
+	{
+		long long tick = arrivals[next].tick;
+		bool arrived[4] = { false, false, false, false };
+		double patience[4] = { 0, 0, 0, 0 };
+		for (; next < arrivals.size() && arrivals[next].tick == tick; next++)
+		{
+			arrived[arrivals[next].type] = true;
+			patience[arrivals[next].type] = arrivals[next].patience;
+		}
+		processTick(tick, bikes, line, totalMoney, reneging, arrived, clientPenalty, [&](long long tick, int type)
+		{
+			if (!useReneging) return TimingWheel::never;
+			return (uint64_t)tick + 1 + (uint64_t)(patience[type] * ticksPerUnit);
+		});
+	}
+
+	line.advanceTo((uint64_t)T * ticksPerUnit, [&](const Client & client) { reneging.abandon(client, totalMoney); });
+	return totalMoney;
+}
+
+//the money at the continuous limit to targetRmse by multilevel Monte Carlo over coarsestTicksPerUnit * refinement^l
+//ticks per interval (MultilevelMonteCarlo.h); with countBernouliDraws the samples are spread over the levels for what
+//they would cost the tick by tick loop instead of their measured time
+int estimateMultilevel(double targetRmse, long long coarsestTicksPerUnit, int refinement, int maximumLevel, bool countBernouliDraws, int T,
+	double bikeArrivalRate, const double clientRates[4], const double clientPenalty[4], bool useReneging, double meanPatience, unsigned int baseSeed)
+{
+	//rate of every bernouli stream {0: Bike Arrival, 1: Class1, 2: Class2, 3: Class3}
+	const double rates[4] = { bikeArrivalRate, clientRates[1], clientRates[2], clientRates[3] };
+
+	auto ticksPerUnitOf = [&](int level)
+	{
+		long long ticksPerUnit = coarsestTicksPerUnit;
+		for (int l = 0; l < level; l++) ticksPerUnit *= refinement;
+		return ticksPerUnit;
+	};
+	//4 bernouli draws per tick at both resolutions of a sample
+	auto drawsOf = [&](int level) { return 4.0 * T * (ticksPerUnitOf(level) + (level > 0 ? ticksPerUnitOf(level) / refinement : 0)); };
+
+	auto sample = [&](int level, int firstSample, int count)
+	{
+		long long ticksPerUnit = ticksPerUnitOf(level);
+		return reduceReplicationRange(firstSample, count, baseSeed ^ (0x9E3779B9u * (level + 1)), LevelSamples(),
+			[&](std::default_random_engine & generator, int)
+		{
+			std::vector<TickArrival> fine, coarse;
+			PatienceLine<Client> line;
+			drawCoupledArrivals(rates, ticksPerUnit, level > 0 ? refinement : 1, T, meanPatience, generator, fine, coarse);
+			double fineMoney = runArrivals(fine, ticksPerUnit, T, 10, clientRates, clientPenalty, useReneging, line);
+			double coarseMoney = level > 0 ? runArrivals(coarse, ticksPerUnit / refinement, T, 10, clientRates, clientPenalty, useReneging, line) : 0.0;
+			return std::make_pair(fineMoney, coarseMoney);
+		},
+			[](LevelSamples & samples, const std::pair<double, double> & money, int) { samples.add(money.first, money.second); });
+	};
+
+	auto begin = std::chrono::steady_clock::now();
+	MultilevelResult result = countBernouliDraws
+		? multilevelMonteCarlo(targetRmse, refinement, 1000, maximumLevel, sample, [&](int level, const MultilevelLevel &) { return drawsOf(level); })
+		: multilevelMonteCarlo(targetRmse, refinement, 1000, maximumLevel, sample);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	std::cout << "Multilevel Monte Carlo, target root mean square error " << targetRmse << std::endl;
+	double multilevelDraws = 0;
+	for (size_t level = 0; level < result.levels.size(); level++)
+	{
+		const MultilevelLevel & current = result.levels[level];
+		long long samples = current.samples.correction.count();
+		multilevelDraws += samples * drawsOf((int)level);
+		std::cout << "  level " << level << ", " << ticksPerUnitOf((int)level) << " ticks per interval : " << samples << " samples, correction "
+			<< current.samples.correction.mean() << " (variance " << current.samples.correction.variance() << "), "
+			<< 1e6 * current.costPerSample() << " us per sample" << std::endl;
+	}
+	int finestLevel = (int)result.levels.size() - 1;
+	const MultilevelLevel & finest = result.levels.back();
+	std::cout << "Average amount of money : " << result.estimate << " +-" << 1.96 * sqrt(result.variance)
+		<< ", bias beyond " << ticksPerUnitOf(finestLevel) << " ticks per interval about " << result.bias
+		<< (result.converged ? "" : " (maximum level reached)") << ", corrections decay as M^-" << result.alpha << " per level" << std::endl;
+	std::cout << "Root mean square error about " << sqrt(result.variance + result.bias * result.bias) << ", " << seconds << " sec, "
+		<< multilevelDraws << " bernouli draws tick by tick" << std::endl;
+
+	//plain trials at the finest resolution alone for the same sampling error, the skip-ahead engine takes about half the
+	//time of a coupled sample there
+	double plainSamples = 2 * finest.samples.fine.variance() / (targetRmse * targetRmse);
+	std::cout << "Plain trials at " << ticksPerUnitOf(finestLevel) << " ticks per interval : " << plainSamples << " runs, about "
+		<< plainSamples * finest.costPerSample() / (finestLevel > 0 ? 2 : 1) << " sec with skip-ahead, "
+		<< plainSamples * 4.0 * T * ticksPerUnitOf(finestLevel) << " bernouli draws tick by tick" << std::endl;
+	return 0;
+}
+
 int main()
 {
 	const int T = 120;
@@ -44,6 +324,9 @@ int main()
 	std::default_random_engine generator;
 	generator.seed(time(0));
 
+	//jump from success to success with geometric gaps instead of drawing every single tick
+	const bool useGeometricSkipAhead = true;
+
 	//We can use a bernouli distribution with paramter p = lambda / bernouliInterval
 	int bernouliInterval = 100000;
 	std::bernoulli_distribution  randomVariableGenerator[4];
@@ -52,68 +335,130 @@ int main()
 	randomVariableGenerator[2] = std::bernoulli_distribution(clientRates[2] / bernouliInterval);
 	randomVariableGenerator[3] = std::bernoulli_distribution(clientRates[3] / bernouliInterval);
 
-	const int numberOfTrials = 100;
+	//number of failed ticks before the next success of each stream
+	std::geometric_distribution<long long> gapGenerator[4];
+	gapGenerator[0] = std::geometric_distribution<long long>(bikeArrivalRate / bernouliInterval);
+	gapGenerator[1] = std::geometric_distribution<long long>(clientRates[1] / bernouliInterval);
+	gapGenerator[2] = std::geometric_distribution<long long>(clientRates[2] / bernouliInterval);
+	gapGenerator[3] = std::geometric_distribution<long long>(clientRates[3] / bernouliInterval);
+
+	//waiting clients give up after an exponential patience time (in poisson intervals), they are lost trips and a pay per
+	//ride rider who gives up takes their fare along; without reneging they wait for as long as it takes
+	const bool useReneging = true;
+	const double meanPatience = 0.25;
+	std::exponential_distribution<double> patienceGenerator(1.0 / meanPatience);
+	auto patience = [&](long long tick, int)
+	{
+		if (!useReneging) return TimingWheel::never;
+		return (uint64_t)tick + 1 + (uint64_t)(patienceGenerator(generator) * bernouliInterval);
+	};
+
+	//multilevel Monte Carlo over 100, 1000, 10000 ... ticks per interval instead of trials at a single resolution, it
+	//adds resolutions until the bias left is within the target (see MultilevelMonteCarlo.h); samples are spread over the
+	//levels for their cost tick by tick, or for their measured skip-ahead time
+	const bool useMultilevelMonteCarlo = false;
+	const bool countBernouliDraws = true;
+	if (useMultilevelMonteCarlo)
+	{
+		const double targetRmse = 0.25;
+		return estimateMultilevel(targetRmse, 100, 10, 5, countBernouliDraws, T, bikeArrivalRate, clientRates, clientPenalty,
+			useReneging, meanPatience, (unsigned int)time(0));
+	}
+
+	//the tick by tick loop is too slow for more than 100 runs
+	const int numberOfTrials = useGeometricSkipAhead ? 10000 : 100;
 	double averageMoneyAmount = 0;
+	Reneging renegingTotal;
+
+	//client queue, the patience timers of the clients in it sit in a timing wheel (see TimingWheel.h)
+	PatienceLine<Client> line;
+	const long long totalTicks = (long long)T * bernouliInterval;
 
 	std::cout << "Starting the trials" << std::endl;
 
 	for (int t = 0; t < numberOfTrials; t++)
 	{
-		//client queue
-		std::queue<Client> line;
+		line.clear();
+		Reneging reneging;
 
 		//we can assume total money starts at 0 + the deterministic annual prorated charge of clients classes 1 and 2
 		double totalMoney = (0.5 * clientRates[1]) + (0.1 * clientRates[2]);
 		X[0] = 10; //we start with 10 bikes at X(0)
 
-		for (int i = 1; i <= T; i++)
+		if (useGeometricSkipAhead)
 		{
-			X[i] = X[i - 1]; //new time interval starts with bike amount from prev interval
+			//ticks are numbered 0 .. T * bernouliInterval - 1 over the whole run, tick g belongs to interval g / bernouliInterval + 1
+			long long nextSuccess[4];
+			for (int k = 0; k < 4; k++) nextSuccess[k] = gapGenerator[k](generator);
+
+			int i = 1;
+			X[i] = X[i - 1];
 
-			for (int q = 0; q < bernouliInterval; q++)
+			while (true)
 			{
-				//see if a bike has arrived
-				if (randomVariableGenerator[0](generator)) X[i]++;
+				long long tick = std::min(std::min(nextSuccess[0], nextSuccess[1]), std::min(nextSuccess[2], nextSuccess[3]));
+				if (tick >= totalTicks) break;
 
-				//distribute the bikes to any clients waiting
-				while (!line.empty() && X[i] > 0)
+				//carry the bike count over any intervals we skipped
+				int interval = (int)(tick / bernouliInterval) + 1;
+				while (i < interval)
 				{
-					auto client = line.front();
-					line.pop(); //remove from queue
+					i++;
+					X[i] = X[i - 1];
+				}
 
-					X[i]--; //decrement bike count
+				bool arrived[4];
+				for (int k = 0; k < 4; k++)
+				{
+					arrived[k] = nextSuccess[k] == tick;
+					if (arrived[k]) nextSuccess[k] = tick + 1 + gapGenerator[k](generator);
 				}
 
-				//see if a client of class 1-3 has arrived
-				for (int j = 1; j <= 3; j++)
+				processTick(tick, X[i], line, totalMoney, reneging, arrived, clientPenalty, patience);
+			}
+
+			while (i < T)
+			{
+				i++;
+				X[i] = X[i - 1];
+			}
+		}
+		else
+		{
+			for (int i = 1; i <= T; i++)
+			{
+				X[i] = X[i - 1]; //new time interval starts with bike amount from prev interval
+
+				for (int q = 0; q < bernouliInterval; q++)
 				{
-					if (randomVariableGenerator[j](generator))
-					{
-						if (j == 3) totalMoney += 1.25; // class 3 pays per ride
-
-						//if a client arrives and there are no bikes
-						if (X[j] == 0) 
-						{
-							//add the client into the queue
-							line.emplace(Client{ j });
-							//we apply a penalty, for class3 penalty is 0
-							totalMoney += clientPenalty[j];
-						} 
-						else 
-						{
-							X[j]--; //otherise just give the client a bike
-						}
-					}
+					bool arrived[4];
+					for (int k = 0; k < 4; k++) arrived[k] = randomVariableGenerator[k](generator);
+
+					long long tick = (long long)(i - 1) * bernouliInterval + q;
+					processTick(tick, X[i], line, totalMoney, reneging, arrived, clientPenalty, patience);
 				}
 			}
 		}
 
+		//whoever runs out of patience after the last arrival still leaves before the end
+		line.advanceTo(totalTicks, [&](const Client & client) { reneging.abandon(client, totalMoney); });
+
 		std::cout << "Total Money at the end of experiment " << totalMoney << std::endl;
 		averageMoneyAmount += totalMoney;
+		renegingTotal.joined += reneging.joined;
+		renegingTotal.abandoned += reneging.abandoned;
+		renegingTotal.lostRevenue += reneging.lostRevenue;
 	}
 
 	std::cout << "Average amount of money over " << numberOfTrials << " iterations" << " : "
 		<< (averageMoneyAmount / numberOfTrials) << std::endl;
+	if (useReneging)
+	{
+		std::cout << "Clients who had to wait per run : " << (double)renegingTotal.joined / numberOfTrials << std::endl;
+		std::cout << "Abandoned (lost trips) per run : " << (double)renegingTotal.abandoned / numberOfTrials
+			<< ", abandonment rate " << (renegingTotal.joined > 0 ? (double)renegingTotal.abandoned / renegingTotal.joined : 0) << std::endl;
+		std::cout << "Lost revenue per run : " << renegingTotal.lostRevenue / numberOfTrials << std::endl;
+	}
 
 	return 0;
 }
\ No newline at end of file
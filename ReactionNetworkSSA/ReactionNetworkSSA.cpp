@@ -0,0 +1,328 @@
+/*
+	Compartment models on the reaction network engine in ReactionNetwork.h.
+
+	hw4_q4_d        the fully mixed contact model as a single reaction S + I -> 2I, a contact between two different
+	                people out of N(N - 1) ordered pairs is S-I in either order with 2SI pairs, so the rate constant
+	                is contactRate * infectionRate * 2 / (N(N - 1)). Time before complete infection should match hw4_q4_d.
+	SIR             S + I -> 2I, I -> R, final size and duration of the outbreak
+	SEIR            S + I -> E + I, E -> I, I -> R
+	SIS             S + I -> 2I, I -> S, prevalence at the end of the horizon
+	metapopulation  SIR in a ring of patches with migration of infected people to the next patch, thousands of
+	                channels, run with both simulators to compare their results and speed
+
+	large populations  the hw4_q4_d model with 10^5 people (exact next reaction against tau-leaping at three epsilons
+	                and the hybrid simulator, all against the exact mean (N - 1) H(N - 1) / (contactRate * infectionRate)),
+	                then 10^9 people where only the approximate simulators are feasible, then a station with 10^5
+	                bikes docked on average, where the pure fluid limit gets the mean right but loses all the variance.
+	                The error budgets are summed over the trials.
+
+	Output (10000 trials for hw4_q4_d, 1000 for the other small models, 400 and 20 for the large populations):
+	hw4_q4_d with next reaction (Gibson-Bruck) : average time before complete infection over 10000 trials : 1023.87
+	SIR : N = 1000, R0 = 3 : final size 937.754 duration 114.168
+	SEIR : N = 1000, R0 = 3 : final size 939.22 duration 156.946
+	SIS : N = 1000, R0 = 2 : infected at t = 500 : 484.747
+	metapopulation SIR : 1000 patches, 3000 reactions
+	next reaction (Gibson-Bruck) : final size 187.584 per patch, 3.62489e+06 events/sec
+	composition-rejection : final size 187.538 per patch, 3.84008e+06 events/sec
+	hw4_q4_d model, N = 100000 : exact mean 2.418e+06
+	  next reaction (Gibson-Bruck) : 2.423e+06 +- 18056.5 (0.206761% off the exact mean) 0.005867 sec/trial
+	  tau-leaping (Cao-Gillespie-Petzold) : 2.42522e+06 +- 18226 (0.298609% off the exact mean) 0.000113203 sec/trial
+	    epsilon 0.1 : 88507 approximate steps (0 rejected or clamped), 158070 exact steps, 99.6048% of the reactions approximated
+	    propensity change per approximate step, mean 0.0437328 largest 0.112408
+	  tau-leaping (Cao-Gillespie-Petzold) : 2.39645e+06 +- 15430 (-0.891349% off the exact mean) 0.000320107 sec/trial
+	    epsilon 0.03 : 229235 approximate steps (0 rejected or clamped), 544911 exact steps, 98.6377% of the reactions approximated
+	    propensity change per approximate step, mean 0.0125952 largest 0.0334948
+	  tau-leaping (Cao-Gillespie-Petzold) : 2.40823e+06 +- 18189.7 (-0.404367% off the exact mean) 0.000833397 sec/trial
+	    epsilon 0.01 : 515164 approximate steps (0 rejected or clamped), 1597991 exact steps, 96.005% of the reactions approximated
+	    propensity change per approximate step, mean 0.0039551 largest 0.0125775
+	  hybrid (Langevin fluid + exact) : 2.42945e+06 +- 18622 (0.47359% off the exact mean) 0.000252642 sec/trial
+	    epsilon 0.03 : 104496 approximate steps (0 rejected or clamped), 793629 exact steps, 98.0157% of the reactions approximated
+	    propensity change per approximate step, mean 0.0247737 largest 0.0485343
+	hw4_q4_d model, N = 1000000000 : exact mean 4.2601e+10
+	  tau-leaping (Cao-Gillespie-Petzold) : 4.30424e+10 +- 8.32301e+08 (1.03633% off the exact mean) 0.000743298 sec/trial
+	    epsilon 0.03 : 36007 approximate steps (0 rejected or clamped), 27250 exact steps, 99.9999% of the reactions approximated
+	    propensity change per approximate step, mean 0.0142331 largest 0.0320855
+	  hybrid (Langevin fluid + exact) : 4.22275e+10 +- 7.4462e+08 (-0.876596% off the exact mean) 0.000279371 sec/trial
+	    epsilon 0.03 : 17511 approximate steps (0 rejected or clamped), 39572 exact steps, 99.9998% of the reactions approximated
+	    propensity change per approximate step, mean 0.028413 largest 0.0441378
+	loaded station, docked bikes at t = 20 : exact mean and variance 100000
+	  tau-leaping (Cao-Gillespie-Petzold) : mean 100014 +- 45.5094 variance 107825 0.00104094 sec/trial
+	  hybrid (ODE fluid + exact) : mean 100000 +- 0 variance 0 0.000238907 sec/trial
+	  hybrid (Langevin fluid + exact) : mean 100004 +- 43.9411 variance 100522 0.000377494 sec/trial
+*/
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include "../SimulationCommon/ReactionNetwork.h"
+#include "../SimulationCommon/StreamingStatistics.h"
+#include "../SimulationCommon/TauLeaping.h"
+
+//S + I -> 2I with the contact structure of hw4_q4_d
+ReactionNetwork fullyMixedContactModel(long long N, double contactRate, double infectionRate)
+{
+	ReactionNetwork network;
+	int S = network.addSpecies("S", N - 1);
+	int I = network.addSpecies("I", 1);
+	network.addReaction(contactRate * infectionRate * 2.0 / ((double)N * (N - 1)), { { S, 1 }, { I, 1 } }, { { I, 2 } });
+	network.finalize();
+	return network;
+}
+
+//beta is the contact rate per infected, recovery the rate of I -> R, SEIR if incubation > 0
+ReactionNetwork sirModel(long long N, long long initialInfected, double beta, double recovery, double incubation = 0)
+{
+	ReactionNetwork network;
+	int S = network.addSpecies("S", N - initialInfected);
+	int E = incubation > 0 ? network.addSpecies("E", 0) : -1;
+	int I = network.addSpecies("I", initialInfected);
+	int R = network.addSpecies("R", 0);
+
+	if (incubation > 0)
+	{
+		network.addReaction(beta / N, { { S, 1 }, { I, 1 } }, { { E, 1 }, { I, 1 } });
+		network.addReaction(incubation, { { E, 1 } }, { { I, 1 } });
+	}
+	else
+	{
+		network.addReaction(beta / N, { { S, 1 }, { I, 1 } }, { { I, 2 } });
+	}
+	network.addReaction(recovery, { { I, 1 } }, { { R, 1 } });
+	network.finalize();
+	return network;
+}
+
+ReactionNetwork sisModel(long long N, long long initialInfected, double beta, double recovery)
+{
+	ReactionNetwork network;
+	int S = network.addSpecies("S", N - initialInfected);
+	int I = network.addSpecies("I", initialInfected);
+	network.addReaction(beta / N, { { S, 1 }, { I, 1 } }, { { I, 2 } });
+	network.addReaction(recovery, { { I, 1 } }, { { S, 1 } });
+	network.finalize();
+	return network;
+}
+
+//ring of patches, each an SIR model, infected people move on to the next patch at migration rate
+ReactionNetwork metapopulationModel(int patches, long long perPatch, double beta, double recovery, double migration)
+{
+	ReactionNetwork network;
+	std::vector<int> S(patches), I(patches), R(patches);
+	for (int p = 0; p < patches; p++)
+	{
+		S[p] = network.addSpecies("S" + std::to_string(p), perPatch - (p == 0 ? 5 : 0));
+		I[p] = network.addSpecies("I" + std::to_string(p), p == 0 ? 5 : 0);
+		R[p] = network.addSpecies("R" + std::to_string(p), 0);
+	}
+	for (int p = 0; p < patches; p++)
+	{
+		network.addReaction(beta / perPatch, { { S[p], 1 }, { I[p], 1 } }, { { I[p], 2 } });
+		network.addReaction(recovery, { { I[p], 1 } }, { { R[p], 1 } });
+		network.addReaction(migration, { { I[p], 1 } }, { { I[(p + 1) % patches], 1 } });
+	}
+	network.finalize();
+	return network;
+}
+
+//heavily loaded station as an immigration death process, bikes are returned at arrivalRate and each one docked
+//leaves at departureRate, so the count at the end is Poisson with mean arrivalRate / departureRate once it settled
+ReactionNetwork loadedStationModel(double arrivalRate, double departureRate)
+{
+	ReactionNetwork network;
+	int B = network.addSpecies("B", 0);
+	network.addReaction(arrivalRate, {}, { { B, 1 } });
+	network.addReaction(departureRate, { { B, 1 } }, {});
+	network.finalize();
+	return network;
+}
+
+//exact mean time before complete infection of the fully mixed model, 1 / (c k (N - k)) summed over k infected
+double expectedTimeToFullInfection(long long N, double contactRate, double infectionRate)
+{
+	double harmonic = 0;
+	for (long long k = N - 1; k >= 1; k--) harmonic += 1.0 / k;
+	return (N - 1) * harmonic / (contactRate * infectionRate);
+}
+
+//the exact simulators have no error budget
+void recordApproximation(const ReactionSimulator &, ApproximationReport &) {}
+void recordApproximation(const TauLeapingSimulator & simulator, ApproximationReport & budget) { budget.epsilon = simulator.approximation().epsilon; budget.merge(simulator.approximation()); }
+void recordApproximation(const HybridSimulator & simulator, ApproximationReport & budget) { budget.epsilon = simulator.approximation().epsilon; budget.merge(simulator.approximation()); }
+void printApproximation(const ReactionSimulator &, const ApproximationReport &) {}
+void printApproximation(const TauLeapingSimulator &, const ApproximationReport & budget) { std::cout << "    "; budget.print(std::cout); }
+void printApproximation(const HybridSimulator &, const ApproximationReport & budget) { std::cout << "    "; budget.print(std::cout); }
+
+//time before complete infection with any simulator, prints the interval, the time per trial and the error budget
+template <typename Simulator>
+void runFullInfection(Simulator & simulator, std::default_random_engine & generator, int numTrials, double expected)
+{
+	RunningMoments times;
+	ApproximationReport budget;
+	auto start = std::chrono::steady_clock::now();
+	for (int trial = 0; trial < numTrials; trial++)
+	{
+		simulator.reset(generator);
+		times.add(simulator.run(generator, INFINITY, [](const std::vector<long long> & counts, double) { return counts[0] == 0; }));
+		recordApproximation(simulator, budget);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "  " << simulator.name() << " : " << times.mean() << " +- " << times.halfWidth()<< " (" << (times.mean() - expected) / expected * 100
+		<< "% off the exact mean) " << seconds / numTrials << " sec/trial" << std::endl;
+	printApproximation(simulator, budget);
+}
+
+//mean final number of recovered per trial (summed over every species whose name starts with R) and outbreak duration
+void runOutbreaks(const char * label, const ReactionNetwork & network, ReactionSimulator & simulator, std::default_random_engine & generator, int numTrials)
+{
+	double finalSize = 0, duration = 0;
+	for (int trial = 0; trial < numTrials; trial++)
+	{
+		simulator.reset(generator);
+		duration += simulator.run(generator, INFINITY);
+		for (int s = 0; s < network.speciesCount(); s++)
+		{
+			if (network.speciesName(s)[0] == 'R') finalSize += simulator.state()[s];
+		}
+	}
+	std::cout << label << " : final size " << finalSize / numTrials << " duration " << duration / numTrials << std::endl;
+}
+
+int main()
+{
+	//create and seed the generator
+	std::default_random_engine generator;
+	generator.seed(time(0));
+
+	bool runLargePopulations = true;
+
+	//hw4_q4_d, run until nobody is healthy
+	{
+		const int numTrials = 10000;
+		ReactionNetwork network = fullyMixedContactModel(100, 1, 0.5);
+		std::unique_ptr<ReactionSimulator> simulator = makeReactionSimulator(network);
+		double totalTime = 0;
+		for (int trial = 0; trial < numTrials; trial++)
+		{
+			simulator->reset(generator);
+			totalTime += simulator->run(generator, INFINITY, [](const std::vector<long long> & counts, double) { return counts[0] == 0; });
+		}
+		std::cout << "hw4_q4_d with " << simulator->name() << " : average time before complete infection over " << numTrials
+			<< " trials : " << totalTime / numTrials << std::endl;
+	}
+
+	const int numTrials = 1000;
+	{
+		ReactionNetwork network = sirModel(1000, 5, 0.3, 0.1);
+		NextReactionSimulator simulator(network);
+		runOutbreaks("SIR : N = 1000, R0 = 3", network, simulator, generator, numTrials);
+	}
+	{
+		ReactionNetwork network = sirModel(1000, 5, 0.3, 0.1, 0.2);
+		NextReactionSimulator simulator(network);
+		runOutbreaks("SEIR : N = 1000, R0 = 3", network, simulator, generator, numTrials);
+	}
+	{
+		ReactionNetwork network = sisModel(1000, 5, 0.2, 0.1);
+		NextReactionSimulator simulator(network);
+		double infected = 0;
+		for (int trial = 0; trial < numTrials; trial++)
+		{
+			simulator.reset(generator);
+			simulator.run(generator, 500);
+			infected += simulator.state()[1];
+		}
+		std::cout << "SIS : N = 1000, R0 = 2 : infected at t = 500 : " << infected / numTrials << std::endl;
+	}
+
+	//the same metapopulation through both simulators, the results should agree and composition-rejection should win
+	{
+		const int patches = 1000;
+		ReactionNetwork network = metapopulationModel(patches, 200, 0.3, 0.1, 0.05);
+		std::cout << "metapopulation SIR : " << patches << " patches, " << network.reactionCount() << " reactions" << std::endl;
+
+		NextReactionSimulator nextReaction(network);
+		CompositionRejectionSimulator compositionRejection(network);
+		ReactionSimulator * simulators[2] = { &nextReaction, &compositionRejection };
+		for (ReactionSimulator * simulator : simulators)
+		{
+			const int metapopulationTrials = 20;
+			double recovered = 0;
+			long long events = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (int trial = 0; trial < metapopulationTrials; trial++)
+			{
+				simulator->reset(generator);
+				simulator->run(generator, INFINITY);
+				for (int p = 0; p < patches; p++) recovered += simulator->state()[3 * p + 2];
+				events += simulator->eventCount();
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << simulator->name() << " : final size " << recovered / metapopulationTrials / patches << " per patch, "
+				<< events / seconds << " events/sec" << std::endl;
+		}
+	}
+
+	//approximate simulators for populations far beyond exact simulation, checked against the exact mean and a smaller
+	//population that the exact simulator can still do, epsilon trades bias for speed
+	if (runLargePopulations)
+	{
+		const long long smallN = 100000;
+		const int smallTrials = 400;
+		double expected = expectedTimeToFullInfection(smallN, 1, 0.5);
+		std::cout << "hw4_q4_d model, N = " << smallN << " : exact mean " << expected << std::endl;
+		ReactionNetwork small = fullyMixedContactModel(smallN, 1, 0.5);
+		NextReactionSimulator exact(small);
+		runFullInfection(exact, generator, smallTrials, expected);
+		for (double epsilon : { 0.1, 0.03, 0.01 })
+		{
+			TauLeapingSimulator tauLeaping(small, epsilon);
+			runFullInfection(tauLeaping, generator, smallTrials, expected);
+		}
+		HybridSimulator hybrid(small, 0.03);
+		runFullInfection(hybrid, generator, smallTrials, expected);
+
+		const long long largeN = 1000000000;
+		const int largeTrials = 20;
+		expected = expectedTimeToFullInfection(largeN, 1, 0.5);
+		std::cout << "hw4_q4_d model, N = " << largeN << " : exact mean " << expected << std::endl;
+		ReactionNetwork large = fullyMixedContactModel(largeN, 1, 0.5);
+		TauLeapingSimulator largeTauLeaping(large, 0.03);
+		runFullInfection(largeTauLeaping, generator, largeTrials, expected);
+		HybridSimulator largeHybrid(large, 0.03);
+		runFullInfection(largeHybrid, generator, largeTrials, expected);
+
+		//a station with 10^5 bikes docked on average, the count at the end should be Poisson(10^5): the fluid
+		//limit gets the mean but loses the variance, the diffusion term keeps it
+		const double arrivalRate = 100000, departureRate = 1, horizon = 20;
+		const int stationTrials = 200;
+		ReactionNetwork station = loadedStationModel(arrivalRate, departureRate);
+		TauLeapingSimulator stationTauLeaping(station, 0.03);
+		HybridSimulator stationFluid(station, 0.03, 1000, false);
+		HybridSimulator stationLangevin(station, 0.03, 1000, true);
+		ReactionSimulator * stationSimulators[3] = { &stationTauLeaping, &stationFluid, &stationLangevin };
+		std::cout << "loaded station, docked bikes at t = " << horizon << " : exact mean and variance " << arrivalRate / departureRate << std::endl;
+		for (ReactionSimulator * simulator : stationSimulators)
+		{
+			RunningMoments docked;
+			auto start = std::chrono::steady_clock::now();
+			for (int trial = 0; trial < stationTrials; trial++)
+			{
+				simulator->reset(generator);
+				simulator->run(generator, horizon);
+				docked.add((double)simulator->state()[0]);
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << "  " << simulator->name() << " : mean " << docked.mean() << " +- " << docked.halfWidth() << " variance " << docked.variance()
+				<< " " << seconds / stationTrials << " sec/trial" << std::endl;
+		}
+	}
+
+	std::getchar();
+
+	return 0;
+}
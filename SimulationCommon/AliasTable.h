@@ -0,0 +1,119 @@
+#pragma once
+
+/*
+	Walker's alias method with Vose's construction: after O(n) setup, drawing from any discrete distribution costs one
+	uniform, one multiply, one compare and at most two table reads, no matter how many outcomes there are.
+
+	The uniform is split in two, its integer part picks a column and its fraction decides between the column and its
+	alias, so a 52 bit uniform from BatchVariates.h is plenty for tables of up to a few million entries.
+
+	AliasTable     a single distribution
+	AliasTableSet  many distributions over the same number of outcomes (e.g. one destination table per station)
+	               stored back to back, so the tables of neighbouring rows share cache lines
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//fills probability[0 .. n) and alias[0 .. n) for the (not necessarily normalised) weights, n > 0
+inline void buildAliasTable(const double * weights, size_t n, double * probability, uint32_t * alias)
+{
+	double total = 0;
+	for (size_t i = 0; i < n; i++) total += weights[i];
+
+	std::vector<double> scaled(n);
+	std::vector<uint32_t> small, large;
+	for (size_t i = 0; i < n; i++)
+	{
+		scaled[i] = total > 0 ? weights[i] * n / total : 1.0;
+		if (scaled[i] < 1) small.push_back((uint32_t)i);
+		else large.push_back((uint32_t)i);
+	}
+
+	//pair every column below 1 with one above, which gives it the rest of its column
+	while (!small.empty() && !large.empty())
+	{
+		uint32_t less = small.back(), more = large.back();
+		small.pop_back();
+		probability[less] = scaled[less];
+		alias[less] = more;
+		scaled[more] -= 1 - scaled[less];
+		if (scaled[more] < 1)
+		{
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+
+	//whatever is left is 1 up to rounding
+	for (uint32_t i : large)
+	{
+		probability[i] = 1;
+		alias[i] = i;
+	}
+	for (uint32_t i : small)
+	{
+		probability[i] = 1;
+		alias[i] = i;
+	}
+}
+
+class AliasTable
+{
+public:
+	AliasTable() {}
+	explicit AliasTable(const std::vector<double> & weights) { build(weights); }
+
+	void build(const std::vector<double> & weights)
+	{
+		probability.resize(weights.size());
+		alias.resize(weights.size());
+		buildAliasTable(weights.data(), weights.size(), probability.data(), alias.data());
+	}
+
+	//outcome for a uniform in [0, 1)
+	uint32_t sample(double uniform) const
+	{
+		double scaled = uniform * probability.size();
+		uint32_t column = (uint32_t)scaled;
+		uint32_t other = alias[column]; //read before the compare so it becomes a conditional move, not a branch
+		return scaled - column < probability[column] ? column : other;
+	}
+
+	size_t size() const { return probability.size(); }
+
+private:
+	std::vector<double> probability;
+	std::vector<uint32_t> alias;
+};
+
+class AliasTableSet
+{
+public:
+	AliasTableSet() {}
+	AliasTableSet(size_t rows, size_t columns) : columns(columns), probability(rows * columns), alias(rows * columns) {}
+
+	void setRow(size_t row, const double * weights)
+	{
+		buildAliasTable(weights, columns, probability.data() + row * columns, alias.data() + row * columns);
+	}
+
+	//outcome (column) of the given row for a uniform in [0, 1)
+	uint32_t sample(size_t row, double uniform) const
+	{
+		double scaled = uniform * columns;
+		uint32_t column = (uint32_t)scaled;
+		size_t entry = row * columns + column;
+		uint32_t other = alias[entry];
+		return scaled - column < probability[entry] ? column : other;
+	}
+
+	size_t rowCount() const { return columns > 0 ? probability.size() / columns : 0; }
+	size_t columnCount() const { return columns; }
+
+private:
+	size_t columns = 0;
+	std::vector<double> probability;
+	std::vector<uint32_t> alias;
+};
@@ -0,0 +1,654 @@
+#pragma once
+
+/*
+	Batched random variate generation.
+
+	Instead of calling a <random> distribution once per event, the simulators pull from a VariateStream that refills
+	a buffer of a few hundred variates at a time. The buffers are filled by BatchRandomEngine, an 8 lane xoshiro256+
+	generator laid out as structure of arrays, so one step of all 8 lanes is a handful of vector instructions:
+		uniforms      raw 64 bit words turned into doubles in [0, 1) with the exponent trick
+		exponentials  Marsaglia & Tsang's 256 layer ziggurat, the fast path (~99% of draws) runs in the vector
+		              kernel with table gathers, the rare rejections are fixed up afterwards in scalar code
+		gammas        Marsaglia & Tsang's squeeze method, scalar, fed from vector filled uniform buffers
+
+	The kernel (AVX-512, AVX2 or plain scalar) is picked at runtime from what the CPU supports. Every kernel produces
+	exactly the same numbers for the same seed, they only differ in speed, so results never depend on the machine.
+
+	CompactRandomStream is the unbuffered scalar version of one lane, for when every entity needs its own stream.
+*/
+
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define BATCH_VARIATES_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#endif
+
+//gcc and clang only emit AVX instructions in functions that ask for them, msvc allows the intrinsics anywhere
+#if defined(__GNUC__) || defined(__clang__)
+#define BATCH_VARIATES_TARGET(features) __attribute__((target(features)))
+#else
+#define BATCH_VARIATES_TARGET(features)
+#endif
+
+enum class BatchKernel
+{
+	Scalar,
+	Avx2,
+	Avx512
+};
+
+//splitmix64, used to expand seeds into generator states and to derive independent stream seeds
+inline uint64_t splitMix64(uint64_t & state)
+{
+	uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+//derives the seed of one stream from a base seed and up to two indices (trial, event class...)
+inline uint64_t mixStreamSeed(uint64_t baseSeed, uint64_t first, uint64_t second = 0)
+{
+	uint64_t state = baseSeed;
+	uint64_t mixed = splitMix64(state) ^ first;
+	state = mixed;
+	mixed = splitMix64(state) ^ second;
+	state = mixed;
+	return splitMix64(state);
+}
+
+//ziggurat tables for the standard exponential, Marsaglia & Tsang (2000) with 256 layers
+//k holds the acceptance thresholds and w the scale of the 32 bit integer, both as doubles so the kernels can gather them
+struct ExponentialZiggurat
+{
+	double k[256];
+	double w[256];
+	double f[256];
+
+	static const ExponentialZiggurat & tables()
+	{
+		static const ExponentialZiggurat instance;
+		return instance;
+	}
+
+	static double tailStart() { return 7.697117470131487; }
+
+private:
+	ExponentialZiggurat()
+	{
+		const double m2 = 4294967296.0;
+		const double v = 3.949659822581572e-3;
+		double d = tailStart();
+		double t = d;
+		double q = v / exp(-d);
+
+		k[0] = floor((d / q) * m2);
+		k[1] = 0;
+		w[0] = q / m2;
+		w[255] = d / m2;
+		f[0] = 1.0;
+		f[255] = exp(-d);
+
+		for (int i = 254; i >= 1; i--)
+		{
+			d = -log(v / d + exp(-d));
+			k[i + 1] = floor((d / t) * m2);
+			t = d;
+			f[i] = exp(-d);
+			w[i] = d / m2;
+		}
+	}
+};
+
+//the bits of a raw word used by the ziggurat: upper 32 bits are the integer, bits 11..18 the layer
+//(xoshiro256+ has weak lowest bits so they are never used)
+inline uint64_t zigguratLayer(uint64_t raw) { return (raw >> 11) & 255; }
+inline uint64_t zigguratInteger(uint64_t raw) { return raw >> 32; }
+
+//[0, 1) with 52 random bits, the same bit trick the vector kernels use
+inline double rawToUniform(uint64_t raw)
+{
+	union { uint64_t bits; double value; } converted;
+	converted.bits = (raw >> 12) | 0x3FF0000000000000ull;
+	return converted.value - 1.0;
+}
+
+inline uint64_t rotateLeft(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+//one xoshiro256+ step of lane l
+inline uint64_t xoshiroStep(uint64_t state[4][8], int l)
+{
+	uint64_t result = state[0][l] + state[3][l];
+	uint64_t t = state[1][l] << 17;
+	state[2][l] ^= state[0][l];
+	state[3][l] ^= state[1][l];
+	state[1][l] ^= state[2][l];
+	state[0][l] ^= state[3][l];
+	state[2][l] ^= t;
+	state[3][l] = rotateLeft(state[3][l], 45);
+	return result;
+}
+
+//fast ziggurat path, a draw outside the rectangles comes back negative as -(1 + 256 * integer + layer) so the
+//fix-up pass can carry on with the same layer and integer (40 bits, exact in a double)
+inline double zigguratFastPath(uint64_t raw, const ExponentialZiggurat & zig)
+{
+	double integer = (double)zigguratInteger(raw);
+	uint64_t layer = zigguratLayer(raw);
+	return integer < zig.k[layer] ? integer * zig.w[layer] : -(1 + 256 * integer + (double)layer);
+}
+
+//scalar kernels, the reference every vector kernel has to match bit for bit
+inline void fillUniformScalar(uint64_t state[4][8], double * out, size_t blocks)
+{
+	for (size_t b = 0; b < blocks; b++)
+	{
+		for (int l = 0; l < 8; l++) out[8 * b + l] = rawToUniform(xoshiroStep(state, l));
+	}
+}
+
+inline void fillExponentialFastScalar(uint64_t state[4][8], double * out, size_t blocks)
+{
+	const ExponentialZiggurat & zig = ExponentialZiggurat::tables();
+	for (size_t b = 0; b < blocks; b++)
+	{
+		for (int l = 0; l < 8; l++) out[8 * b + l] = zigguratFastPath(xoshiroStep(state, l), zig);
+	}
+}
+
+#ifdef BATCH_VARIATES_X86
+
+BATCH_VARIATES_TARGET("avx2")
+inline __m256i xoshiroStepAvx2(__m256i & s0, __m256i & s1, __m256i & s2, __m256i & s3)
+{
+	__m256i result = _mm256_add_epi64(s0, s3);
+	__m256i t = _mm256_slli_epi64(s1, 17);
+	s2 = _mm256_xor_si256(s2, s0);
+	s3 = _mm256_xor_si256(s3, s1);
+	s1 = _mm256_xor_si256(s1, s2);
+	s0 = _mm256_xor_si256(s0, s3);
+	s2 = _mm256_xor_si256(s2, t);
+	s3 = _mm256_or_si256(_mm256_slli_epi64(s3, 45), _mm256_srli_epi64(s3, 19));
+	return result;
+}
+
+//the 8 lanes are handled as two independent groups of 4, each writing its half of every block
+BATCH_VARIATES_TARGET("avx2")
+inline void fillUniformAvx2(uint64_t state[4][8], double * out, size_t blocks)
+{
+	const __m256i exponent = _mm256_set1_epi64x(0x3FF0000000000000ll);
+	const __m256d one = _mm256_set1_pd(1.0);
+
+	for (int half = 0; half < 2; half++)
+	{
+		__m256i s0 = _mm256_loadu_si256((const __m256i *)&state[0][4 * half]);
+		__m256i s1 = _mm256_loadu_si256((const __m256i *)&state[1][4 * half]);
+		__m256i s2 = _mm256_loadu_si256((const __m256i *)&state[2][4 * half]);
+		__m256i s3 = _mm256_loadu_si256((const __m256i *)&state[3][4 * half]);
+
+		for (size_t b = 0; b < blocks; b++)
+		{
+			__m256i raw = xoshiroStepAvx2(s0, s1, s2, s3);
+			__m256d value = _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(raw, 12), exponent));
+			_mm256_storeu_pd(out + 8 * b + 4 * half, _mm256_sub_pd(value, one));
+		}
+
+		_mm256_storeu_si256((__m256i *)&state[0][4 * half], s0);
+		_mm256_storeu_si256((__m256i *)&state[1][4 * half], s1);
+		_mm256_storeu_si256((__m256i *)&state[2][4 * half], s2);
+		_mm256_storeu_si256((__m256i *)&state[3][4 * half], s3);
+	}
+}
+
+BATCH_VARIATES_TARGET("avx2")
+inline void fillExponentialFastAvx2(uint64_t state[4][8], double * out, size_t blocks)
+{
+	const ExponentialZiggurat & zig = ExponentialZiggurat::tables();
+	const __m256i layerMask = _mm256_set1_epi64x(255);
+	const __m256i magicBits = _mm256_set1_epi64x(0x4330000000000000ll); //2^52, turns a 32 bit integer into a double
+	const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+	const __m256d minusOne = _mm256_set1_pd(-1.0);
+	const __m256d minus256 = _mm256_set1_pd(-256.0);
+
+	for (int half = 0; half < 2; half++)
+	{
+		__m256i s0 = _mm256_loadu_si256((const __m256i *)&state[0][4 * half]);
+		__m256i s1 = _mm256_loadu_si256((const __m256i *)&state[1][4 * half]);
+		__m256i s2 = _mm256_loadu_si256((const __m256i *)&state[2][4 * half]);
+		__m256i s3 = _mm256_loadu_si256((const __m256i *)&state[3][4 * half]);
+
+		for (size_t b = 0; b < blocks; b++)
+		{
+			__m256i raw = xoshiroStepAvx2(s0, s1, s2, s3);
+			__m256i layer = _mm256_and_si256(_mm256_srli_epi64(raw, 11), layerMask);
+			__m256d integer = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(raw, 32), magicBits)), magic);
+
+			__m256d threshold = _mm256_i64gather_pd(zig.k, layer, 8);
+			__m256d scale = _mm256_i64gather_pd(zig.w, layer, 8);
+			__m256d layerValue = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(layer, magicBits)), magic);
+			__m256d rejected = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(integer, minus256), minusOne), layerValue);
+			__m256d accepted = _mm256_cmp_pd(integer, threshold, _CMP_LT_OQ);
+			__m256d value = _mm256_blendv_pd(rejected, _mm256_mul_pd(integer, scale), accepted);
+			_mm256_storeu_pd(out + 8 * b + 4 * half, value);
+		}
+
+		_mm256_storeu_si256((__m256i *)&state[0][4 * half], s0);
+		_mm256_storeu_si256((__m256i *)&state[1][4 * half], s1);
+		_mm256_storeu_si256((__m256i *)&state[2][4 * half], s2);
+		_mm256_storeu_si256((__m256i *)&state[3][4 * half], s3);
+	}
+}
+
+BATCH_VARIATES_TARGET("avx512f")
+inline __m512i xoshiroStepAvx512(__m512i & s0, __m512i & s1, __m512i & s2, __m512i & s3)
+{
+	__m512i result = _mm512_add_epi64(s0, s3);
+	__m512i t = _mm512_slli_epi64(s1, 17);
+	s2 = _mm512_xor_si512(s2, s0);
+	s3 = _mm512_xor_si512(s3, s1);
+	s1 = _mm512_xor_si512(s1, s2);
+	s0 = _mm512_xor_si512(s0, s3);
+	s2 = _mm512_xor_si512(s2, t);
+	s3 = _mm512_rol_epi64(s3, 45);
+	return result;
+}
+
+BATCH_VARIATES_TARGET("avx512f")
+inline void fillUniformAvx512(uint64_t state[4][8], double * out, size_t blocks)
+{
+	const __m512i exponent = _mm512_set1_epi64(0x3FF0000000000000ll);
+	const __m512d one = _mm512_set1_pd(1.0);
+
+	__m512i s0 = _mm512_loadu_si512(state[0]);
+	__m512i s1 = _mm512_loadu_si512(state[1]);
+	__m512i s2 = _mm512_loadu_si512(state[2]);
+	__m512i s3 = _mm512_loadu_si512(state[3]);
+
+	for (size_t b = 0; b < blocks; b++)
+	{
+		__m512i raw = xoshiroStepAvx512(s0, s1, s2, s3);
+		__m512d value = _mm512_castsi512_pd(_mm512_or_si512(_mm512_srli_epi64(raw, 12), exponent));
+		_mm512_storeu_pd(out + 8 * b, _mm512_sub_pd(value, one));
+	}
+
+	_mm512_storeu_si512(state[0], s0);
+	_mm512_storeu_si512(state[1], s1);
+	_mm512_storeu_si512(state[2], s2);
+	_mm512_storeu_si512(state[3], s3);
+}
+
+BATCH_VARIATES_TARGET("avx512f")
+inline void fillExponentialFastAvx512(uint64_t state[4][8], double * out, size_t blocks)
+{
+	const ExponentialZiggurat & zig = ExponentialZiggurat::tables();
+	const __m512i layerMask = _mm512_set1_epi64(255);
+	const __m512i magicBits = _mm512_set1_epi64(0x4330000000000000ll);
+	const __m512d magic = _mm512_set1_pd(4503599627370496.0);
+	const __m512d minusOne = _mm512_set1_pd(-1.0);
+	const __m512d minus256 = _mm512_set1_pd(-256.0);
+
+	__m512i s0 = _mm512_loadu_si512(state[0]);
+	__m512i s1 = _mm512_loadu_si512(state[1]);
+	__m512i s2 = _mm512_loadu_si512(state[2]);
+	__m512i s3 = _mm512_loadu_si512(state[3]);
+
+	for (size_t b = 0; b < blocks; b++)
+	{
+		__m512i raw = xoshiroStepAvx512(s0, s1, s2, s3);
+		__m512i layer = _mm512_and_si512(_mm512_srli_epi64(raw, 11), layerMask);
+		__m512d integer = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(_mm512_srli_epi64(raw, 32), magicBits)), magic);
+
+		__m512d threshold = _mm512_i64gather_pd(layer, zig.k, 8);
+		__m512d scale = _mm512_i64gather_pd(layer, zig.w, 8);
+		__m512d layerValue = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(layer, magicBits)), magic);
+		__m512d rejected = _mm512_sub_pd(_mm512_add_pd(_mm512_mul_pd(integer, minus256), minusOne), layerValue);
+		__mmask8 accepted = _mm512_cmp_pd_mask(integer, threshold, _CMP_LT_OQ);
+		_mm512_storeu_pd(out + 8 * b, _mm512_mask_mul_pd(rejected, accepted, integer, scale));
+	}
+
+	_mm512_storeu_si512(state[0], s0);
+	_mm512_storeu_si512(state[1], s1);
+	_mm512_storeu_si512(state[2], s2);
+	_mm512_storeu_si512(state[3], s3);
+}
+
+//checks the cpu and that the os saves the wide registers on context switches
+inline bool cpuSupportsBatchKernel(BatchKernel kernel)
+{
+	if (kernel == BatchKernel::Scalar) return true;
+
+	int leaf1[4] = { 0 }, leaf7[4] = { 0 };
+#if defined(_MSC_VER)
+	__cpuid(leaf1, 1);
+	__cpuidex(leaf7, 7, 0);
+#else
+	__cpuid_count(1, 0, leaf1[0], leaf1[1], leaf1[2], leaf1[3]);
+	__cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+#endif
+
+	bool osxsave = (leaf1[2] & (1 << 27)) != 0;
+	if (!osxsave) return false;
+
+#if defined(_MSC_VER)
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int xcrLow, xcrHigh;
+	__asm__("xgetbv" : "=a"(xcrLow), "=d"(xcrHigh) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)xcrHigh << 32) | xcrLow;
+#endif
+
+	bool ymmSaved = (xcr0 & 0x6) == 0x6;
+	bool zmmSaved = (xcr0 & 0xE6) == 0xE6;
+	bool avx2 = (leaf7[1] & (1 << 5)) != 0;
+	bool avx512f = (leaf7[1] & (1 << 16)) != 0;
+
+	if (kernel == BatchKernel::Avx2) return avx2 && ymmSaved;
+	return avx512f && zmmSaved;
+}
+
+#else
+
+inline bool cpuSupportsBatchKernel(BatchKernel kernel) { return kernel == BatchKernel::Scalar; }
+
+#endif
+
+//the kernel used by every engine, detected once, can be overridden (e.g. to compare kernels)
+inline BatchKernel & activeBatchKernel()
+{
+	static BatchKernel kernel =
+		cpuSupportsBatchKernel(BatchKernel::Avx512) ? BatchKernel::Avx512 :
+		cpuSupportsBatchKernel(BatchKernel::Avx2) ? BatchKernel::Avx2 : BatchKernel::Scalar;
+	return kernel;
+}
+
+inline const char * batchKernelName(BatchKernel kernel)
+{
+	return kernel == BatchKernel::Avx512 ? "AVX-512" : kernel == BatchKernel::Avx2 ? "AVX2" : "scalar";
+}
+
+class BatchRandomEngine
+{
+public:
+	explicit BatchRandomEngine(uint64_t seed = 1) { this->seed(seed); }
+
+	void seed(uint64_t seed)
+	{
+		uint64_t expander = seed;
+		for (int word = 0; word < 4; word++)
+		{
+			for (int l = 0; l < 8; l++) state[word][l] = splitMix64(expander);
+		}
+		for (int word = 0; word < 4; word++) fixupState[word][0] = splitMix64(expander);
+	}
+
+	//uniforms in [0, 1), n does not have to be a multiple of the 8 lanes
+	void fillUniform(double * out, size_t n)
+	{
+		size_t blocks = n / 8;
+		switch (activeBatchKernel())
+		{
+#ifdef BATCH_VARIATES_X86
+		case BatchKernel::Avx512: fillUniformAvx512(state, out, blocks); break;
+		case BatchKernel::Avx2: fillUniformAvx2(state, out, blocks); break;
+#endif
+		default: fillUniformScalar(state, out, blocks); break;
+		}
+
+		if (n % 8 != 0)
+		{
+			double tail[8];
+			fillUniformScalar(state, tail, 1);
+			for (size_t i = 0; i < n % 8; i++) out[8 * blocks + i] = tail[i];
+		}
+	}
+
+	//exponentials with the given rate
+	void fillExponential(double * out, size_t n, double rate)
+	{
+		size_t blocks = n / 8;
+		switch (activeBatchKernel())
+		{
+#ifdef BATCH_VARIATES_X86
+		case BatchKernel::Avx512: fillExponentialFastAvx512(state, out, blocks); break;
+		case BatchKernel::Avx2: fillExponentialFastAvx2(state, out, blocks); break;
+#endif
+		default: fillExponentialFastScalar(state, out, blocks); break;
+		}
+
+		if (n % 8 != 0)
+		{
+			double tail[8];
+			fillExponentialFastScalar(state, tail, 1);
+			for (size_t i = 0; i < n % 8; i++) out[8 * blocks + i] = tail[i];
+		}
+
+		//rejected draws come back negative, finish them in order from the scalar stream so every kernel agrees
+		const double scale = 1.0 / rate;
+		for (size_t i = 0; i < n; i++)
+		{
+			if (out[i] < 0)
+			{
+				uint64_t code = (uint64_t)(-out[i] - 1);
+				out[i] = exponentialSlowPath(code & 255, (double)(code >> 8));
+			}
+			out[i] *= scale;
+		}
+	}
+
+	//gammas with the given shape and scale (mean shape * scale)
+	void fillGamma(double * out, size_t n, double shape, double scale)
+	{
+		//shape < 1 is boosted, gamma(a) = gamma(a + 1) * U^(1/a)
+		const bool boosted = shape < 1;
+		const double d = (boosted ? shape + 1 : shape) - 1.0 / 3.0;
+		const double c = 1.0 / sqrt(9 * d);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			double value;
+			while (true)
+			{
+				double x, v;
+				do
+				{
+					x = nextNormal();
+					v = 1 + c * x;
+				} while (v <= 0);
+
+				v = v * v * v;
+				double u = nextOpenUniform();
+				double xx = x * x;
+
+				//cheap squeeze first, the log test is rarely needed
+				if (u < 1 - 0.0331 * xx * xx || log(u) < 0.5 * xx + d * (1 - v + log(v)))
+				{
+					value = d * v;
+					break;
+				}
+			}
+
+			if (boosted) value *= pow(nextOpenUniform(), 1.0 / shape);
+			out[i] = value * scale;
+		}
+	}
+
+private:
+	//uniform in (0, 1) from the scalar fix-up stream
+	double nextFixupUniform()
+	{
+		return ((xoshiroStep(fixupState, 0) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+	}
+
+	//the ziggurat outside the rectangles, wedges are tested against exp(-x) and layer 0 samples the tail,
+	//a failed wedge test starts over with a fresh draw
+	double exponentialSlowPath(uint64_t layer, double integer)
+	{
+		const ExponentialZiggurat & zig = ExponentialZiggurat::tables();
+		while (true)
+		{
+			if (layer == 0) return ExponentialZiggurat::tailStart() - log(nextFixupUniform());
+
+			double x = integer * zig.w[layer];
+			if (zig.f[layer] + nextFixupUniform() * (zig.f[layer - 1] - zig.f[layer]) < exp(-x)) return x;
+
+			uint64_t raw = xoshiroStep(fixupState, 0);
+			layer = zigguratLayer(raw);
+			integer = (double)zigguratInteger(raw);
+			if (integer < zig.k[layer]) return integer * zig.w[layer];
+		}
+	}
+
+	//uniforms in (0, 1) for the gamma sampler, taken from a vector filled buffer
+	double nextOpenUniform()
+	{
+		if (uniformPosition == uniformBufferSize)
+		{
+			fillUniform(uniformBuffer, uniformBufferSize);
+			uniformPosition = 0;
+		}
+		double u = uniformBuffer[uniformPosition++];
+		return u > 0 ? u : nextOpenUniform();
+	}
+
+	//standard normals with the polar method, the second value of each pair is kept for the next call
+	double nextNormal()
+	{
+		if (hasSpareNormal)
+		{
+			hasSpareNormal = false;
+			return spareNormal;
+		}
+
+		double u, v, s;
+		do
+		{
+			u = 2 * nextOpenUniform() - 1;
+			v = 2 * nextOpenUniform() - 1;
+			s = u * u + v * v;
+		} while (s >= 1 || s == 0);
+
+		double factor = sqrt(-2 * log(s) / s);
+		spareNormal = v * factor;
+		hasSpareNormal = true;
+		return u * factor;
+	}
+
+	static const size_t uniformBufferSize = 256;
+
+	uint64_t state[4][8];
+	uint64_t fixupState[4][8];
+	double uniformBuffer[uniformBufferSize];
+	size_t uniformPosition = uniformBufferSize;
+	double spareNormal = 0;
+	bool hasSpareNormal = false;
+};
+
+//a buffered source of one kind of variate, refilled in batches from its own BatchRandomEngine
+class VariateStream
+{
+public:
+	static VariateStream exponential(uint64_t seed, double rate) { return VariateStream(seed, Kind::Exponential, rate, 0); }
+	static VariateStream gamma(uint64_t seed, double shape, double scale) { return VariateStream(seed, Kind::Gamma, shape, scale); }
+
+	//antithetic streams mirror the uniforms of the stream with the same seed (u and 1 - u, exactly, on the 2^-52 grid)
+	static VariateStream uniform(uint64_t seed, double low, double high, bool antithetic = false) { return VariateStream(seed, Kind::Uniform, low, high, antithetic); }
+
+	//exponentials by inversion of one uniform each, slower than the ziggurat of exponential() but monotone in the
+	//uniform, so an antithetic stream is negatively correlated with its twin (inverted at the midpoints of the grid,
+	//which keeps both finite)
+	static VariateStream inverseExponential(uint64_t seed, double rate, bool antithetic = false) { return VariateStream(seed, Kind::InverseExponential, rate, 0, antithetic); }
+
+	double next()
+	{
+		if (position == bufferSize) refill();
+		return buffer[position++];
+	}
+
+private:
+	enum class Kind
+	{
+		Exponential,
+		Gamma,
+		Uniform,
+		InverseExponential
+	};
+
+	VariateStream(uint64_t seed, Kind kind, double first, double second, bool antithetic = false)
+		: engine(seed), kind(kind), first(first), second(second), antithetic(antithetic) {}
+
+	void refill()
+	{
+		if (kind == Kind::Exponential) engine.fillExponential(buffer, bufferSize, first);
+		else if (kind == Kind::Gamma) engine.fillGamma(buffer, bufferSize, first, second);
+		else if (kind == Kind::Uniform)
+		{
+			engine.fillUniform(buffer, bufferSize);
+			if (antithetic)
+			{
+				for (size_t i = 0; i < bufferSize; i++) buffer[i] = (1 - DBL_EPSILON) - buffer[i];
+			}
+			for (size_t i = 0; i < bufferSize; i++) buffer[i] = first + (second - first) * buffer[i];
+		}
+		else
+		{
+			engine.fillUniform(buffer, bufferSize);
+			double midpoint = 0.5 * DBL_EPSILON;
+			for (size_t i = 0; i < bufferSize; i++)
+			{
+				double u = buffer[i] + midpoint;
+				buffer[i] = -log(antithetic ? u : 1 - u) / first;
+			}
+		}
+		position = 0;
+	}
+
+	static const size_t bufferSize = 256;
+
+	BatchRandomEngine engine;
+	Kind kind;
+	double first;  //rate, shape or low
+	double second; //scale or high
+	bool antithetic;
+	double buffer[bufferSize];
+	size_t position = bufferSize;
+};
+
+//single lane xoshiro256+ with 32 bytes of state, for models that need an independent stream per entity (one per
+//station in the partitioned network engine) and can't afford the buffers of a VariateStream for each of them
+class CompactRandomStream
+{
+public:
+	explicit CompactRandomStream(uint64_t seed = 1)
+	{
+		uint64_t expander = seed;
+		for (int word = 0; word < 4; word++) state[word] = splitMix64(expander);
+	}
+
+	double uniform()
+	{
+		uint64_t result = state[0] + state[3];
+		uint64_t t = state[1] << 17;
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = rotateLeft(state[3], 45);
+		return rawToUniform(result);
+	}
+
+	//inversion, 1 - u is in (0, 1] so the log is always finite
+	double exponential(double rate) { return -log(1.0 - uniform()) / rate; }
+
+private:
+	uint64_t state[4];
+};
@@ -0,0 +1,301 @@
+#pragma once
+
+/*
+	A city of bike stations for the network simulations (BikeNetworkSimulator).
+
+	BikeCity is the fixed part of the model, built once from its own seed so every trial and every engine sees the
+	same city:
+		stations    spread uniformly over a square, each with a number of docks, starting half full, and a
+		            lognormal popularity that scales the client rates of the single station models
+		rides       a client picks up a bike and rides to one of the destinationCount nearest stations, picked by a
+		            gravity model (popularity of the destination * exp(-distance / distanceDecay)); riding takes
+		            minimumTravelTime (undocking, docking) plus distance / speed
+	Everything is stored as structure of arrays. The destination alias table of a station is a row of
+	DestinationEntry, every column of it carries both of its outcomes (station and travel time) inline, so picking
+	the destination of a ride reads a single cache line (rows are about 1.3 KB, the whole table is larger than L2).
+
+	RidesInFlight holds the bikes on the road in a ring of time buckets no wider than the shortest ride (and narrow
+	enough to hold only a handful of rides, see rideBucketWidth). A ride that starts in bucket k can therefore never
+	end in bucket k, so a bucket is complete by the time the simulation reaches it and only has to be sorted once,
+	when it becomes current. Pushing a ride is an append.
+*/
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdint.h>
+#include <vector>
+
+#include "AliasTable.h"
+
+//one column of a destination alias table, the column's own outcome and its alias
+struct DestinationEntry
+{
+	float threshold;
+	uint32_t station;
+	float travel;
+	uint32_t aliasStation;
+	float aliasTravel;
+};
+
+struct RideInFlight
+{
+	double arrival;
+	uint32_t station;
+	uint32_t previous; //where the rider comes from, a redirected rider doesn't ride back there
+};
+
+struct BikeNetworkConfig
+{
+	int stations = 2000;
+	double citySize = 10;          //side of the square the stations are spread over
+	int destinationCount = 64;     //rides end at one of the nearest stations
+	double minimumTravelTime = 1;  //docking and undocking, no ride is shorter
+	double speed = 2;              //distance per unit of time
+	double distanceDecay = 1;      //gravity model, destinations further than this quickly lose their pull
+	int minimumDocks = 15;
+	int maximumDocks = 40;
+	double popularitySpread = 0.5; //sigma of the lognormal station popularity
+	unsigned int seed = 1;         //the layout of the city, not the trials
+};
+
+class BikeCity
+{
+public:
+	//clientRates as in the single station models, index 0 unused, classes 1 .. 3
+	BikeCity(const BikeNetworkConfig & config, const double clientRates[4])
+		: stationCount(config.stations), destinationCount(std::min(config.destinationCount, config.stations - 1))
+	{
+		std::default_random_engine generator(config.seed);
+		std::uniform_real_distribution<double> position(0, config.citySize);
+		std::uniform_int_distribution<int> dockCount(config.minimumDocks, config.maximumDocks);
+		std::lognormal_distribution<double> popularityDraw(0, config.popularitySpread);
+
+		x.resize(stationCount);
+		y.resize(stationCount);
+		docks.resize(stationCount);
+		initialBikes.resize(stationCount);
+		popularity.resize(stationCount);
+		double totalPopularity = 0;
+		for (int s = 0; s < stationCount; s++)
+		{
+			x[s] = position(generator);
+			y[s] = position(generator);
+			docks[s] = dockCount(generator);
+			initialBikes[s] = docks[s] / 2;
+			popularity[s] = popularityDraw(generator);
+			totalPopularity += popularity[s];
+		}
+
+		//client arrivals of every (station, class) pair, an arrival is entry 3 * station + class - 1
+		std::vector<double> arrivalWeights(3 * stationCount);
+		arrivalRate.assign(stationCount, 0);
+		totalArrivalRate = 0;
+		for (int s = 0; s < stationCount; s++)
+		{
+			for (int c = 1; c <= 3; c++)
+			{
+				arrivalWeights[3 * s + c - 1] = clientRates[c] * popularity[s] * stationCount / totalPopularity;
+				arrivalRate[s] += arrivalWeights[3 * s + c - 1];
+			}
+			totalArrivalRate += arrivalRate[s];
+		}
+		arrivals.build(arrivalWeights);
+
+		//every station has the same mix of classes
+		double classTotal = clientRates[1] + clientRates[2] + clientRates[3];
+		classThreshold[0] = clientRates[1] / classTotal;
+		classThreshold[1] = (clientRates[1] + clientRates[2]) / classTotal;
+
+		//nearest stations, travel times and destination tables, row s of each belongs to station s
+		neighbours.resize((size_t)stationCount * destinationCount);
+		travelTimes.resize((size_t)stationCount * destinationCount);
+		destinations.resize((size_t)stationCount * destinationCount);
+		std::vector<int> order(stationCount);
+		std::vector<double> distance(stationCount);
+		std::vector<double> weights(destinationCount);
+		std::vector<double> probability(destinationCount);
+		std::vector<uint32_t> alias(destinationCount);
+		longestTravelTime = config.minimumTravelTime;
+		for (int s = 0; s < stationCount; s++)
+		{
+			for (int other = 0; other < stationCount; other++)
+			{
+				order[other] = other;
+				distance[other] = other == s ? INFINITY : hypot(x[s] - x[other], y[s] - y[other]);
+			}
+			std::partial_sort(order.begin(), order.begin() + destinationCount, order.end(),
+				[&](int a, int b) { return distance[a] < distance[b] || (distance[a] == distance[b] && a < b); });
+
+			for (int d = 0; d < destinationCount; d++)
+			{
+				int other = order[d];
+				size_t entry = (size_t)s * destinationCount + d;
+				neighbours[entry] = (uint32_t)other;
+				travelTimes[entry] = config.minimumTravelTime + distance[other] / config.speed;
+				weights[d] = popularity[other] * exp(-distance[other] / config.distanceDecay);
+				longestTravelTime = std::max(longestTravelTime, travelTimes[entry]);
+			}
+			buildAliasTable(weights.data(), destinationCount, probability.data(), alias.data());
+			for (int d = 0; d < destinationCount; d++)
+			{
+				size_t entry = (size_t)s * destinationCount;
+				destinations[entry + d] = DestinationEntry{ (float)probability[d],
+					neighbours[entry + d], (float)travelTimes[entry + d],
+					neighbours[entry + alias[d]], (float)travelTimes[entry + alias[d]] };
+			}
+		}
+		shortestTravelTime = config.minimumTravelTime;
+	}
+
+	//width of the RidesInFlight buckets, no wider than the shortest ride and narrow enough that a bucket only holds a
+	//handful of rides, which keeps sorting it cheap (8 was the fastest for 2000 stations, 4 and 32 lose about 20%)
+	double rideBucketWidth(double ridesPerBucket = 8) const
+	{
+		return std::min(shortestTravelTime, ridesPerBucket / totalArrivalRate);
+	}
+
+	//destination and travel time of a ride from s for a uniform in [0, 1)
+	void pickDestination(int s, double uniform, uint32_t & destination, double & travel) const
+	{
+		double scaled = uniform * destinationCount;
+		int column = (int)scaled;
+		const DestinationEntry & entry = destinations[(size_t)s * destinationCount + column];
+		bool own = (float)(scaled - column) < entry.threshold;
+		destination = own ? entry.station : entry.aliasStation;
+		travel = own ? entry.travel : entry.aliasTravel;
+	}
+
+	//class of a client at a single station for a uniform in [0, 1)
+	int pickClass(double uniform) const { return uniform < classThreshold[0] ? 1 : uniform < classThreshold[1] ? 2 : 3; }
+
+	//a rider who finds every dock of s taken rides on to the nearest station of s, or the second nearest if the
+	//nearest is where they just came from; they only find out there whether it has a free dock
+	void redirect(const RideInFlight & ride, uint32_t & destination, double & travel) const
+	{
+		const uint32_t * row = nearest(ride.station);
+		int choice = row[0] == ride.previous && destinationCount > 1 ? 1 : 0;
+		destination = row[choice];
+		travel = travelTimes[(size_t)ride.station * destinationCount + choice];
+	}
+
+	int stations() const { return stationCount; }
+	int neighbourCount() const { return destinationCount; }
+
+	//row of the nearest stations of s, sorted by distance
+	const uint32_t * nearest(int s) const { return neighbours.data() + (size_t)s * destinationCount; }
+	const double * travel(int s) const { return travelTimes.data() + (size_t)s * destinationCount; }
+
+	std::vector<double> x, y;
+	std::vector<int> docks;
+	std::vector<int> initialBikes;
+	std::vector<double> popularity;
+
+	std::vector<double> arrivalRate; //all classes of one station
+	AliasTable arrivals;            //(station, class) of the next client, all stations superposed
+	double totalArrivalRate;
+	double shortestTravelTime;
+	double longestTravelTime;
+
+private:
+	int stationCount;
+	int destinationCount;
+	double classThreshold[2];
+	std::vector<uint32_t> neighbours;
+	std::vector<double> travelTimes;
+	std::vector<DestinationEntry> destinations;
+};
+
+class RidesInFlight
+{
+public:
+	//bucketWidth must not exceed the shortest ride, longestRide bounds how far ahead a ride can be pushed
+	RidesInFlight(double bucketWidth, double longestRide) : width(bucketWidth)
+	{
+		size_t needed = (size_t)ceil(longestRide / bucketWidth) + 2;
+		size_t count = 1;
+		while (count < needed) count *= 2;
+		buckets.resize(count);
+		mask = (long long)count - 1;
+	}
+
+	void clear()
+	{
+		for (auto & bucket : buckets) bucket.clear();
+		current = 0;
+		inFlight = 0;
+	}
+
+	//a ride that arrives no earlier than the last one delivered
+	void push(double arrival, uint32_t station, uint32_t previous)
+	{
+		RideInFlight ride{ arrival, station, previous };
+		long long bucket = (long long)(arrival / width);
+		inFlight++;
+		if (bucket > current)
+		{
+			buckets[bucket & mask].push_back(ride);
+			return;
+		}
+
+		//only a ride handed over by another partition can land in the current bucket, which is already sorted
+		std::vector<RideInFlight> & sorted = buckets[current & mask];
+		sorted.insert(std::upper_bound(sorted.begin(), sorted.end(), ride, deliveredAfter), ride);
+	}
+
+	//hands every ride that arrives before time to dock(ride), in order of arrival, dock may push new rides
+	template <typename Dock>
+	void deliverBefore(double time, Dock dock)
+	{
+		while (true)
+		{
+			std::vector<RideInFlight> & bucket = buckets[current & mask];
+			if (!bucket.empty())
+			{
+				if (bucket.back().arrival >= time) return;
+				RideInFlight ride = bucket.back();
+				bucket.pop_back();
+				inFlight--;
+				dock(ride);
+				continue;
+			}
+
+			if ((current + 1) * width >= time) return;
+			current++;
+			std::vector<RideInFlight> & next = buckets[current & mask];
+			if (next.size() > 1)
+			{
+				//latest first so the next ride is a pop_back; buckets are small, so insertion sort beats std::sort here
+				for (size_t i = 1; i < next.size(); i++)
+				{
+					RideInFlight ride = next[i];
+					size_t j = i;
+					while (j > 0 && deliveredAfter(ride, next[j - 1]))
+					{
+						next[j] = next[j - 1];
+						j--;
+					}
+					next[j] = ride;
+				}
+			}
+		}
+	}
+
+	size_t size() const { return inFlight; }
+
+private:
+	//order of a sorted bucket (latest first), of rides arriving at the same time the higher station and then the higher
+	//origin is delivered first, so the order of delivery never depends on the order the rides were pushed in
+	static bool deliveredAfter(const RideInFlight & a, const RideInFlight & b)
+	{
+		if (a.arrival != b.arrival) return a.arrival > b.arrival;
+		if (a.station != b.station) return a.station < b.station;
+		return a.previous < b.previous;
+	}
+
+	double width;
+	long long mask;
+	long long current = 0;
+	size_t inFlight = 0;
+	std::vector<std::vector<RideInFlight>> buckets;
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+/*
+	Undirected contact graph in compressed sparse row form, stored in a binary file that is memory mapped on load.
+
+	File layout (little endian, everything 8 byte aligned):
+		header      magic "CSRGRAPH", version, reserved, node count, entry count
+		offsets     uint64_t[nodes + 1], the neighbours of node v are entries offsets[v] .. offsets[v + 1] - 1
+		neighbours  uint32_t[entries]
+
+	Every edge is stored in both directions, so entries = 2 * edges, and every neighbour list is sorted without
+	duplicates or self loops, which lets findEntry() locate the entry (v, w) with a binary search.
+
+	convertEdgeList() builds the file from a text edge list ("u v" per line, lines starting with # or % are
+	comments) in two passes over the text, so the edges never have to be held in memory next to the graph.
+*/
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "MappedFile.h"
+
+struct ContactGraphHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t nodes;
+	uint64_t entries;
+};
+
+const uint32_t contactGraphVersion = 1;
+
+class ContactGraph
+{
+public:
+	//maps the file and checks it before anything reads through it: the header, that the sizes fit in the file, that
+	//the offsets run from 0 up to the entry count and that every neighbour list is a sorted list of other nodes, which
+	//is one pass over the file
+	bool open(const char * path)
+	{
+		nodes = 0;
+		entries = 0;
+		if (!file.open(path) || file.size() < sizeof(ContactGraphHeader)) return false;
+
+		ContactGraphHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+		if (memcmp(header.magic, "CSRGRAPH", 8) != 0 || header.version != contactGraphVersion) return false;
+
+		//node ids are 32 bit, which also keeps the size of the offsets from overflowing
+		if (header.nodes > UINT32_MAX) return false;
+		uint64_t available = file.size() - sizeof(header);
+		uint64_t offsetBytes = (header.nodes + 1) * sizeof(uint64_t);
+		if (available < offsetBytes || (available - offsetBytes) / sizeof(uint32_t) < header.entries) return false;
+
+		const uint64_t * fileOffsets = (const uint64_t *)(file.data() + sizeof(header));
+		const uint32_t * fileNeighbours = (const uint32_t *)(fileOffsets + header.nodes + 1);
+		if (fileOffsets[0] != 0 || fileOffsets[header.nodes] != header.entries) return false;
+		for (uint64_t v = 0; v < header.nodes; v++)
+		{
+			uint64_t first = fileOffsets[v], last = fileOffsets[v + 1];
+			if (last < first || last > header.entries) return false;
+			for (uint64_t e = first; e < last; e++)
+			{
+				uint32_t w = fileNeighbours[e];
+				if (w >= header.nodes || w == v || (e > first && w <= fileNeighbours[e - 1])) return false;
+			}
+		}
+
+		nodes = header.nodes;
+		entries = header.entries;
+		offsets = fileOffsets;
+		neighbours = fileNeighbours;
+		return true;
+	}
+
+	uint64_t nodeCount() const { return nodes; }
+	uint64_t entryCount() const { return entries; }
+	uint64_t edgeCount() const { return entries / 2; }
+
+	uint64_t begin(uint32_t node) const { return offsets[node]; }
+	uint64_t end(uint32_t node) const { return offsets[node + 1]; }
+	uint32_t neighbour(uint64_t entry) const { return neighbours[entry]; }
+
+	//index of the entry (node, other), entryCount() if they are not connected
+	uint64_t findEntry(uint32_t node, uint32_t other) const
+	{
+		const uint32_t * first = neighbours + offsets[node];
+		const uint32_t * last = neighbours + offsets[node + 1];
+		const uint32_t * found = std::lower_bound(first, last, other);
+		return (found != last && *found == other) ? (uint64_t)(found - neighbours) : entries;
+	}
+
+private:
+	MappedFile file;
+	uint64_t nodes = 0;
+	uint64_t entries = 0;
+	const uint64_t * offsets = NULL;
+	const uint32_t * neighbours = NULL;
+};
+
+//sorts every neighbour list, drops duplicates and compacts the arrays in place
+inline void normalizeContactGraph(std::vector<uint64_t> & offsets, std::vector<uint32_t> & neighbours)
+{
+	uint64_t nodes = offsets.size() - 1;
+	uint64_t written = 0;
+	for (uint64_t v = 0; v < nodes; v++)
+	{
+		uint32_t * first = neighbours.data() + offsets[v];
+		uint32_t * last = neighbours.data() + offsets[v + 1];
+		std::sort(first, last);
+		uint32_t * uniqueEnd = std::unique(first, last);
+
+		offsets[v] = written;
+		for (uint32_t * n = first; n != uniqueEnd; n++) neighbours[written++] = *n;
+	}
+	offsets[nodes] = written;
+	neighbours.resize(written);
+}
+
+inline bool writeContactGraph(const char * path, const std::vector<uint64_t> & offsets, const std::vector<uint32_t> & neighbours)
+{
+	FILE * out = fopen(path, "wb");
+	if (!out) return false;
+
+	ContactGraphHeader header;
+	memcpy(header.magic, "CSRGRAPH", 8);
+	header.version = contactGraphVersion;
+	header.reserved = 0;
+	header.nodes = offsets.size() - 1;
+	header.entries = neighbours.size();
+
+	bool written = fwrite(&header, sizeof(header), 1, out) == 1
+		&& fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), out) == offsets.size()
+		&& fwrite(neighbours.data(), sizeof(uint32_t), neighbours.size(), out) == neighbours.size();
+	return fclose(out) == 0 && written;
+}
+
+//reads the next "u v" pair from an edge list, skipping comment lines
+inline bool readEdge(FILE * in, unsigned long long & u, unsigned long long & v)
+{
+	char line[256];
+	while (fgets(line, sizeof(line), in))
+	{
+		if (line[0] == '#' || line[0] == '%') continue;
+		if (sscanf(line, "%llu %llu", &u, &v) == 2) return true;
+	}
+	return false;
+}
+
+//text edge list to binary graph, node ids are used as they are (0 based), self loops and duplicate edges are dropped
+inline bool convertEdgeList(const char * edgeListPath, const char * graphPath)
+{
+	FILE * in = fopen(edgeListPath, "r");
+	if (!in) return false;
+
+	//first pass counts the degrees
+	std::vector<uint64_t> offsets(1, 0);
+	unsigned long long u, v;
+	while (readEdge(in, u, v))
+	{
+		if (u == v || u >= UINT32_MAX || v >= UINT32_MAX) continue;
+		uint64_t largest = std::max(u, v);
+		if (largest + 2 > offsets.size()) offsets.resize(largest + 2, 0);
+		offsets[u + 1]++;
+		offsets[v + 1]++;
+	}
+	for (size_t i = 1; i < offsets.size(); i++) offsets[i] += offsets[i - 1];
+
+	//second pass fills the neighbour lists
+	std::vector<uint32_t> neighbours(offsets.back());
+	std::vector<uint64_t> fill(offsets.begin(), offsets.end() - 1);
+	rewind(in);
+	while (readEdge(in, u, v))
+	{
+		if (u == v || u >= UINT32_MAX || v >= UINT32_MAX) continue;
+		neighbours[fill[u]++] = (uint32_t)v;
+		neighbours[fill[v]++] = (uint32_t)u;
+	}
+	fclose(in);
+
+	normalizeContactGraph(offsets, neighbours);
+	return writeContactGraph(graphPath, offsets, neighbours);
+}
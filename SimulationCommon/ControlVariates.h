@@ -0,0 +1,216 @@
+#pragma once
+
+/*
+	Control variates for the replications: outputs (responses) of a trial are corrected with quantities of the same
+	trial whose means are known exactly, such as the number of arrivals of every class over [0, T].
+
+	ControlVariateSet keeps nothing but the count, the means and the co-moment matrix of all responses and controls
+	together (a multivariate Welford update), and merges like RunningMoments with Chan's pairwise formula, so it can be
+	the accumulator of reduceReplicationRange and the results don't depend on how the trials were scheduled. From the
+	co-moments it fits, for every response y and the vector of controls c with known mean mu,
+		beta = Scc^-1 Scy                        least squares coefficients, re-estimated whenever asked
+		controlled mean = mean(y) - beta (mean(c) - mu)
+		variance = s^2 (1 / n + (mean(c) - mu) Scc^-1 (mean(c) - mu)),  s^2 = (Syy - Syc beta) / (n - q - 1)
+	where the S are sums of squares and cross products around the means. The variance is the normal theory one for
+	estimated coefficients (Lavenberg and Welch), which keeps the interval honest for the q degrees of freedom the fit
+	uses up. A control that is (nearly) a linear combination of the others, or constant, is left out of the fit.
+*/
+
+#include <algorithm>
+#include <initializer_list>
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include "StreamingStatistics.h"
+
+class ControlVariateSet
+{
+public:
+	struct Estimate
+	{
+		double mean;           //controlled
+		double variance;       //of the controlled mean
+		double rawMean;
+		double rawVariance;    //of the plain mean
+		int controlsUsed;
+	};
+
+	ControlVariateSet() {}
+	ControlVariateSet(std::initializer_list<const char *> responseNames, const std::vector<double> & controlMeans)
+		: names(responseNames.begin(), responseNames.end()), knownMeans(controlMeans),
+		responseCount(responseNames.size()), controlCount(controlMeans.size()),
+		means(responseCount + controlCount, 0.0), comoments((responseCount + controlCount) * (responseCount + controlCount), 0.0)
+	{
+	}
+
+	//one trial, its responses and its controls in the order they were declared
+	void add(const double * responses, const double * controls)
+	{
+		size_t v = means.size();
+		delta.resize(v);
+		observations++;
+		for (size_t i = 0; i < v; i++)
+		{
+			double value = i < responseCount ? responses[i] : controls[i - responseCount];
+			delta[i] = value - means[i];
+			means[i] += delta[i] / observations;
+		}
+		//delta_i (x_j - new mean_j) = delta_i delta_j (n - 1) / n, symmetric
+		double scale = (double)(observations - 1) / observations;
+		for (size_t i = 0; i < v; i++)
+		{
+			for (size_t j = 0; j < v; j++) comoments[i * v + j] += delta[i] * delta[j] * scale;
+		}
+	}
+
+	//sets being merged must have the same responses and controls
+	void merge(const ControlVariateSet & other)
+	{
+		if (other.observations == 0) return;
+		if (observations == 0)
+		{
+			*this = other;
+			return;
+		}
+
+		size_t v = means.size();
+		long long combined = observations + other.observations;
+		double weight = (double)observations * other.observations / combined;
+		delta.resize(v);
+		for (size_t i = 0; i < v; i++) delta[i] = other.means[i] - means[i];
+		for (size_t i = 0; i < v; i++)
+		{
+			for (size_t j = 0; j < v; j++) comoments[i * v + j] += other.comoments[i * v + j] + delta[i] * delta[j] * weight;
+		}
+		for (size_t i = 0; i < v; i++) means[i] += delta[i] * ((double)other.observations / combined);
+		observations = combined;
+	}
+
+	long long count() const { return observations; }
+	size_t size() const { return responseCount; }
+	const std::string & name(size_t response) const { return names[response]; }
+
+	Estimate estimate(size_t response) const
+	{
+		size_t v = means.size();
+		size_t y = response;
+		double n = (double)observations;
+
+		Estimate result;
+		result.rawMean = means[y];
+		result.rawVariance = observations > 1 ? comoments[y * v + y] / (n - 1) / n : 0.0;
+		result.mean = result.rawMean;
+		result.variance = result.rawVariance;
+		result.controlsUsed = 0;
+
+		//Scc = L D L^T, a control whose pivot is lost to cancellation is dropped
+		size_t q = controlCount;
+		std::vector<double> lower(q * q, 0.0), pivot(q, 0.0);
+		std::vector<char> used(q, 0);
+		for (size_t k = 0; k < q; k++)
+		{
+			size_t ck = responseCount + k;
+			double diagonal = comoments[ck * v + ck];
+			double d = diagonal;
+			for (size_t j = 0; j < k; j++) d -= lower[k * q + j] * lower[k * q + j] * pivot[j];
+			if (!(d > 1e-10 * diagonal) || diagonal <= 0) continue;
+			used[k] = 1;
+			pivot[k] = d;
+			lower[k * q + k] = 1;
+			for (size_t i = k + 1; i < q; i++)
+			{
+				size_t ci = responseCount + i;
+				double sum = comoments[ci * v + ck];
+				for (size_t j = 0; j < k; j++) sum -= lower[i * q + j] * lower[k * q + j] * pivot[j];
+				lower[i * q + k] = sum / d;
+			}
+			result.controlsUsed++;
+		}
+		if (result.controlsUsed == 0 || n - result.controlsUsed - 1 <= 0) return result;
+
+		//solves Scc x = b over the controls that are used
+		auto solve = [&](std::vector<double> b)
+		{
+			for (size_t i = 0; i < q; i++)
+			{
+				if (!used[i]) { b[i] = 0; continue; }
+				for (size_t j = 0; j < i; j++) b[i] -= lower[i * q + j] * b[j];
+			}
+			for (size_t i = 0; i < q; i++) b[i] = used[i] ? b[i] / pivot[i] : 0;
+			for (size_t i = q; i-- > 0;)
+			{
+				if (!used[i]) continue;
+				for (size_t j = i + 1; j < q; j++) b[i] -= lower[j * q + i] * b[j];
+			}
+			return b;
+		};
+
+		std::vector<double> crossWithResponse(q), offset(q);
+		for (size_t k = 0; k < q; k++)
+		{
+			crossWithResponse[k] = comoments[(responseCount + k) * v + y];
+			offset[k] = means[responseCount + k] - knownMeans[k];
+		}
+		std::vector<double> beta = solve(crossWithResponse);
+		std::vector<double> scaledOffset = solve(offset);
+
+		double explained = 0, correction = 0, spread = 0;
+		for (size_t k = 0; k < q; k++)
+		{
+			explained += crossWithResponse[k] * beta[k];
+			correction += beta[k] * offset[k];
+			spread += offset[k] * scaledOffset[k];
+		}
+		double residual = std::max(0.0, comoments[y * v + y] - explained) / (n - result.controlsUsed - 1);
+		result.mean = means[y] - correction;
+		result.variance = residual * (1 / n + spread);
+		return result;
+	}
+
+	//half width of the controlled mean, z = 1.96 for alpha = 0.05
+	double halfWidth(size_t response, double z = 1.96) const { return z * sqrt(estimate(response).variance); }
+
+	//the Chow-Robbins rule of StreamingStatistics.h on the controlled estimates, one target per response
+	bool meetsPrecision(const PrecisionTarget * targets, double z = 1.96) const
+	{
+		for (size_t r = 0; r < responseCount; r++)
+		{
+			const PrecisionTarget & target = targets[r];
+			if (observations < std::max<long long>(2, target.minimumCount)) return false;
+			if (target.absoluteHalfWidth <= 0 && target.relativeHalfWidth <= 0) continue;
+
+			Estimate result = estimate(r);
+			double n = (double)observations;
+			double halfWidth = z * sqrt(result.variance + 1 / (n * n));
+			bool met = (target.absoluteHalfWidth > 0 && halfWidth <= target.absoluteHalfWidth)
+				|| (target.relativeHalfWidth > 0 && halfWidth <= target.relativeHalfWidth * fabs(result.mean));
+			if (!met) return false;
+		}
+		return true;
+	}
+
+	//one line per response: controlled mean +- half width, the plain one and how much variance the controls removed
+	void printConfidenceIntervals(std::ostream & out, double z = 1.96) const
+	{
+		for (size_t r = 0; r < responseCount; r++)
+		{
+			Estimate result = estimate(r);
+			out << names[r] << " over " << observations << " observations : " << result.mean << " +-" << z * sqrt(result.variance)
+				<< " (without controls " << result.rawMean << " +-" << z * sqrt(result.rawVariance);
+			if (result.variance > 0) out << ", variance " << result.rawVariance / result.variance << "x lower";
+			out << ")" << std::endl;
+		}
+	}
+
+private:
+	std::vector<std::string> names;
+	std::vector<double> knownMeans;
+	size_t responseCount = 0;
+	size_t controlCount = 0;
+	long long observations = 0;
+	std::vector<double> means;     //responses, then controls
+	std::vector<double> comoments; //sums of cross products around the means, row major
+	std::vector<double> delta;     //scratch of add and merge
+};
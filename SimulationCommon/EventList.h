@@ -0,0 +1,541 @@
+#pragma once
+
+/*
+	Future event lists for the next-event simulations.
+
+	All lists share the same small interface so they can be swapped with a typedef:
+		push(time, type)   schedule an event
+		top()              the next event (time, type), the list must not be empty
+		pop()              remove and return the next event
+		empty(), size(), clear()
+
+	Every event is stamped with an insertion sequence number and ordered by (time, sequence), so two events with the
+	same time are never merged and always come out in the order they were scheduled (std::map<double, int> silently
+	dropped the second one).
+
+	Backends:
+		QuaternaryHeapEventList   implicit 4-ary heap in one vector, the default
+		PairingHeapEventList      pairing heap with nodes in a pooled vector and a free list
+		CalendarQueueEventList    Brown's calendar queue, resizes itself and re-estimates the bucket width
+		LadderQueueEventList      Tang/Goh/Thng ladder queue (top, rungs of buckets, sorted bottom)
+
+	Buckets in the calendar and ladder queues are vectors that keep their capacity between uses, so after warm up
+	none of the lists allocate per event.
+*/
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <vector>
+
+struct FutureEvent
+{
+	double time;
+	unsigned long long sequence; //insertion order, breaks ties between events with the same time
+	int type;
+};
+
+//strict ordering used by every list, earlier time first and then earlier insertion
+inline bool eventPrecedes(const FutureEvent & a, const FutureEvent & b)
+{
+	return a.time < b.time || (a.time == b.time && a.sequence < b.sequence);
+}
+
+//sorts so the next event sits at the back of the vector, which makes taking it a pop_back
+inline void sortEventsDescending(std::vector<FutureEvent> & events)
+{
+	std::sort(events.begin(), events.end(), [](const FutureEvent & a, const FutureEvent & b) { return eventPrecedes(b, a); });
+}
+
+//inserts into a vector sorted by sortEventsDescending
+inline void insertEventDescending(std::vector<FutureEvent> & events, const FutureEvent & event)
+{
+	auto position = std::upper_bound(events.begin(), events.end(), event,
+		[](const FutureEvent & a, const FutureEvent & b) { return eventPrecedes(b, a); });
+	events.insert(position, event);
+}
+
+class QuaternaryHeapEventList
+{
+public:
+	void push(double time, int type)
+	{
+		heap.push_back(FutureEvent{ time, nextSequence++, type });
+		siftUp(heap.size() - 1);
+	}
+
+	const FutureEvent & top() const { return heap.front(); }
+
+	FutureEvent pop()
+	{
+		FutureEvent first = heap.front();
+		FutureEvent last = heap.back();
+		heap.pop_back();
+		if (!heap.empty()) siftDown(0, last);
+		return first;
+	}
+
+	bool empty() const { return heap.empty(); }
+	size_t size() const { return heap.size(); }
+	void clear() { heap.clear(); nextSequence = 0; }
+
+private:
+	void siftUp(size_t index)
+	{
+		FutureEvent event = heap[index];
+		while (index > 0)
+		{
+			size_t parent = (index - 1) / 4;
+			if (!eventPrecedes(event, heap[parent])) break;
+			heap[index] = heap[parent];
+			index = parent;
+		}
+		heap[index] = event;
+	}
+
+	void siftDown(size_t index, const FutureEvent & event)
+	{
+		const size_t count = heap.size();
+		while (true)
+		{
+			size_t firstChild = 4 * index + 1;
+			if (firstChild >= count) break;
+
+			//pick the earliest of the (up to) four children
+			size_t best = firstChild;
+			size_t lastChild = std::min(firstChild + 4, count);
+			for (size_t child = firstChild + 1; child < lastChild; child++)
+			{
+				if (eventPrecedes(heap[child], heap[best])) best = child;
+			}
+
+			if (!eventPrecedes(heap[best], event)) break;
+			heap[index] = heap[best];
+			index = best;
+		}
+		heap[index] = event;
+	}
+
+	std::vector<FutureEvent> heap;
+	unsigned long long nextSequence = 0;
+};
+
+class PairingHeapEventList
+{
+public:
+	void push(double time, int type)
+	{
+		root = meld(root, allocate(FutureEvent{ time, nextSequence++, type }));
+		count++;
+	}
+
+	const FutureEvent & top() const { return pool[root].event; }
+
+	FutureEvent pop()
+	{
+		FutureEvent first = pool[root].event;
+		int children = pool[root].child;
+		freeNodes.push_back(root);
+		root = mergePairs(children);
+		count--;
+		return first;
+	}
+
+	bool empty() const { return count == 0; }
+	size_t size() const { return count; }
+	void clear() { pool.clear(); freeNodes.clear(); root = -1; count = 0; nextSequence = 0; }
+
+private:
+	struct Node
+	{
+		FutureEvent event;
+		int child;   //first child, -1 if none
+		int sibling; //next sibling, -1 if none
+	};
+
+	int allocate(const FutureEvent & event)
+	{
+		int index;
+		if (!freeNodes.empty())
+		{
+			index = freeNodes.back();
+			freeNodes.pop_back();
+			pool[index] = Node{ event, -1, -1 };
+		}
+		else
+		{
+			index = (int)pool.size();
+			pool.push_back(Node{ event, -1, -1 });
+		}
+		return index;
+	}
+
+	//links two heaps, the later root becomes the first child of the earlier one
+	int meld(int a, int b)
+	{
+		if (a < 0) return b;
+		if (b < 0) return a;
+		if (eventPrecedes(pool[b].event, pool[a].event)) std::swap(a, b);
+		pool[b].sibling = pool[a].child;
+		pool[a].child = b;
+		return a;
+	}
+
+	//standard two pass merge, pair up left to right then fold right to left
+	int mergePairs(int first)
+	{
+		if (first < 0) return -1;
+
+		scratch.clear();
+		while (first >= 0)
+		{
+			int a = first;
+			int b = pool[a].sibling;
+			first = b >= 0 ? pool[b].sibling : -1;
+			pool[a].sibling = -1;
+			if (b >= 0) pool[b].sibling = -1;
+			scratch.push_back(meld(a, b));
+		}
+
+		int merged = scratch.back();
+		for (size_t i = scratch.size() - 1; i-- > 0;) merged = meld(scratch[i], merged);
+		return merged;
+	}
+
+	std::vector<Node> pool;
+	std::vector<int> freeNodes;
+	std::vector<int> scratch;
+	int root = -1;
+	size_t count = 0;
+	unsigned long long nextSequence = 0;
+};
+
+class CalendarQueueEventList
+{
+public:
+	CalendarQueueEventList() { buckets.resize(2); mask = 1; }
+
+	void push(double time, int type)
+	{
+		insert(FutureEvent{ time, nextSequence++, type });
+		count++;
+		located = -1;
+		if (count > 2 * buckets.size()) resize(buckets.size() * 2);
+	}
+
+	const FutureEvent & top() { return buckets[locate()].back(); }
+
+	FutureEvent pop()
+	{
+		std::vector<FutureEvent> & bucket = buckets[locate()];
+		FutureEvent first = bucket.back();
+		bucket.pop_back();
+		count--;
+		located = -1;
+		if (buckets.size() > 2 && count < buckets.size() / 2) resize(buckets.size() / 2);
+		return first;
+	}
+
+	bool empty() const { return count == 0; }
+	size_t size() const { return count; }
+
+	void clear()
+	{
+		for (auto & bucket : buckets) bucket.clear();
+		count = 0;
+		nextSequence = 0;
+		located = -1;
+	}
+
+private:
+	//index of the "day" the time falls into if the calendar never wrapped around
+	long long dayOf(double time) const { return (long long)floor(time / width); }
+
+	//buckets are sorted descending so the earliest event of the bucket is at the back
+	void insert(const FutureEvent & event)
+	{
+		long long day = dayOf(event.time);
+		insertEventDescending(buckets[day & mask], event);
+		if (count == 0 || day < currentDay) currentDay = day;
+	}
+
+	//finds the bucket holding the next event, scanning at most one year before falling back to a direct search
+	size_t locate()
+	{
+		if (located >= 0) return (size_t)located;
+
+		for (size_t scanned = 0; scanned < buckets.size(); scanned++, currentDay++)
+		{
+			size_t index = (size_t)(currentDay & mask);
+			if (!buckets[index].empty() && dayOf(buckets[index].back().time) <= currentDay)
+			{
+				located = (long long)index;
+				return index;
+			}
+		}
+
+		//nothing this year, jump straight to the earliest event
+		size_t best = 0;
+		bool found = false;
+		for (size_t index = 0; index < buckets.size(); index++)
+		{
+			if (buckets[index].empty()) continue;
+			if (!found || eventPrecedes(buckets[index].back(), buckets[best].back()))
+			{
+				best = index;
+				found = true;
+			}
+		}
+		currentDay = dayOf(buckets[best].back().time);
+		located = (long long)best;
+		return best;
+	}
+
+	//rebuilds the calendar with a new number of buckets and a width estimated from the head of the list
+	void resize(size_t bucketCount)
+	{
+		scratch.clear();
+		for (auto & bucket : buckets)
+		{
+			scratch.insert(scratch.end(), bucket.begin(), bucket.end());
+			bucket.clear();
+		}
+
+		width = estimateWidth(scratch, width);
+		buckets.resize(bucketCount);
+		mask = (long long)bucketCount - 1;
+
+		size_t events = count;
+		count = 0;
+		for (auto & event : scratch)
+		{
+			insert(event);
+			count++;
+		}
+		count = events;
+		located = -1;
+	}
+
+	//Brown's heuristic, three times the average separation of the earliest few events ignoring outliers
+	static double estimateWidth(std::vector<FutureEvent> & events, double previousWidth)
+	{
+		const size_t sampleSize = std::min<size_t>(events.size(), 25);
+		if (sampleSize < 2) return previousWidth;
+
+		std::nth_element(events.begin(), events.begin() + (sampleSize - 1), events.end(), eventPrecedes);
+		std::sort(events.begin(), events.begin() + sampleSize, eventPrecedes);
+
+		double averageSeparation = (events[sampleSize - 1].time - events[0].time) / (sampleSize - 1);
+		double total = 0;
+		size_t used = 0;
+		for (size_t i = 1; i < sampleSize; i++)
+		{
+			double separation = events[i].time - events[i - 1].time;
+			if (separation <= 2 * averageSeparation)
+			{
+				total += separation;
+				used++;
+			}
+		}
+
+		if (used == 0 || total <= 0) return previousWidth;
+		return 3 * total / used;
+	}
+
+	std::vector<std::vector<FutureEvent>> buckets;
+	std::vector<FutureEvent> scratch;
+	long long mask;
+	double width = 1.0;
+	long long currentDay = 0;
+	long long located = -1; //bucket of the next event, -1 when it has to be searched again
+	size_t count = 0;
+	unsigned long long nextSequence = 0;
+};
+
+class LadderQueueEventList
+{
+public:
+	void push(double time, int type)
+	{
+		FutureEvent event{ time, nextSequence++, type };
+		count++;
+
+		//far future, goes into the unsorted top
+		if (time >= topStart)
+		{
+			topEvents.push_back(event);
+			topMin = std::min(topMin, time);
+			topMax = std::max(topMax, time);
+			return;
+		}
+
+		//otherwise into the first rung whose current bucket has not been passed yet
+		for (size_t r = 0; r < activeRungs; r++)
+		{
+			Rung & rung = rungs[r];
+			if (rung.current >= rung.buckets.size()) continue; //exhausted, only kept as a parent
+			if (time >= rung.start + rung.current * rung.width)
+			{
+				rung.buckets[bucketIndex(rung, time)].push_back(event);
+				return;
+			}
+		}
+
+		//earlier than everything on the ladder
+		insertEventDescending(bottom, event);
+	}
+
+	const FutureEvent & top()
+	{
+		prepareBottom();
+		return bottom.back();
+	}
+
+	FutureEvent pop()
+	{
+		prepareBottom();
+		FutureEvent first = bottom.back();
+		bottom.pop_back();
+		count--;
+
+		//once drained, start over so the next events go back into the top
+		if (count == 0)
+		{
+			activeRungs = 0;
+			resetTop();
+		}
+		return first;
+	}
+
+	bool empty() const { return count == 0; }
+	size_t size() const { return count; }
+
+	void clear()
+	{
+		topEvents.clear();
+		bottom.clear();
+		for (auto & rung : rungs)
+		{
+			for (auto & bucket : rung.buckets) bucket.clear();
+		}
+		activeRungs = 0;
+		resetTop();
+		count = 0;
+		nextSequence = 0;
+	}
+
+private:
+	struct Rung
+	{
+		double start;
+		double width;
+		size_t current; //first bucket that has not been moved down yet
+		std::vector<std::vector<FutureEvent>> buckets;
+	};
+
+	//a bucket with more events than this is split into a new rung instead of being sorted
+	static const size_t bucketThreshold = 50;
+	static const size_t maxRungs = 8;
+
+	static size_t bucketIndex(const Rung & rung, double time)
+	{
+		double offset = (time - rung.start) / rung.width;
+		size_t index = offset > 0 ? (size_t)offset : 0;
+		if (index < rung.current) index = rung.current;
+		if (index >= rung.buckets.size()) index = rung.buckets.size() - 1;
+		return index;
+	}
+
+	void resetTop()
+	{
+		topStart = -std::numeric_limits<double>::infinity();
+		topMin = std::numeric_limits<double>::infinity();
+		topMax = -std::numeric_limits<double>::infinity();
+	}
+
+	Rung & openRung(double start, double width, size_t bucketCount)
+	{
+		if (rungs.size() <= activeRungs) rungs.emplace_back();
+		Rung & rung = rungs[activeRungs++];
+		rung.start = start;
+		rung.width = width;
+		rung.current = 0;
+		rung.buckets.resize(bucketCount); //old buckets are already empty and keep their capacity
+		return rung;
+	}
+
+	//spreads the top over a new first rung, everything scheduled from now on at or after topMax stays in the top
+	void transferTop()
+	{
+		topStart = topMax;
+		if (topMin == topMax)
+		{
+			bottom.swap(topEvents);
+			sortEventsDescending(bottom);
+		}
+		else
+		{
+			Rung & rung = openRung(topMin, (topMax - topMin) / topEvents.size(), topEvents.size() + 1);
+			for (auto & event : topEvents) rung.buckets[bucketIndex(rung, event.time)].push_back(event);
+			topEvents.clear();
+		}
+		topMin = std::numeric_limits<double>::infinity();
+		topMax = -std::numeric_limits<double>::infinity();
+	}
+
+	//makes sure the bottom holds the next events, walking down the ladder or refilling it from the top
+	void prepareBottom()
+	{
+		while (bottom.empty())
+		{
+			//drop exhausted rungs at the end of the ladder
+			while (activeRungs > 0 && rungs[activeRungs - 1].current >= rungs[activeRungs - 1].buckets.size()) activeRungs--;
+
+			if (activeRungs == 0)
+			{
+				transferTop();
+				continue;
+			}
+
+			Rung & rung = rungs[activeRungs - 1];
+			while (rung.current < rung.buckets.size() && rung.buckets[rung.current].empty()) rung.current++;
+			if (rung.current >= rung.buckets.size()) continue;
+
+			std::vector<FutureEvent> & bucket = rung.buckets[rung.current];
+			double bucketStart = rung.start + rung.current * rung.width;
+			rung.current++;
+
+			auto range = std::minmax_element(bucket.begin(), bucket.end(),
+				[](const FutureEvent & a, const FutureEvent & b) { return a.time < b.time; });
+
+			if (bucket.size() > bucketThreshold && activeRungs < maxRungs && range.first->time < range.second->time)
+			{
+				//too many events to sort, split the bucket into a finer rung
+				spill.clear();
+				spill.swap(bucket);
+				Rung & child = openRung(bucketStart, rung.width / spill.size(), spill.size());
+				for (auto & event : spill) child.buckets[bucketIndex(child, event.time)].push_back(event);
+				spill.clear();
+			}
+			else
+			{
+				bottom.swap(bucket);
+				sortEventsDescending(bottom);
+			}
+		}
+	}
+
+	std::vector<FutureEvent> topEvents;
+	double topStart = -std::numeric_limits<double>::infinity();
+	double topMin = std::numeric_limits<double>::infinity();
+	double topMax = -std::numeric_limits<double>::infinity();
+
+	std::vector<Rung> rungs;
+	size_t activeRungs = 0;
+
+	std::vector<FutureEvent> bottom;
+	std::vector<FutureEvent> spill;
+
+	size_t count = 0;
+	unsigned long long nextSequence = 0;
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+/*
+	Single server FIFO queue with poisson arrivals and gamma service times (M/G/1), driven by the Lindley recursion.
+
+	With FIFO service the waiting time of the next customer only depends on the previous one:
+		W(n+1) = max(0, W(n) + S(n) - A(n+1))
+	where S(n) is the service time of customer n and A(n+1) the gap to the next arrival. So there is no need to keep
+	the customers in a container, the queue is a couple of doubles and every customer costs an add, a subtract and
+	a max. The time average number of customers waiting follows from Little's law as (sum of W) / (elapsed time).
+
+	Gaps and service times are filled in blocks by BatchRandomEngine, integer gamma shapes are drawn as the sum of
+	that many exponentials (Erlang), which stays in the vector kernels. The recursion itself is a sequential scan
+	over the block without branches, the waiting time histogram is the only scattered write.
+*/
+
+#include <algorithm>
+#include <vector>
+#include <math.h>
+
+#include "BatchVariates.h"
+
+//what one or more runs of the queue observed, merges exactly across replications
+struct LindleyQueueStatistics
+{
+	long long customers = 0;
+	long long customersNotWaiting = 0;   //arrived to an idle server
+	double elapsedTime = 0;              //from the first to the last arrival
+	double totalWait = 0;
+	double totalWaitSquared = 0;
+	double totalService = 0;
+
+	//waiting times in bins of binWidth, the last bin collects everything beyond the range, there is always at least one
+	//bin since simulate writes to the last one
+	double binWidth = 0.05;
+	std::vector<long long> waitHistogram;
+
+	LindleyQueueStatistics() : LindleyQueueStatistics(0.05, 2048) {}
+	LindleyQueueStatistics(double binWidth, int bins)
+		: binWidth(binWidth), waitHistogram(std::max(bins, 1), 0)
+	{
+	}
+
+	void merge(const LindleyQueueStatistics & other)
+	{
+		customers += other.customers;
+		customersNotWaiting += other.customersNotWaiting;
+		elapsedTime += other.elapsedTime;
+		totalWait += other.totalWait;
+		totalWaitSquared += other.totalWaitSquared;
+		totalService += other.totalService;
+		for (size_t b = 0; b < waitHistogram.size(); b++) waitHistogram[b] += other.waitHistogram[b];
+	}
+
+	//Little's law, Lq = lambda * Wq = (sum of waits) / time
+	double timeAverageQueueLength() const { return elapsedTime > 0 ? totalWait / elapsedTime : 0; }
+	double utilization() const { return elapsedTime > 0 ? totalService / elapsedTime : 0; }
+	double meanWait() const { return customers > 0 ? totalWait / customers : 0; }
+	double probabilityOfNoWait() const { return customers > 0 ? (double)customersNotWaiting / customers : 0; }
+
+	//quantile of the waiting time, the atom at 0 is handled exactly and the rest is interpolated within a bin
+	double waitQuantile(double probability) const
+	{
+		double target = probability * customers;
+		if (target <= customersNotWaiting) return 0;
+
+		//bin 0 holds the customers that did not wait as well, take them out first
+		double cumulative = (double)customersNotWaiting;
+		for (size_t b = 0; b < waitHistogram.size(); b++)
+		{
+			double count = (double)waitHistogram[b] - (b == 0 ? customersNotWaiting : 0);
+			if (cumulative + count >= target)
+			{
+				return binWidth * (b + (count > 0 ? (target - cumulative) / count : 0));
+			}
+			cumulative += count;
+		}
+		return binWidth * waitHistogram.size();
+	}
+};
+
+//Pollaczek-Khinchine mean number of customers waiting, for checking the simulation against
+inline double pollaczekKhinchineQueueLength(double arrivalRate, double serviceShape, double serviceScale)
+{
+	double meanService = serviceShape * serviceScale;
+	double secondMomentService = serviceShape * (serviceShape + 1) * serviceScale * serviceScale;
+	double rho = arrivalRate * meanService;
+	return rho < 1 ? arrivalRate * arrivalRate * secondMomentService / (2 * (1 - rho)) : INFINITY;
+}
+
+class LindleyQueue
+{
+public:
+	LindleyQueue(uint64_t seed, double arrivalRate, double serviceShape, double serviceScale)
+		: engine(seed), arrivalRate(arrivalRate), serviceShape(serviceShape), serviceScale(serviceScale),
+		gaps(blockSize), services(blockSize)
+	{
+		//small integer shapes are summed from exponentials, which is much cheaper than the squeeze method
+		erlangStages = (serviceShape == floor(serviceShape) && serviceShape >= 1 && serviceShape <= 8) ? (int)serviceShape : 0;
+		if (erlangStages > 0) stages.resize(blockSize * erlangStages);
+	}
+
+	//runs the next customers through the queue, the state carries over between calls so a long run can be split up
+	//(e.g. into batches) without any effect on the sample path, waits (if given) receives every customers waiting time
+	void simulate(long long customers, LindleyQueueStatistics & statistics, double * waits = nullptr)
+	{
+		const double inverseBinWidth = 1 / statistics.binWidth;
+		const int lastBin = (int)statistics.waitHistogram.size() - 1;
+		long long * histogram = statistics.waitHistogram.data();
+
+		while (customers > 0)
+		{
+			int n = (int)std::min<long long>(customers, blockSize);
+			fillBlock(n);
+
+			double blockWait = 0, blockWaitSquared = 0, blockService = 0, blockTime = 0;
+			long long blockNotWaiting = 0;
+			for (int k = 0; k < n; k++)
+			{
+				//the increment doesn't depend on the previous wait, so only an add and a max are on the critical path
+				double increment = (k == 0 ? pendingService : services[k - 1]) - gaps[k];
+				wait = std::max(0.0, wait + increment);
+
+				blockWait += wait;
+				blockWaitSquared += wait * wait;
+				blockService += services[k];
+				blockTime += gaps[k];
+				blockNotWaiting += (wait == 0);
+				histogram[std::min((int)(wait * inverseBinWidth), lastBin)]++;
+				if (waits) waits[k] = wait;
+			}
+			if (waits) waits += n;
+
+			//the very first customer finds an empty system, its gap is from time 0 and doesn't count as elapsed time
+			if (!started)
+			{
+				blockTime -= gaps[0];
+				started = true;
+			}
+
+			pendingService = services[n - 1];
+			statistics.customers += n;
+			statistics.customersNotWaiting += blockNotWaiting;
+			statistics.elapsedTime += blockTime;
+			statistics.totalWait += blockWait;
+			statistics.totalWaitSquared += blockWaitSquared;
+			statistics.totalService += blockService;
+			customers -= n;
+		}
+	}
+
+	double currentWait() const { return wait; }
+
+private:
+	void fillBlock(int n)
+	{
+		engine.fillExponential(gaps.data(), n, arrivalRate);
+		if (erlangStages > 0)
+		{
+			engine.fillExponential(stages.data(), (size_t)n * erlangStages, 1 / serviceScale);
+			for (int k = 0; k < n; k++)
+			{
+				double sum = 0;
+				for (int s = 0; s < erlangStages; s++) sum += stages[(size_t)s * n + k];
+				services[k] = sum;
+			}
+		}
+		else
+		{
+			engine.fillGamma(services.data(), n, serviceShape, serviceScale);
+		}
+	}
+
+	static const int blockSize = 4096;
+
+	BatchRandomEngine engine;
+	double arrivalRate;
+	double serviceShape;
+	double serviceScale;
+	int erlangStages = 0;
+
+	//waiting time of the last arrival and the service time it will need once it gets to the server
+	double wait = 0;
+	double pendingService = 0;
+	bool started = false;
+
+	std::vector<double> gaps;
+	std::vector<double> services;
+	std::vector<double> stages;
+};
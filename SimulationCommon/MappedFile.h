@@ -0,0 +1,116 @@
+#pragma once
+
+/*
+	Read only memory mapped file, CreateFileMapping on Windows and mmap everywhere else.
+
+	The whole file is mapped at once and the pages are loaded by the OS on first touch, so opening a multi gigabyte
+	input is instant and only the parts that are actually used end up in memory.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+
+	//maps the file, false if it can't be opened (an empty file opens fine with size() == 0)
+	bool open(const char * path)
+	{
+		close();
+
+#if defined(_WIN32)
+		fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (fileHandle == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(fileHandle, &fileSize))
+		{
+			close();
+			return false;
+		}
+		length = (size_t)fileSize.QuadPart;
+		if (length == 0) return true;
+
+		mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mappingHandle == NULL)
+		{
+			close();
+			return false;
+		}
+		view = (const uint8_t *)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+		descriptor = ::open(path, O_RDONLY);
+		if (descriptor < 0) return false;
+
+		struct stat status;
+		if (fstat(descriptor, &status) != 0)
+		{
+			close();
+			return false;
+		}
+		length = (size_t)status.st_size;
+		if (length == 0) return true;
+
+		void * mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		view = mapping == MAP_FAILED ? NULL : (const uint8_t *)mapping;
+#endif
+
+		if (view == NULL)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+#if defined(_WIN32)
+		if (view) UnmapViewOfFile(view);
+		if (mappingHandle != NULL) CloseHandle(mappingHandle);
+		if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+		mappingHandle = NULL;
+		fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (view) munmap((void *)view, length);
+		if (descriptor >= 0) ::close(descriptor);
+		descriptor = -1;
+#endif
+		view = NULL;
+		length = 0;
+	}
+
+	const uint8_t * data() const { return view; }
+	size_t size() const { return length; }
+	bool isOpen() const { return view != NULL || (length == 0 && isFileOpen()); }
+
+private:
+#if defined(_WIN32)
+	bool isFileOpen() const { return fileHandle != INVALID_HANDLE_VALUE; }
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	HANDLE mappingHandle = NULL;
+#else
+	bool isFileOpen() const { return descriptor >= 0; }
+	int descriptor = -1;
+#endif
+	const uint8_t * view = NULL;
+	size_t length = 0;
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+/*
+	Multilevel Monte Carlo (Giles) over the resolutions of a discretised model, level l runs at coarsest * M^l ticks
+	per unit. With P_l the output at level l,
+		E[P_L] = E[P_0] + sum_{l = 1..L} E[P_l - P_(l-1)]
+	and every correction Y_l = P_l - P_(l-1) is sampled with both resolutions driven by the same randomness, so its
+	variance V_l is small and shrinks with l. The corrections of the levels are independent of each other.
+
+	multilevelMonteCarlo aims at a root mean square error of targetRmse, half the squared error for the sampling and
+	half for the bias left beyond the finest level:
+		N_l = 2 / targetRmse^2 sqrt(V_l / C_l) sum_k sqrt(V_k C_k)      minimises the cost for sum V_l / N_l = targetRmse^2 / 2
+		bias ~ max(|E Y_L|, |E Y_(L-1)| / M^alpha) / (M^alpha - 1)      |E Y_l| ~ M^-alpha l, alpha fitted over l >= 1
+	where an |E Y_l| below the standard error of its estimate counts as the standard error, so noise can't make the
+	bias look smaller than it is known to be.
+	C_l is the measured time of a sample, or what a cost model says a sample of the level costs (the work an engine
+	that isn't the one being run would do, say). It starts with levels 0 .. 2, tops the levels up to their N_l and
+	adds a finer level while the bias is too large, until maximumLevel. The coarsest level has to be fine enough that
+	V_1 is well below V_0, or the corrections cost as much as the plain output.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <vector>
+
+#include "StreamingStatistics.h"
+
+//the samples of one level, the correction (P_0 itself on level 0) and the finer output alone
+struct LevelSamples
+{
+	RunningMoments correction;
+	RunningMoments fine;
+
+	void add(double fineOutput, double coarseOutput)
+	{
+		correction.add(fineOutput - coarseOutput);
+		fine.add(fineOutput);
+	}
+
+	void merge(const LevelSamples & other)
+	{
+		correction.merge(other.correction);
+		fine.merge(other.fine);
+	}
+};
+
+struct MultilevelLevel
+{
+	LevelSamples samples;
+	double seconds = 0;
+
+	double costPerSample() const { return samples.correction.count() > 0 ? seconds / samples.correction.count() : 0.0; }
+};
+
+struct MultilevelResult
+{
+	std::vector<MultilevelLevel> levels;
+	double estimate = 0;
+	double variance = 0;     //of the estimate, sum V_l / N_l
+	double bias = 0;         //estimated bias left beyond the finest level
+	double alpha = 0;        //fitted decay of the corrections
+	bool converged = false;  //the bias met its half of the error before maximumLevel
+};
+
+/*
+	sample(level, firstSample, count) returns the LevelSamples of samples [firstSample, firstSample + count) of a
+	level (usually a reduceReplicationRange, so topping a level up continues its sample sequence), cost(level,
+	samples) the cost of one sample of the level.
+*/
+template <typename SampleLevel, typename CostModel>
+MultilevelResult multilevelMonteCarlo(double targetRmse, double refinement, int initialSamples, int maximumLevel, SampleLevel sample, CostModel cost)
+{
+	MultilevelResult result;
+	result.levels.resize(3);
+	std::vector<long long> extra(3, initialSamples);
+
+	while (true)
+	{
+		for (size_t level = 0; level < result.levels.size(); level++)
+		{
+			if (extra[level] <= 0) continue;
+			MultilevelLevel & current = result.levels[level];
+			auto begin = std::chrono::steady_clock::now();
+			current.samples.merge(sample((int)level, (int)current.samples.correction.count(), (int)extra[level]));
+			current.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		}
+
+		//samples per level for a sampling variance of targetRmse^2 / 2, a level short of it by more than 1% gets topped up
+		double spread = 0;
+		for (size_t level = 0; level < result.levels.size(); level++)
+		{
+			spread += sqrt(result.levels[level].samples.correction.variance() * cost((int)level, result.levels[level]));
+		}
+		bool topUp = false;
+		extra.assign(result.levels.size(), 0);
+		for (size_t level = 0; level < result.levels.size(); level++)
+		{
+			const MultilevelLevel & current = result.levels[level];
+			double levelCost = std::max(cost((int)level, current), 1e-300);
+			long long needed = (long long)ceil(2 / (targetRmse * targetRmse) * sqrt(current.samples.correction.variance() / levelCost) * spread);
+			long long have = current.samples.correction.count();
+			if (needed > have + have / 100)
+			{
+				extra[level] = needed - have;
+				topUp = true;
+			}
+		}
+		if (topUp) continue;
+
+		//a correction can't be known to be smaller than its standard error
+		auto size = [&](size_t level)
+		{
+			const RunningMoments & correction = result.levels[level].samples.correction;
+			return std::max(std::max(fabs(correction.mean()), correction.standardError()), 1e-300);
+		};
+
+		//decay of |E Y_l| over the correction levels, least squares in log base M
+		double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+		int points = 0;
+		for (size_t level = 1; level < result.levels.size(); level++)
+		{
+			double x = (double)level;
+			double y = log(size(level)) / log(refinement);
+			sumX += x;
+			sumY += y;
+			sumXX += x * x;
+			sumXY += x * y;
+			points++;
+		}
+		double slope = (points * sumXY - sumX * sumY) / (points * sumXX - sumX * sumX);
+		result.alpha = std::max(0.5, -slope);
+
+		size_t finest = result.levels.size() - 1;
+		double shrink = pow(refinement, result.alpha);
+		result.bias = std::max(size(finest), size(finest - 1) / shrink) / (shrink - 1);
+		if (result.bias <= targetRmse / sqrt(2.0))
+		{
+			result.converged = true;
+			break;
+		}
+		if ((int)finest >= maximumLevel) break;
+
+		result.levels.emplace_back();
+		extra.push_back(initialSamples);
+	}
+
+	for (const MultilevelLevel & level : result.levels)
+	{
+		result.estimate += level.samples.correction.mean();
+		result.variance += level.samples.correction.variance() / level.samples.correction.count();
+	}
+	return result;
+}
+
+//with the measured time of a sample as its cost
+template <typename SampleLevel>
+MultilevelResult multilevelMonteCarlo(double targetRmse, double refinement, int initialSamples, int maximumLevel, SampleLevel sample)
+{
+	return multilevelMonteCarlo(targetRmse, refinement, initialSamples, maximumLevel, sample,
+		[](int, const MultilevelLevel & samples) { return samples.costPerSample(); });
+}
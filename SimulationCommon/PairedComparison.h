@@ -0,0 +1,101 @@
+#pragma once
+
+/*
+	Common random numbers and antithetic pairs for comparing two configurations of a model (10 vs 12 bikes at the
+	start, two policies, ...).
+
+	The arrivals of a trial come from one stream per event class, seeded from the trial's stream seed and the class
+	alone (TrialStreams::eventClassSeed). Two configurations simulated with the same TrialStreams therefore consume
+	exactly the same arrival randomness whatever they do with it, and the difference of their outputs only carries the
+	noise the change of configuration causes. That difference is one observation (common random numbers).
+
+	An antithetic pair runs the trial again with every uniform u replaced by 1 - u. The exponential clocks then have
+	to draw by inversion (ClockVariates::Inversion and its twin) instead of the ziggurat, and for an output that is
+	monotone in every arrival stream the two halves are negatively correlated. The observation is their average.
+
+	PairedComparison keeps the differences of every metric under the three schemes, independent streams for the two
+	configurations (the baseline), common streams, and common streams with antithetic pairs, and prints the
+	confidence interval of each mean difference. The variance is compared per simulation run (2 for an independent or
+	common pair, 4 for an antithetic one), so "x fewer runs" is how many times fewer runs a scheme needs for the same
+	half width as the baseline.
+*/
+
+#include <initializer_list>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <vector>
+
+#include "BatchVariates.h"
+#include "RateProfile.h"
+#include "StreamingStatistics.h"
+
+//the random numbers of one trial, shared by every configuration simulated in it
+struct TrialStreams
+{
+	uint64_t seed;
+	ClockVariates variates;
+
+	uint64_t eventClassSeed(uint64_t eventClass) const { return mixStreamSeed(seed, eventClass); }
+
+	//the same streams with the uniforms mirrored, the clocks switch to inversion
+	TrialStreams antitheticTwin() const { return TrialStreams{ seed, ClockVariates::AntitheticInversion }; }
+};
+
+//the 64 bit stream seed of a trial from its generator, as the models draw it
+inline uint64_t drawStreamSeed(std::default_random_engine & generator)
+{
+	uint64_t streamSeed = generator();
+	return (streamSeed << 32) ^ generator();
+}
+
+enum class PairingScheme { Independent, Common, CommonAntithetic };
+
+class PairedComparison
+{
+public:
+	static const int schemeCount = 3;
+
+	PairedComparison() {}
+	PairedComparison(std::initializer_list<const char *> metricNames)
+	{
+		for (int scheme = 0; scheme < schemeCount; scheme++) differences[scheme] = MetricSet(metricNames);
+	}
+
+	//difference (second configuration - first) of one metric in one observation of a scheme
+	void add(PairingScheme scheme, size_t metric, double difference) { differences[(int)scheme].add(metric, difference); }
+
+	void merge(const PairedComparison & other)
+	{
+		for (int scheme = 0; scheme < schemeCount; scheme++) differences[scheme].merge(other.differences[scheme]);
+	}
+
+	const RunningMoments & operator()(PairingScheme scheme, size_t metric) const { return differences[(int)scheme][metric]; }
+
+	//simulation runs behind one observation of a scheme
+	static int runsPerObservation(PairingScheme scheme) { return scheme == PairingScheme::CommonAntithetic ? 4 : 2; }
+
+	//the confidence interval of every mean difference and how many times fewer runs each scheme needs than the baseline
+	void print(std::ostream & out, double z = 1.96) const
+	{
+		static const char * schemeNames[schemeCount] = { "independent streams", "common random numbers", "common, antithetic pairs" };
+		const MetricSet & baseline = differences[(int)PairingScheme::Independent];
+		for (size_t m = 0; m < baseline.size(); m++)
+		{
+			out << "difference in " << baseline.name(m) << " :" << std::endl;
+			double baselineCost = baseline[m].variance() * runsPerObservation(PairingScheme::Independent);
+			for (int scheme = 0; scheme < schemeCount; scheme++)
+			{
+				const RunningMoments & moments = differences[scheme][m];
+				double cost = moments.variance() * runsPerObservation((PairingScheme)scheme);
+				out << "  " << schemeNames[scheme] << " : " << moments.mean() << " +-" << moments.halfWidth(z)
+					<< " over " << moments.count() << " observations";
+				if (scheme > 0 && cost > 0) out << ", " << baselineCost / cost << "x fewer runs";
+				out << std::endl;
+			}
+		}
+	}
+
+private:
+	MetricSet differences[schemeCount];
+};
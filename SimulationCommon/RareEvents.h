@@ -0,0 +1,177 @@
+#pragma once
+
+/*
+	Rare event estimation for the station models, probabilities far too small for plain replications to ever see.
+
+	Importance sampling by exponential tilting: the arrivals of every class are simulated at tilted rates and every
+	trial is weighted with its likelihood ratio. A class may be a kind of arrival in one regime of the model only (a
+	client while the station has bikes, a bike while it is empty, ...), its rate then applies over the time E_k the
+	model spends in that regime, its exposure, and for N_k arrivals
+		W = prod_k (nominal_k / tilted_k)^N_k exp(-(nominal_k - tilted_k) E_k)
+	The tilt comes from the cross-entropy method (crossEntropyTilt): raise a threshold level by level (the 1 - rho
+	quantile of the scores, capped at the target) and refit the rates to the weighted trials that reach it, which
+	for poisson rates has the closed form
+		tilted_k = sum W 1{score >= level} N_k / sum W 1{score >= level} E_k
+
+	Multilevel splitting (fixed effort): an importance function of the state of a path, as close as can be to the log
+	of the probability of the event from that state, reaches the target exactly when the event happens. Levels
+	l_1 < ... < l_m = target cut the way up into steps that are not rare; stage k starts effort paths from the states
+	where paths of stage k - 1 first crossed l_(k-1) (in turn, so every entrance state is used evenly) and runs each
+	until it crosses l_k or the horizon ends. The product of the fractions that cross is an unbiased estimate of the
+	probability of the event whatever the importance function, a poor one only costs variance. placeSplittingLevels
+	puts the levels at the 1 - rho quantiles of the highest importance the paths of a pilot reach, the estimates then
+	come from runs that are independent of the pilot so the levels don't bias them.
+
+	Either way the relative error (standard error / estimate) is what the output reports, it is what decides how many
+	runs a given precision costs.
+*/
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#include "BatchVariates.h"
+
+//log of the likelihood ratio of poisson arrivals simulated at tilted rates, class k over the time exposure[k]
+inline double poissonLogLikelihoodRatio(const double * nominal, const double * tilted, const double * counts, const double * exposure, size_t classes)
+{
+	double logRatio = 0;
+	for (size_t k = 0; k < classes; k++)
+	{
+		if (counts[k] > 0) logRatio += counts[k] * log(nominal[k] / tilted[k]);
+		logRatio -= (nominal[k] - tilted[k]) * exposure[k];
+	}
+	return logRatio;
+}
+
+//the score below which a fraction quantile of the scores lies
+inline double scoreQuantile(std::vector<double> scores, double quantile)
+{
+	size_t k = std::min(scores.size() - 1, (size_t)(quantile * scores.size()));
+	std::nth_element(scores.begin(), scores.begin() + k, scores.end());
+	return scores[k];
+}
+
+/*
+	Cross-entropy tilt of poisson rates towards score >= target. simulate(rates, random, counts, exposure) runs one
+	trial at the given rates, fills counts[k] and exposure[k] with the arrivals of class k and the time its rate
+	applied, and returns the score. Stops once the level reaches the
+	target (or after maxIterations), tilted holds the rates to sample with.
+*/
+template <typename Simulate>
+int crossEntropyTilt(const std::vector<double> & nominal, double target, int samples, double rho, uint64_t seed,
+	Simulate simulate, std::vector<double> & tilted, int maxIterations = 50)
+{
+	size_t classes = nominal.size();
+	tilted = nominal;
+	CompactRandomStream random(seed);
+	std::vector<double> scores(samples), weights(samples), counts((size_t)samples * classes), exposures((size_t)samples * classes);
+
+	for (int iteration = 1; iteration <= maxIterations; iteration++)
+	{
+		for (int i = 0; i < samples; i++)
+		{
+			double * trialCounts = counts.data() + (size_t)i * classes;
+			double * trialExposure = exposures.data() + (size_t)i * classes;
+			scores[i] = simulate(tilted.data(), random, trialCounts, trialExposure);
+			weights[i] = exp(poissonLogLikelihoodRatio(nominal.data(), tilted.data(), trialCounts, trialExposure, classes));
+		}
+		double level = std::min(target, scoreQuantile(scores, 1 - rho));
+
+		std::vector<double> weightedCounts(classes, 0.0), weightedExposure(classes, 0.0);
+		for (int i = 0; i < samples; i++)
+		{
+			if (scores[i] < level) continue;
+			for (size_t k = 0; k < classes; k++)
+			{
+				weightedCounts[k] += weights[i] * counts[(size_t)i * classes + k];
+				weightedExposure[k] += weights[i] * exposures[(size_t)i * classes + k];
+			}
+		}
+		//a class never exposed among the trials that count keeps its rate
+		for (size_t k = 0; k < classes; k++)
+		{
+			if (weightedExposure[k] > 0) tilted[k] = std::max(weightedCounts[k] / weightedExposure[k], 1e-6 * nominal[k]);
+		}
+		if (level >= target) return iteration;
+	}
+	return maxIterations;
+}
+
+/*
+	advance(state, level, random) continues a path from state until its importance reaches level, leaving state at
+	the crossing, or until the horizon ends, and returns the highest importance reached. The levels end with the target.
+	Returns the product of the stage fractions, stages gets each fraction if given.
+*/
+template <typename State, typename Advance>
+double fixedEffortSplitting(const State & start, const std::vector<double> & levels, int effort, uint64_t seed, Advance advance,
+	std::vector<double> * stages = nullptr)
+{
+	CompactRandomStream random(seed);
+	std::vector<State> entrance(1, start), crossed;
+	double estimate = 1;
+	if (stages) stages->clear();
+	for (double level : levels)
+	{
+		crossed.clear();
+		for (int i = 0; i < effort; i++)
+		{
+			State path = entrance[i % entrance.size()];
+			if (advance(path, level, random) >= level) crossed.push_back(path);
+		}
+		double fraction = (double)crossed.size() / effort;
+		if (stages) stages->push_back(fraction);
+		estimate *= fraction;
+		if (crossed.empty()) return 0;
+		entrance.swap(crossed);
+	}
+	return estimate;
+}
+
+//levels for fixedEffortSplitting from a pilot with the same advance, every stage is expected to pass about rho
+template <typename State, typename Advance>
+std::vector<double> placeSplittingLevels(const State & start, double startImportance, double target, int effort, double rho, uint64_t seed,
+	Advance advance, int maxLevels = 100)
+{
+	CompactRandomStream random(seed);
+	std::vector<double> levels;
+	std::vector<State> entrance(1, start), crossed;
+	std::vector<double> reached(effort);
+	double last = startImportance;
+	while ((int)levels.size() < maxLevels)
+	{
+		//how far the paths get when they are let run all the way
+		for (int i = 0; i < effort; i++)
+		{
+			State path = entrance[i % entrance.size()];
+			reached[i] = advance(path, target, random);
+		}
+		double level = scoreQuantile(reached, 1 - rho);
+		if (level >= target) break;
+		if (level <= last)
+		{
+			//a lump of paths stuck at the last level, take the lowest score above it
+			double above = target;
+			for (double value : reached)
+			{
+				if (value > last) above = std::min(above, value);
+			}
+			level = above;
+			if (level >= target) break;
+		}
+		levels.push_back(level);
+		last = level;
+
+		crossed.clear();
+		for (int i = 0; i < effort; i++)
+		{
+			State path = entrance[i % entrance.size()];
+			if (advance(path, level, random) >= level) crossed.push_back(path);
+		}
+		if (crossed.empty()) break;
+		entrance.swap(crossed);
+	}
+	levels.push_back(target);
+	return levels;
+}
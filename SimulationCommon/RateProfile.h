@@ -0,0 +1,366 @@
+#pragma once
+
+/*
+	Time of day arrival rates for the station models, non-homogeneous Poisson processes whose rate follows a profile.
+
+	A RateProfile covers one period (a day) and repeats. It is either piecewise constant (rates[k] on
+	[times[k], times[k + 1])) or piecewise linear (straight lines between the knots, the last one back to rates[0] at
+	the end of the period so the days join up). Along with the knots it keeps the integrated rate at every knot, which
+	gives two exact ways to get the next arrival after t:
+
+		inversion   solve Lambda(s) - Lambda(t) = E for an Exp(1) E, a division on a constant piece and the stable root of
+		            a quadratic on a linear one, never rejects anything
+		thinning    candidates from a piecewise constant majorant (by inversion), each kept with probability
+		            rate / majorant; the majorant splits every linear piece until the rate changes by at most
+		            majorantSlack of its largest value on a piece, so even a 20x rush hour rejects under 10%
+
+	ProfileArrivalClock draws the arrivals of one profile either way and counts the rejected candidates. Its Exp(1)
+	variates come from the ziggurat, or by inversion when the clock has to be paired with an antithetic twin (see
+	ClockVariates and PairedComparison.h).
+
+	UnitThinningTable superposes the profiles of several event classes unit by unit for the retrospective engines:
+	in unit [u, u + 1) the candidates form a homogeneous Poisson process of rate unitRate(u), the sum of the maxima of
+	every profile over the unit. A candidate picks its class from the alias table of the unit and is kept with
+	probability rate / maximum, which needs no profile lookup at all when the class is flat over the unit. With the
+	rush hour profiles below about 10% of the candidates are rejected, none with constant rates.
+*/
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#include "AliasTable.h"
+#include "BatchVariates.h"
+
+//largest relative change of the rate under one piece of a thinning majorant
+const double majorantSlack = 0.1;
+
+class RateProfile
+{
+public:
+	enum class Shape { PiecewiseConstant, PiecewiseLinear };
+
+	RateProfile() : RateProfile(Shape::PiecewiseConstant, { 0 }, { 0 }, 1) {}
+
+	static RateProfile constant(double rate) { return RateProfile(Shape::PiecewiseConstant, { 0 }, { rate }, 1); }
+
+	//times[0] = 0 < times[1] < ... < period, rates >= 0
+	static RateProfile piecewiseConstant(const std::vector<double> & times, const std::vector<double> & rates, double period)
+	{
+		return RateProfile(Shape::PiecewiseConstant, times, rates, period);
+	}
+	static RateProfile piecewiseLinear(const std::vector<double> & times, const std::vector<double> & rates, double period)
+	{
+		return RateProfile(Shape::PiecewiseLinear, times, rates, period);
+	}
+
+	//same shape, every rate multiplied by factor
+	RateProfile scaled(double factor) const
+	{
+		std::vector<double> rates(knotRate.begin(), knotRate.end() - 1);
+		for (double & rate : rates) rate *= factor;
+		return RateProfile(shape, std::vector<double>(knotTime.begin(), knotTime.end() - 1), rates, period);
+	}
+
+	double rate(double t) const
+	{
+		double phase = phaseOf(t);
+		size_t k = segmentOf(phase);
+		if (shape == Shape::PiecewiseConstant) return knotRate[k];
+		return knotRate[k] + slope[k] * (phase - knotTime[k]);
+	}
+
+	//integrated rate over [0, t]
+	double cumulative(double t) const
+	{
+		double cycles = floor(t / period);
+		double phase = t - cycles * period;
+		size_t k = segmentOf(phase);
+		double x = phase - knotTime[k];
+		double within = shape == Shape::PiecewiseConstant ? knotRate[k] * x : (knotRate[k] + 0.5 * slope[k] * x) * x;
+		return cycles * knotCumulative.back() + knotCumulative[k] + within;
+	}
+
+	double mean() const { return knotCumulative.back() / period; }
+
+	//largest rate over [a, b]
+	double maximum(double a, double b) const
+	{
+		double largest = std::max(rate(a), rate(b));
+		if (b - a >= period)
+		{
+			for (size_t k = 0; k + 1 < knotTime.size(); k++) largest = std::max(largest, knotRate[k]);
+			return largest;
+		}
+		//knots strictly inside, a constant profile's pieces start at knots too
+		double start = floor(a / period) * period;
+		for (double cycle = start; cycle <= b; cycle += period)
+		{
+			for (size_t k = 0; k + 1 < knotTime.size(); k++)
+			{
+				double knot = cycle + knotTime[k];
+				if (knot > a && knot < b) largest = std::max(largest, knotRate[k]);
+			}
+		}
+		return largest;
+	}
+
+	//true if the rate doesn't change over [a, b]
+	bool flat(double a, double b) const { return maximum(a, b) == minimumOver(a, b); }
+
+	//the time s > t with cumulative(s) - cumulative(t) = amount, infinity if the rate is 0 everywhere
+	double advance(double t, double amount) const
+	{
+		//a constant rate is a plain exponential gap, keeps the homework's constant rates as cheap as before
+		if (knotTime.size() == 2 && shape == Shape::PiecewiseConstant) return knotRate[0] > 0 ? t + amount / knotRate[0] : INFINITY;
+		return solve(knotTime, knotRate, slope, knotCumulative, t, amount);
+	}
+
+	//the piecewise constant majorant used for thinning
+	double majorantRate(double t) const { return majorantRates[segmentOf(majorantTimes, phaseOf(t))]; }
+	double advanceMajorant(double t, double amount) const
+	{
+		return solve(majorantTimes, majorantRates, majorantSlopes, majorantCumulative, t, amount);
+	}
+
+	Shape profileShape() const { return shape; }
+	double profilePeriod() const { return period; }
+
+private:
+	RateProfile(Shape shape, const std::vector<double> & times, const std::vector<double> & rates, double period)
+		: shape(shape), period(period), knotTime(times), knotRate(rates)
+	{
+		//closing knot at the end of the period, a linear profile heads back to where the next day starts
+		knotTime.push_back(period);
+		knotRate.push_back(rates[0]);
+		slope.assign(knotTime.size(), 0);
+		knotCumulative.assign(knotTime.size(), 0);
+		for (size_t k = 0; k + 1 < knotTime.size(); k++)
+		{
+			double width = knotTime[k + 1] - knotTime[k];
+			if (shape == Shape::PiecewiseLinear) slope[k] = (knotRate[k + 1] - knotRate[k]) / width;
+			double area = shape == Shape::PiecewiseConstant ? knotRate[k] * width : 0.5 * (knotRate[k] + knotRate[k + 1]) * width;
+			knotCumulative[k + 1] = knotCumulative[k] + area;
+		}
+
+		//majorant, the constant pieces as they are, linear pieces split until they are nearly flat
+		for (size_t k = 0; k + 1 < knotTime.size(); k++)
+		{
+			double width = knotTime[k + 1] - knotTime[k];
+			double high = std::max(knotRate[k], knotRate[k + 1]);
+			int pieces = 1;
+			if (shape == Shape::PiecewiseLinear && high > 0)
+			{
+				pieces = (int)std::min(64.0, ceil(fabs(knotRate[k + 1] - knotRate[k]) / (majorantSlack * high)));
+				pieces = std::max(pieces, 1);
+			}
+			for (int piece = 0; piece < pieces; piece++)
+			{
+				double from = knotTime[k] + width * piece / pieces;
+				double to = piece + 1 == pieces ? knotTime[k + 1] : knotTime[k] + width * (piece + 1) / pieces;
+				double pieceRate = shape == Shape::PiecewiseConstant ? knotRate[k]
+					: std::max(knotRate[k] + slope[k] * (from - knotTime[k]), knotRate[k] + slope[k] * (to - knotTime[k]));
+				majorantTimes.push_back(from);
+				majorantRates.push_back(pieceRate);
+			}
+		}
+		majorantTimes.push_back(period);
+		majorantRates.push_back(majorantRates[0]);
+		majorantSlopes.assign(majorantTimes.size(), 0);
+		majorantCumulative.assign(majorantTimes.size(), 0);
+		for (size_t k = 0; k + 1 < majorantTimes.size(); k++)
+		{
+			majorantCumulative[k + 1] = majorantCumulative[k] + majorantRates[k] * (majorantTimes[k + 1] - majorantTimes[k]);
+		}
+	}
+
+	double phaseOf(double t) const { return t - floor(t / period) * period; }
+
+	//piece that holds the phase, the last knot only closes the period
+	static size_t segmentOf(const std::vector<double> & times, double phase)
+	{
+		size_t k = std::upper_bound(times.begin(), times.end(), phase) - times.begin();
+		return std::min(k == 0 ? 0 : k - 1, times.size() - 2);
+	}
+	size_t segmentOf(double phase) const { return segmentOf(knotTime, phase); }
+
+	double minimumOver(double a, double b) const
+	{
+		double smallest = std::min(rate(a), rate(b));
+		double start = floor(a / period) * period;
+		for (double cycle = start; cycle <= b; cycle += period)
+		{
+			for (size_t k = 0; k + 1 < knotTime.size(); k++)
+			{
+				double knot = cycle + knotTime[k];
+				if (knot > a && knot < b) smallest = std::min(smallest, knotRate[k]);
+			}
+		}
+		return smallest;
+	}
+
+	//inverts the integrated rate of the pieces (times, rates, slopes) whose integral at the knots is cumulative
+	double solve(const std::vector<double> & times, const std::vector<double> & rates, const std::vector<double> & slopes,
+		const std::vector<double> & cumulativeAt, double t, double amount) const
+	{
+		double perPeriod = cumulativeAt.back();
+		if (perPeriod <= 0) return INFINITY;
+
+		//integrated rate from the start of t's period to the target, whole periods are skipped in one go
+		double cycleStart = floor(t / period) * period;
+		double phase = t - cycleStart;
+		size_t k = segmentOf(times, phase);
+		double x = phase - times[k];
+		double target = cumulativeAt[k] + (rates[k] + 0.5 * slopes[k] * x) * x + amount;
+		double cycles = floor(target / perPeriod);
+		target -= cycles * perPeriod;
+		cycleStart += cycles * period;
+
+		//first piece whose end reaches the target, it has a positive rate somewhere
+		k = std::upper_bound(cumulativeAt.begin(), cumulativeAt.end(), target) - cumulativeAt.begin();
+		k = std::min(k == 0 ? 0 : k - 1, times.size() - 2);
+		double remaining = target - cumulativeAt[k];
+		double a = rates[k], b = slopes[k];
+		//a x + b x^2 / 2 = remaining, written so it doesn't cancel when b is small
+		double offset = b == 0 ? remaining / a : 2 * remaining / (a + sqrt(std::max(0.0, a * a + 2 * b * remaining)));
+		double s = cycleStart + times[k] + std::min(offset, times[k + 1] - times[k]);
+		return std::max(s, t);
+	}
+
+	Shape shape;
+	double period;
+	std::vector<double> knotTime;       //knots of the period plus the closing one at period
+	std::vector<double> knotRate;
+	std::vector<double> slope;          //of every piece, 0 for a constant profile
+	std::vector<double> knotCumulative; //integrated rate from the start of the period to every knot
+	std::vector<double> majorantTimes;
+	std::vector<double> majorantRates;
+	std::vector<double> majorantSlopes; //all 0, lets the majorant share solve()
+	std::vector<double> majorantCumulative;
+};
+
+enum class ArrivalMethod { Inversion, Thinning };
+
+//how a clock gets its variates: the ziggurat (fastest), inversion of its uniforms, or inversion of the mirrored
+//uniforms of the same seed, the antithetic twin of Inversion
+enum class ClockVariates { Ziggurat, Inversion, AntitheticInversion };
+
+//arrivals of the non-homogeneous poisson process of a profile, the Exp(1) and uniform variates come from their own streams
+class ProfileArrivalClock
+{
+public:
+	ProfileArrivalClock(const RateProfile & profile, uint64_t seed, ArrivalMethod method, ClockVariates variates = ClockVariates::Ziggurat)
+		: profile(&profile), method(method),
+		unitExponentials(variates == ClockVariates::Ziggurat ? VariateStream::exponential(mixStreamSeed(seed, 0), 1)
+			: VariateStream::inverseExponential(mixStreamSeed(seed, 0), 1, variates == ClockVariates::AntitheticInversion)),
+		uniforms(VariateStream::uniform(mixStreamSeed(seed, 1), 0, 1, variates == ClockVariates::AntitheticInversion))
+	{
+	}
+
+	//first arrival after time
+	double next(double time)
+	{
+		if (method == ArrivalMethod::Inversion)
+		{
+			candidates++;
+			return profile->advance(time, unitExponentials.next());
+		}
+		while (true)
+		{
+			time = profile->advanceMajorant(time, unitExponentials.next());
+			candidates++;
+			if (time == INFINITY || uniforms.next() * profile->majorantRate(time) < profile->rate(time)) return time;
+			rejected++;
+		}
+	}
+
+	unsigned long long candidates = 0;
+	unsigned long long rejected = 0;
+
+private:
+	const RateProfile * profile;
+	ArrivalMethod method;
+	VariateStream unitExponentials;
+	VariateStream uniforms;
+};
+
+class UnitThinningTable
+{
+public:
+	//profiles of the event classes, units [firstUnit, firstUnit + units)
+	UnitThinningTable(const std::vector<RateProfile> & profiles, int firstUnit, int units)
+		: profiles(profiles), firstUnit(firstUnit), classCount(profiles.size()), candidateClass(units, profiles.size()),
+		rates(units), maxima((size_t)units * profiles.size()), flatUnits((size_t)units * profiles.size())
+	{
+		for (int u = 0; u < units; u++)
+		{
+			double start = firstUnit + u;
+			rates[u] = 0;
+			for (size_t c = 0; c < classCount; c++)
+			{
+				size_t entry = (size_t)u * classCount + c;
+				maxima[entry] = profiles[c].maximum(start, start + 1);
+				flatUnits[entry] = profiles[c].flat(start, start + 1);
+				rates[u] += maxima[entry];
+			}
+			candidateClass.setRow(u, maxima.data() + (size_t)u * classCount);
+		}
+	}
+
+	//rate of the candidates in [unit, unit + 1)
+	double unitRate(int unit) const { return rates[unit - firstUnit]; }
+
+	//class of a candidate in the unit for a uniform in [0, 1)
+	uint32_t candidate(int unit, double uniform) const { return candidateClass.sample(unit - firstUnit, uniform); }
+
+	//whether a candidate of the class at time is a real event, for another uniform in [0, 1)
+	bool accept(int unit, uint32_t eventClass, double time, double uniform) const
+	{
+		size_t entry = (size_t)(unit - firstUnit) * classCount + eventClass;
+		return flatUnits[entry] || uniform * maxima[entry] < profiles[eventClass].rate(time);
+	}
+
+	//expected share of the candidates over the units that is kept
+	double acceptance() const
+	{
+		double kept = 0, offered = 0;
+		for (size_t u = 0; u < rates.size(); u++)
+		{
+			double start = firstUnit + (double)u;
+			for (const RateProfile & profile : profiles) kept += profile.cumulative(start + 1) - profile.cumulative(start);
+			offered += rates[u];
+		}
+		return offered > 0 ? kept / offered : 1;
+	}
+
+private:
+	std::vector<RateProfile> profiles;
+	int firstUnit;
+	size_t classCount;
+	AliasTableSet candidateClass;
+	std::vector<double> rates;
+	std::vector<double> maxima;
+	std::vector<char> flatUnits;
+};
+
+//a commuter station over a day of 24 time units: quiet nights, a morning peak at 8 and an evening peak at 17 that are
+//20x the night rate, scaled to a mean of 1 so it only redistributes the homework rates over the day
+inline RateProfile rushHourShape(RateProfile::Shape shape)
+{
+	std::vector<double> times = { 0, 5, 8, 11, 14, 17, 20, 23 };
+	std::vector<double> rates = { 0.2, 0.8, 4.0, 1.2, 1.2, 4.0, 1.0, 0.4 };
+	RateProfile profile = shape == RateProfile::Shape::PiecewiseConstant ?
+		RateProfile::piecewiseConstant(times, rates, 24) : RateProfile::piecewiseLinear(times, rates, 24);
+	return profile.scaled(1 / profile.mean());
+}
+
+//leisure riders over the same day, busiest in the early afternoon, also mean 1
+inline RateProfile middayShape(RateProfile::Shape shape)
+{
+	std::vector<double> times = { 0, 7, 10, 14, 18, 22 };
+	std::vector<double> rates = { 0.2, 0.6, 1.6, 2.4, 1.4, 0.5 };
+	RateProfile profile = shape == RateProfile::Shape::PiecewiseConstant ?
+		RateProfile::piecewiseConstant(times, rates, 24) : RateProfile::piecewiseLinear(times, rates, 24);
+	return profile.scaled(1 / profile.mean());
+}
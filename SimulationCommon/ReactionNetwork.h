@@ -0,0 +1,468 @@
+#pragma once
+
+/*
+	Stochastic reaction networks (compartment models) with mass action kinetics.
+
+	A network is a list of species with initial counts and a list of reactions, every reaction has a rate constant,
+	the species it consumes and the species it produces, e.g. infection S + I -> 2I at rate beta. The propensity of a
+	reaction is rate * prod over its reactants of C(x, k) (x the count, k how many it consumes), Gillespie's convention.
+
+	finalize() builds the dependency graph: firing reaction i changes some counts, and only the reactions that
+	consume one of those species need a new propensity. Both simulators only ever touch those reactions.
+
+	NextReactionSimulator    Gibson & Bruck. Every reaction has a putative firing time in an indexed binary heap,
+	                         the earliest one fires, and the times of the dependents are rescaled by old / new
+	                         propensity instead of being redrawn, so an event costs O(dependents * log reactions)
+	                         and one exponential.
+	CompositionRejectionSimulator  Slepoy, Thompson & Plimpton. Reactions are grouped by propensity in powers of two,
+	                         a group is picked by its total (there are only a few dozen groups) and a reaction in it
+	                         by rejection against the top of the group's range, which accepts at least half the time.
+	                         Updates are O(1), so an event costs O(dependents) no matter how many channels there are.
+	makeReactionSimulator picks composition-rejection once there are compositionRejectionThreshold reactions or more.
+
+	Both simulators run until endTime, until no reaction can fire, or until stop(counts, time) returns true.
+*/
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <math.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct ReactionTerm
+{
+	int species;
+	int count;
+};
+
+struct Reaction
+{
+	double rate;
+	std::vector<ReactionTerm> reactants;
+	std::vector<ReactionTerm> change;   //net change per species, zero entries left out
+};
+
+class ReactionNetwork
+{
+public:
+	int addSpecies(const std::string & name, long long initialCount)
+	{
+		names.push_back(name);
+		initial.push_back(initialCount);
+		return (int)names.size() - 1;
+	}
+
+	//mass action reaction, e.g. addReaction(beta, { { S, 1 }, { I, 1 } }, { { I, 2 } }) for S + I -> 2I
+	int addReaction(double rate, std::vector<ReactionTerm> reactants, std::vector<ReactionTerm> products)
+	{
+		Reaction reaction;
+		reaction.rate = rate;
+		reaction.reactants = reactants;
+
+		std::vector<int> net(names.size(), 0);
+		for (auto & term : reactants) net[term.species] -= term.count;
+		for (auto & term : products) net[term.species] += term.count;
+		for (int s = 0; s < (int)net.size(); s++)
+		{
+			if (net[s] != 0) reaction.change.push_back(ReactionTerm{ s, net[s] });
+		}
+
+		reactions.push_back(reaction);
+		return (int)reactions.size() - 1;
+	}
+
+	//builds the dependency graph, call once after the last reaction was added
+	void finalize()
+	{
+		std::vector<std::vector<int>> consumers(names.size());
+		for (int r = 0; r < (int)reactions.size(); r++)
+		{
+			for (auto & term : reactions[r].reactants) consumers[term.species].push_back(r);
+		}
+
+		dependents.assign(reactions.size(), std::vector<int>());
+		for (int r = 0; r < (int)reactions.size(); r++)
+		{
+			std::vector<int> & affected = dependents[r];
+			affected.push_back(r);
+			for (auto & term : reactions[r].change)
+			{
+				affected.insert(affected.end(), consumers[term.species].begin(), consumers[term.species].end());
+			}
+			std::sort(affected.begin(), affected.end());
+			affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+		}
+	}
+
+	//counts are long long for the exact simulators, double for the continuous species of the hybrid one (TauLeaping.h)
+	template <typename Count>
+	double propensity(int r, const std::vector<Count> & counts) const
+	{
+		const Reaction & reaction = reactions[r];
+		double a = reaction.rate;
+		for (auto & term : reaction.reactants)
+		{
+			Count x = counts[term.species];
+			if (x < term.count) return 0;
+			//C(x, k) for the small k of elementary reactions
+			double combinations = 1;
+			for (int k = 0; k < term.count; k++) combinations = combinations * (x - k) / (k + 1);
+			a *= combinations;
+		}
+		return a;
+	}
+
+	template <typename Count>
+	void fire(int r, std::vector<Count> & counts) const
+	{
+		for (auto & term : reactions[r].change) counts[term.species] += term.count;
+	}
+
+	int speciesCount() const { return (int)names.size(); }
+	int reactionCount() const { return (int)reactions.size(); }
+	const std::string & speciesName(int s) const { return names[s]; }
+	const std::vector<long long> & initialCounts() const { return initial; }
+	const Reaction & reaction(int r) const { return reactions[r]; }
+	const std::vector<int> & dependentsOf(int r) const { return dependents[r]; }
+
+private:
+	std::vector<std::string> names;
+	std::vector<long long> initial;
+	std::vector<Reaction> reactions;
+	std::vector<std::vector<int>> dependents;
+};
+
+//common interface so a model can be run by either simulator
+class ReactionSimulator
+{
+public:
+	explicit ReactionSimulator(const ReactionNetwork & network)
+		: network(network), counts(network.initialCounts()), propensities(network.reactionCount(), 0)
+	{
+	}
+	virtual ~ReactionSimulator() {}
+
+	//back to the initial counts at time 0
+	virtual void reset(std::default_random_engine & generator) = 0;
+
+	//fires the next reaction if it happens before endTime, false (and time = endTime) otherwise
+	virtual bool step(std::default_random_engine & generator, double endTime) = 0;
+
+	template <typename StopCondition>
+	double run(std::default_random_engine & generator, double endTime, StopCondition stop)
+	{
+		while (!stop(counts, time) && step(generator, endTime)) {}
+		return time;
+	}
+
+	double run(std::default_random_engine & generator, double endTime)
+	{
+		return run(generator, endTime, [](const std::vector<long long> &, double) { return false; });
+	}
+
+	const std::vector<long long> & state() const { return counts; }
+	double currentTime() const { return time; }
+	long long eventCount() const { return events; }
+	virtual const char * name() const = 0;
+
+protected:
+	//nothing more happens before endTime, the clock moves there (it stays put when there is no end)
+	void finish(double endTime)
+	{
+		if (!std::isinf(endTime)) time = endTime;
+	}
+
+	const ReactionNetwork & network;
+	std::vector<long long> counts;
+	std::vector<double> propensities;
+	double time = 0;
+	long long events = 0;
+};
+
+class NextReactionSimulator : public ReactionSimulator
+{
+public:
+	explicit NextReactionSimulator(const ReactionNetwork & network)
+		: ReactionSimulator(network), firingTimes(network.reactionCount()), heap(network.reactionCount()), heapPosition(network.reactionCount())
+	{
+	}
+
+	void reset(std::default_random_engine & generator) override
+	{
+		counts = network.initialCounts();
+		time = 0;
+		events = 0;
+		for (int r = 0; r < network.reactionCount(); r++)
+		{
+			propensities[r] = network.propensity(r, counts);
+			firingTimes[r] = drawFiringTime(generator, propensities[r]);
+			heap[r] = r;
+			heapPosition[r] = r;
+		}
+		for (int i = (int)heap.size() / 2 - 1; i >= 0; i--) siftDown(i);
+	}
+
+	bool step(std::default_random_engine & generator, double endTime) override
+	{
+		if (heap.empty() || firingTimes[heap[0]] > endTime || std::isinf(firingTimes[heap[0]]))
+		{
+			finish(endTime);
+			return false;
+		}
+
+		int fired = heap[0];
+		time = firingTimes[fired];
+		network.fire(fired, counts);
+		events++;
+
+		for (int r : network.dependentsOf(fired))
+		{
+			double oldPropensity = propensities[r];
+			double newPropensity = network.propensity(r, counts);
+			propensities[r] = newPropensity;
+
+			if (r == fired || oldPropensity <= 0) firingTimes[r] = drawFiringTime(generator, newPropensity);
+			else if (newPropensity <= 0) firingTimes[r] = std::numeric_limits<double>::infinity();
+			else firingTimes[r] = time + (oldPropensity / newPropensity) * (firingTimes[r] - time);
+
+			update(heapPosition[r]);
+		}
+		return true;
+	}
+
+	const char * name() const override { return "next reaction (Gibson-Bruck)"; }
+
+private:
+	double drawFiringTime(std::default_random_engine & generator, double propensity)
+	{
+		if (propensity <= 0) return std::numeric_limits<double>::infinity();
+		return time + exponential(generator) / propensity;
+	}
+
+	bool earlier(int a, int b) const { return firingTimes[heap[a]] < firingTimes[heap[b]]; }
+
+	void swapNodes(int a, int b)
+	{
+		std::swap(heap[a], heap[b]);
+		heapPosition[heap[a]] = a;
+		heapPosition[heap[b]] = b;
+	}
+
+	void siftDown(int i)
+	{
+		int n = (int)heap.size();
+		while (true)
+		{
+			int smallest = i, left = 2 * i + 1, right = left + 1;
+			if (left < n && earlier(left, smallest)) smallest = left;
+			if (right < n && earlier(right, smallest)) smallest = right;
+			if (smallest == i) return;
+			swapNodes(i, smallest);
+			i = smallest;
+		}
+	}
+
+	void update(int i)
+	{
+		while (i > 0 && earlier(i, (i - 1) / 2))
+		{
+			swapNodes(i, (i - 1) / 2);
+			i = (i - 1) / 2;
+		}
+		siftDown(i);
+	}
+
+	std::exponential_distribution<double> exponential{ 1.0 };
+	std::vector<double> firingTimes;
+	std::vector<int> heap;          //reactions ordered by firing time
+	std::vector<int> heapPosition;  //where every reaction sits in heap
+};
+
+class CompositionRejectionSimulator : public ReactionSimulator
+{
+public:
+	explicit CompositionRejectionSimulator(const ReactionNetwork & network)
+		: ReactionSimulator(network), groupOf(network.reactionCount(), int(noGroup)), slotInGroup(network.reactionCount(), 0)
+	{
+	}
+
+	void reset(std::default_random_engine &) override
+	{
+		counts = network.initialCounts();
+		time = 0;
+		events = 0;
+		groups.clear();
+		activeGroups.clear();
+		std::fill(groupOf.begin(), groupOf.end(), int(noGroup));
+		totalPropensity = 0;
+
+		for (int r = 0; r < network.reactionCount(); r++)
+		{
+			propensities[r] = 0;
+			setPropensity(r, network.propensity(r, counts));
+		}
+		recomputeTotals();
+	}
+
+	bool step(std::default_random_engine & generator, double endTime) override
+	{
+		//the running totals drift a little with every update, start from exact sums every now and then
+		if (++updatesSinceRecompute >= 1000000) recomputeTotals();
+
+		if (activeGroups.empty() || totalPropensity <= 0)
+		{
+			finish(endTime);
+			return false;
+		}
+
+		double next = time + exponential(generator) / totalPropensity;
+		if (next > endTime)
+		{
+			finish(endTime);
+			return false;
+		}
+		time = next;
+
+		//composition: pick a group by its share of the total
+		double target = uniform(generator) * totalPropensity;
+		size_t g = 0;
+		while (g + 1 < activeGroups.size() && target >= groups[activeGroups[g]].total)
+		{
+			target -= groups[activeGroups[g]].total;
+			g++;
+		}
+		const Group & group = groups[activeGroups[g]];
+
+		//rejection: every member is below the top of the group range, which is at most twice its propensity
+		int fired;
+		do
+		{
+			fired = group.members[(size_t)(uniform(generator) * group.members.size()) % group.members.size()];
+		} while (uniform(generator) * group.upperBound >= propensities[fired]);
+
+		network.fire(fired, counts);
+		events++;
+
+		for (int r : network.dependentsOf(fired)) setPropensity(r, network.propensity(r, counts));
+		return true;
+	}
+
+	const char * name() const override { return "composition-rejection"; }
+
+private:
+	struct Group
+	{
+		double upperBound = 0;
+		double total = 0;
+		std::vector<int> members;
+		int activeSlot = -1;   //position in activeGroups, -1 when empty
+	};
+
+	//group for a propensity in [2^(e - 1), 2^e)
+	int groupFor(double propensity)
+	{
+		int exponent;
+		frexp(propensity, &exponent);
+		int index = exponent + exponentOffset;
+		if (index >= (int)groups.size()) groups.resize(index + 1);
+		groups[index].upperBound = ldexp(1.0, exponent);
+		return index;
+	}
+
+	void setPropensity(int r, double propensity)
+	{
+		int current = groupOf[r];
+		int wanted = propensity > 0 ? groupFor(propensity) : noGroup;
+
+		if (current != noGroup)
+		{
+			groups[current].total -= propensities[r];
+			totalPropensity -= propensities[r];
+		}
+		if (current != wanted)
+		{
+			if (current != noGroup) removeFromGroup(r, current);
+			if (wanted != noGroup) addToGroup(r, wanted);
+		}
+		propensities[r] = propensity;
+		if (wanted != noGroup)
+		{
+			groups[wanted].total += propensity;
+			totalPropensity += propensity;
+		}
+	}
+
+	void addToGroup(int r, int g)
+	{
+		Group & group = groups[g];
+		if (group.members.empty())
+		{
+			group.activeSlot = (int)activeGroups.size();
+			activeGroups.push_back(g);
+		}
+		groupOf[r] = g;
+		slotInGroup[r] = (int)group.members.size();
+		group.members.push_back(r);
+	}
+
+	void removeFromGroup(int r, int g)
+	{
+		Group & group = groups[g];
+		int slot = slotInGroup[r];
+		int last = group.members.back();
+		group.members[slot] = last;
+		slotInGroup[last] = slot;
+		group.members.pop_back();
+		groupOf[r] = noGroup;
+
+		if (group.members.empty())
+		{
+			int movedGroup = activeGroups.back();
+			activeGroups[group.activeSlot] = movedGroup;
+			groups[movedGroup].activeSlot = group.activeSlot;
+			activeGroups.pop_back();
+			group.activeSlot = -1;
+			group.total = 0;
+			if (activeGroups.empty()) totalPropensity = 0; //no rounding residue once nothing can fire
+		}
+	}
+
+	void recomputeTotals()
+	{
+		totalPropensity = 0;
+		for (int g : activeGroups)
+		{
+			groups[g].total = 0;
+			for (int r : groups[g].members) groups[g].total += propensities[r];
+			totalPropensity += groups[g].total;
+		}
+		updatesSinceRecompute = 0;
+	}
+
+	static constexpr int noGroup = -1;
+	static const int exponentOffset = 1100; //frexp exponents of doubles are above -1075
+
+	std::exponential_distribution<double> exponential{ 1.0 };
+	std::uniform_real_distribution<double> uniform{ 0.0, 1.0 };
+	std::vector<Group> groups;
+	std::vector<int> activeGroups;   //non empty groups
+	std::vector<int> groupOf;
+	std::vector<int> slotInGroup;
+	double totalPropensity = 0;
+	long long updatesSinceRecompute = 0;
+};
+
+const int compositionRejectionThreshold = 1000;
+
+inline std::unique_ptr<ReactionSimulator> makeReactionSimulator(const ReactionNetwork & network)
+{
+	if (network.reactionCount() >= compositionRejectionThreshold)
+	{
+		return std::unique_ptr<ReactionSimulator>(new CompositionRejectionSimulator(network));
+	}
+	return std::unique_ptr<ReactionSimulator>(new NextReactionSimulator(network));
+}
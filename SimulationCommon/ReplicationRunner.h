@@ -0,0 +1,204 @@
+#pragma once
+
+/*
+	Replication runner shared by the bike station models.
+
+	Trials are split into fixed size chunks and handed to a pool of worker threads. Every worker owns a range of
+	chunks and takes work from the front of it, once its own range is empty it steals half of the remaining range
+	of another worker from the back. Since no new work is ever created, a worker can stop as soon as a full pass
+	over the other workers finds nothing left to steal.
+
+	Every trial gets its own generator seeded from (baseSeed, trialIndex) and writes its result into the slot for
+	that trial, so the results (and anything reduced from them in trial order) are bit-identical no matter how many
+	threads ran or which thread picked up which trial.
+*/
+
+#include <algorithm>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+//creates the generator for a single trial, the seed sequence mixes the base seed with the trial index so
+//neighbouring trials get unrelated streams
+inline std::default_random_engine makeTrialGenerator(unsigned int baseSeed, int trialIndex)
+{
+	std::seed_seq seedSequence{ baseSeed, (unsigned int)trialIndex, 0x9E3779B9u };
+	std::default_random_engine generator;
+	generator.seed(seedSequence);
+	return generator;
+}
+
+//number of threads to use when the caller doesn't ask for a specific amount
+inline unsigned int defaultReplicationThreadCount()
+{
+	unsigned int threads = std::thread::hardware_concurrency();
+	return threads == 0 ? 1 : threads;
+}
+
+//range of trials owned by one worker, [begin, end)
+struct ReplicationWorkRange
+{
+	std::mutex lock;
+	int begin = 0;
+	int end = 0;
+};
+
+//takes up to grainSize trials from the front of the workers own range
+inline bool takeOwnReplicationWork(ReplicationWorkRange & range, int grainSize, int & begin, int & end)
+{
+	std::lock_guard<std::mutex> guard(range.lock);
+	if (range.begin >= range.end) return false;
+
+	begin = range.begin;
+	end = std::min(range.begin + grainSize, range.end);
+	range.begin = end;
+	return true;
+}
+
+//steals half of the remaining trials (at least one grain) from the back of another workers range
+inline bool stealReplicationWork(ReplicationWorkRange & victim, int grainSize, int & begin, int & end)
+{
+	std::lock_guard<std::mutex> guard(victim.lock);
+	int remaining = victim.end - victim.begin;
+	if (remaining <= 0) return false;
+
+	int stolen = std::min(remaining, std::max(grainSize, remaining / 2));
+	end = victim.end;
+	begin = victim.end - stolen;
+	victim.end = begin;
+	return true;
+}
+
+//runs trial(generator, trialIndex) for every trial in [0, numberOfTrials) and returns the results in trial order
+//numberOfThreads = 0 uses every core
+template <typename TrialResult, typename TrialFunction>
+std::vector<TrialResult> runReplications(int numberOfTrials, unsigned int baseSeed, TrialFunction trial, unsigned int numberOfThreads = 0)
+{
+	std::vector<TrialResult> results(numberOfTrials);
+	if (numberOfTrials <= 0) return results;
+
+	if (numberOfThreads == 0) numberOfThreads = defaultReplicationThreadCount();
+
+	//small grains keep the load balanced, the trials themselves are long enough that the locking doesn't show up
+	const int grainSize = std::max(1, std::min(64, numberOfTrials / (int)(numberOfThreads * 8) + 1));
+	numberOfThreads = std::min<unsigned int>(numberOfThreads, (numberOfTrials + grainSize - 1) / grainSize);
+
+	//hand every worker an equal contiguous share of the trials up front
+	std::vector<ReplicationWorkRange> ranges(numberOfThreads);
+	for (unsigned int w = 0; w < numberOfThreads; w++)
+	{
+		ranges[w].begin = (int)(((long long)numberOfTrials * w) / numberOfThreads);
+		ranges[w].end = (int)(((long long)numberOfTrials * (w + 1)) / numberOfThreads);
+	}
+
+	auto worker = [&](unsigned int workerIndex)
+	{
+		ReplicationWorkRange & ownRange = ranges[workerIndex];
+		int begin = 0, end = 0;
+		while (true)
+		{
+			if (!takeOwnReplicationWork(ownRange, grainSize, begin, end))
+			{
+				//own range is empty, go looking for work in the other ranges
+				bool stolen = false;
+				for (unsigned int v = 1; !stolen && v < numberOfThreads; v++)
+				{
+					stolen = stealReplicationWork(ranges[(workerIndex + v) % numberOfThreads], grainSize, begin, end);
+				}
+
+				if (!stolen) break;
+
+				//the stolen trials become our own range so they can be stolen again by idle workers
+				{
+					std::lock_guard<std::mutex> guard(ownRange.lock);
+					ownRange.begin = begin;
+					ownRange.end = end;
+				}
+				continue;
+			}
+
+			for (int t = begin; t < end; t++)
+			{
+				std::default_random_engine generator = makeTrialGenerator(baseSeed, t);
+				results[t] = trial(generator, t);
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int w = 1; w < numberOfThreads; w++) threads.emplace_back(worker, w);
+	worker(0); //the calling thread works too
+	for (auto & thread : threads) thread.join();
+
+	return results;
+}
+
+/*
+	Same as runReplications, but results are folded into accumulators instead of being stored, so memory doesn't grow
+	with the number of trials. Trials are grouped in fixed blocks of blockSize, every block gets a copy of empty and
+	record(accumulator, result, trialIndex) is called for its trials in order, then the blocks are merged in block
+	order with accumulator.merge(). The block boundaries don't depend on the thread count, so neither does the result.
+
+	reduceReplicationRange does the same for the trials [firstTrial, firstTrial + numberOfTrials), so a run can be
+	continued in batches and every trial still gets the generator it would have had in one big run.
+*/
+template <typename Accumulator, typename TrialFunction, typename RecordFunction>
+Accumulator reduceReplicationRange(int firstTrial, int numberOfTrials, unsigned int baseSeed, const Accumulator & empty, TrialFunction trial, RecordFunction record,
+	int blockSize = 256, unsigned int numberOfThreads = 0)
+{
+	int numberOfBlocks = (numberOfTrials + blockSize - 1) / blockSize;
+
+	//each block is a unit of work for runReplications, the generator it hands out is ignored since every trial
+	//still seeds its own from (baseSeed, trialIndex)
+	std::vector<Accumulator> blocks = runReplications<Accumulator>(numberOfBlocks, baseSeed,
+		[&](std::default_random_engine &, int blockIndex)
+	{
+		Accumulator accumulator = empty;
+		int end = firstTrial + std::min(numberOfTrials, (blockIndex + 1) * blockSize);
+		for (int t = firstTrial + blockIndex * blockSize; t < end; t++)
+		{
+			std::default_random_engine generator = makeTrialGenerator(baseSeed, t);
+			record(accumulator, trial(generator, t), t);
+		}
+		return accumulator;
+	}, numberOfThreads);
+
+	Accumulator total = empty;
+	for (auto & block : blocks) total.merge(block);
+	return total;
+}
+
+template <typename Accumulator, typename TrialFunction, typename RecordFunction>
+Accumulator reduceReplications(int numberOfTrials, unsigned int baseSeed, const Accumulator & empty, TrialFunction trial, RecordFunction record,
+	int blockSize = 256, unsigned int numberOfThreads = 0)
+{
+	return reduceReplicationRange(0, numberOfTrials, baseSeed, empty, trial, record, blockSize, numberOfThreads);
+}
+
+/*
+	Sequential stopping: runs a pilot of pilotTrials, then keeps adding batches of batchTrials until done(total)
+	says the estimate is precise enough or maxTrials is reached. reduceRange(firstTrial, numberOfTrials) has to return
+	the accumulator for that range of trials (usually a call to reduceReplicationRange), every batch runs in parallel.
+	The rule is only checked between batches, so a run can overshoot the point where it could have stopped by at most
+	one batch. trialsUsed gets the number of trials that went into the result.
+*/
+template <typename Accumulator, typename RangeFunction, typename StopFunction>
+Accumulator reduceReplicationsUntil(const Accumulator & empty, RangeFunction reduceRange, StopFunction done,
+	int pilotTrials, int batchTrials, int maxTrials, int & trialsUsed)
+{
+	Accumulator total = empty;
+	trialsUsed = 0;
+
+	int nextBatch = std::min(pilotTrials, maxTrials);
+	while (nextBatch > 0)
+	{
+		total.merge(reduceRange(trialsUsed, nextBatch));
+		trialsUsed += nextBatch;
+
+		if (done(total)) break;
+		nextBatch = std::min(batchTrials, maxTrials - trialsUsed);
+	}
+
+	return total;
+}
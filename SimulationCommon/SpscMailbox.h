@@ -0,0 +1,105 @@
+#pragma once
+
+/*
+	Lock free single producer, single consumer mailbox between two threads of a partitioned simulation.
+
+	A ring of power of two size with a head owned by the consumer and a tail owned by the producer. tryPush only
+	fails when the ring is full, drain hands every message pushed so far to the consumer. The two indices sit on
+	separate cache lines and each side keeps a private copy of the other one's index, so in the common case neither
+	side touches the other's cache line.
+
+	WindowBarrier is the spinning barrier that ends every synchronisation window. A thread that waits keeps calling
+	idle() (e.g. to drain its mailboxes, so a producer stuck on a full ring always makes progress) and yields, so
+	running more threads than cores is slow but never deadlocks.
+*/
+
+#include <atomic>
+#include <stddef.h>
+#include <thread>
+#include <vector>
+
+template <typename Message>
+class SpscMailbox
+{
+public:
+	explicit SpscMailbox(size_t capacity = 4096)
+	{
+		size_t size = 1;
+		while (size < capacity) size *= 2;
+		slots.resize(size);
+		mask = size - 1;
+	}
+
+	SpscMailbox(const SpscMailbox &) = delete;
+	SpscMailbox & operator=(const SpscMailbox &) = delete;
+
+	//producer side, false if the ring is full
+	bool tryPush(const Message & message)
+	{
+		size_t tail = tailIndex.load(std::memory_order_relaxed);
+		if (tail - cachedHead == slots.size())
+		{
+			cachedHead = headIndex.load(std::memory_order_acquire);
+			if (tail - cachedHead == slots.size()) return false;
+		}
+		slots[tail & mask] = message;
+		tailIndex.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	//consumer side, hands every message that was pushed so far to receive(message), returns how many
+	template <typename Receive>
+	size_t drain(Receive receive)
+	{
+		size_t head = headIndex.load(std::memory_order_relaxed);
+		if (head == cachedTail)
+		{
+			cachedTail = tailIndex.load(std::memory_order_acquire);
+			if (head == cachedTail) return 0;
+		}
+		size_t received = cachedTail - head;
+		for (; head != cachedTail; head++) receive(slots[head & mask]);
+		headIndex.store(head, std::memory_order_release);
+		return received;
+	}
+
+private:
+	std::vector<Message> slots;
+	size_t mask;
+	char padding0[64];
+	std::atomic<size_t> headIndex{ 0 };
+	size_t cachedTail = 0;  //consumer's copy of tailIndex
+	char padding1[64];
+	std::atomic<size_t> tailIndex{ 0 };
+	size_t cachedHead = 0;  //producer's copy of headIndex
+	char padding2[64];
+};
+
+class WindowBarrier
+{
+public:
+	explicit WindowBarrier(int parties) : parties(parties) {}
+
+	template <typename Idle>
+	void arriveAndWait(Idle idle)
+	{
+		int currentGeneration = generation.load(std::memory_order_acquire);
+		if (waiting.fetch_add(1, std::memory_order_acq_rel) == parties - 1)
+		{
+			//last one in releases the others
+			waiting.store(0, std::memory_order_relaxed);
+			generation.fetch_add(1, std::memory_order_release);
+			return;
+		}
+		while (generation.load(std::memory_order_acquire) == currentGeneration)
+		{
+			idle();
+			std::this_thread::yield();
+		}
+	}
+
+private:
+	int parties;
+	std::atomic<int> waiting{ 0 };
+	std::atomic<int> generation{ 0 };
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+/*
+	Steady state output analysis for a single long run.
+
+	Observations are folded into batches as they arrive, starting at 5 observations per batch. Once there are
+	2 * minimumBatches of them, neighbouring batches are merged and the batch size doubles, so memory stays between
+	minimumBatches and 2 * minimumBatches batches however long the run gets, and the batches keep getting longer,
+	which is what makes their means close to independent (batch doubling as in Fishman's LABATCH).
+
+	Every batch keeps its sum and the sum of its partial sums, both merge exactly, and from those we get:
+		warm-up    MSER: the truncation point d that minimises the squared deviations of the batch means after d
+		           divided by (n - d)^2, searched over the first half of the run. While the batches still hold 5
+		           observations this is exactly MSER-5, later it works on the coarser batches.
+		variance   three estimators of the variance parameter sigma^2 (so that Var(mean) ~ sigma^2 / N)
+		           batch means             m * sample variance of the batch means
+		           overlapping batch means windows of 4 batches sliding by one batch, ~1.5x the degrees of freedom
+		           standardized time series the area estimator of every batch, 12 / (m^3 - m) * (sum of k * (mean -
+		                                   mean of first k))^2, which doesn't depend on the batch means being
+		                                   independent of each other the same way
+	Confidence intervals use the student t quantile for the degrees of freedom of the estimator.
+*/
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <math.h>
+
+enum class VarianceEstimator { BatchMeans, OverlappingBatchMeans, StandardizedTimeSeries };
+
+//97.5% quantile of the student t distribution (Cornish-Fisher expansion around the normal quantile)
+inline double studentT975(double degreesOfFreedom)
+{
+	if (degreesOfFreedom < 1) return std::numeric_limits<double>::infinity();
+	const double z = 1.959963984540054;
+	double v = degreesOfFreedom;
+	double z3 = z * z * z, z5 = z3 * z * z, z7 = z5 * z * z;
+	return z + (z3 + z) / (4 * v) + (5 * z5 + 16 * z3 + 3 * z) / (96 * v * v) + (3 * z7 + 19 * z5 + 17 * z3 - 15 * z) / (384 * v * v * v);
+}
+
+struct VarianceEstimate
+{
+	double varianceParameter = 0;   //sigma^2
+	double degreesOfFreedom = 0;
+	double halfWidth = std::numeric_limits<double>::infinity();
+};
+
+struct SteadyStateEstimate
+{
+	long long truncatedObservations = 0;   //dropped as warm-up
+	long long usedObservations = 0;
+	long long batchSize = 0;
+	int batches = 0;                       //after truncation
+	double mean = 0;
+	VarianceEstimate batchMeans;
+	VarianceEstimate overlappingBatchMeans;
+	VarianceEstimate standardizedTimeSeries;
+
+	const VarianceEstimate & estimate(VarianceEstimator estimator) const
+	{
+		switch (estimator)
+		{
+		case VarianceEstimator::BatchMeans: return batchMeans;
+		case VarianceEstimator::OverlappingBatchMeans: return overlappingBatchMeans;
+		default: return standardizedTimeSeries;
+		}
+	}
+};
+
+class SteadyStateAnalyzer
+{
+public:
+	explicit SteadyStateAnalyzer(int minimumBatches = 32, long long initialBatchSize = 5)
+		: minimumBatches(minimumBatches), batchSize(initialBatchSize)
+	{
+		batches.reserve(2 * minimumBatches);
+	}
+
+	void add(double value)
+	{
+		current.sum += value;
+		current.partialSums += current.sum;
+		observations++;
+
+		if (++currentCount == batchSize)
+		{
+			batches.push_back(current);
+			current = Batch();
+			currentCount = 0;
+			if ((int)batches.size() == 2 * minimumBatches) mergeBatches();
+		}
+	}
+
+	long long count() const { return observations; }
+
+	//true when a complete batch was just closed, a cheap moment to call analyze()
+	bool batchCompleted() const { return currentCount == 0 && observations > 0; }
+
+	SteadyStateEstimate analyze() const
+	{
+		SteadyStateEstimate result;
+		result.batchSize = batchSize;
+		int n = (int)batches.size();
+		if (n == 0) return result;
+
+		std::vector<double> means(n);
+		for (int i = 0; i < n; i++) means[i] = batches[i].sum / batchSize;
+
+		//MSER over the batch means, suffix sums make every candidate O(1)
+		std::vector<double> suffixSum(n + 1, 0), suffixSquares(n + 1, 0);
+		for (int i = n - 1; i >= 0; i--)
+		{
+			suffixSum[i] = suffixSum[i + 1] + means[i];
+			suffixSquares[i] = suffixSquares[i + 1] + means[i] * means[i];
+		}
+		int truncation = 0;
+		double best = std::numeric_limits<double>::infinity();
+		for (int d = 0; d <= n / 2; d++)
+		{
+			double remaining = n - d;
+			double deviations = suffixSquares[d] - suffixSum[d] * suffixSum[d] / remaining;
+			double statistic = deviations / (remaining * remaining);
+			if (statistic < best)
+			{
+				best = statistic;
+				truncation = d;
+			}
+		}
+
+		int used = n - truncation;
+		result.truncatedObservations = (long long)truncation * batchSize;
+		result.usedObservations = (long long)used * batchSize;
+		result.batches = used;
+		result.mean = suffixSum[truncation] / used;
+
+		double totalObservations = (double)result.usedObservations;
+		auto finish = [&](VarianceEstimate & estimate)
+		{
+			estimate.halfWidth = estimate.degreesOfFreedom >= 1 ?
+				studentT975(estimate.degreesOfFreedom) * sqrt(estimate.varianceParameter / totalObservations) :
+				std::numeric_limits<double>::infinity();
+		};
+
+		//batch means
+		double squaredDeviations = 0;
+		for (int i = truncation; i < n; i++) squaredDeviations += (means[i] - result.mean) * (means[i] - result.mean);
+		if (used > 1)
+		{
+			result.batchMeans.varianceParameter = batchSize * squaredDeviations / (used - 1);
+			result.batchMeans.degreesOfFreedom = used - 1;
+		}
+		finish(result.batchMeans);
+
+		//overlapping batch means, windows of windowBatches batches
+		const int windowBatches = 4;
+		if (used > windowBatches)
+		{
+			double windowSum = 0;
+			for (int i = truncation; i < truncation + windowBatches; i++) windowSum += means[i];
+			double windowDeviations = 0;
+			for (int start = truncation; start + windowBatches <= n; start++)
+			{
+				if (start > truncation) windowSum += means[start + windowBatches - 1] - means[start - 1];
+				double windowMean = windowSum / windowBatches;
+				windowDeviations += (windowMean - result.mean) * (windowMean - result.mean);
+			}
+			double windows = used - windowBatches + 1;
+			result.overlappingBatchMeans.varianceParameter = batchSize * ((double)used * windowBatches / (windows * (used - windowBatches))) * windowDeviations;
+			result.overlappingBatchMeans.degreesOfFreedom = 1.5 * ((double)used / windowBatches - 1);
+		}
+		finish(result.overlappingBatchMeans);
+
+		//standardized time series, area estimator per batch
+		double m = (double)batchSize;
+		double areaSquares = 0;
+		for (int i = truncation; i < n; i++)
+		{
+			double area = means[i] * m * (m + 1) / 2 - batches[i].partialSums;
+			areaSquares += 12 * area * area / (m * m * m - m);
+		}
+		result.standardizedTimeSeries.varianceParameter = areaSquares / used;
+		result.standardizedTimeSeries.degreesOfFreedom = used;
+		finish(result.standardizedTimeSeries);
+
+		return result;
+	}
+
+private:
+	struct Batch
+	{
+		double sum = 0;
+		double partialSums = 0; //sum over k of (sum of the first k observations of the batch)
+	};
+
+	//merges neighbouring batches, the partial sums of the second half all start from the full first half
+	void mergeBatches()
+	{
+		size_t merged = batches.size() / 2;
+		for (size_t i = 0; i < merged; i++)
+		{
+			const Batch & first = batches[2 * i];
+			const Batch & second = batches[2 * i + 1];
+			Batch combined;
+			combined.sum = first.sum + second.sum;
+			combined.partialSums = first.partialSums + batchSize * first.sum + second.partialSums;
+			batches[i] = combined;
+		}
+		batches.resize(merged);
+		batchSize *= 2;
+	}
+
+	int minimumBatches;
+	long long batchSize;
+	std::vector<Batch> batches;
+	Batch current;
+	long long currentCount = 0;
+	long long observations = 0;
+};
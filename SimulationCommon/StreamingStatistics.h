@@ -0,0 +1,272 @@
+#pragma once
+
+/*
+	Streaming statistics shared by the simulations.
+
+	RunningMoments keeps count, mean and the sum of squared deviations with Welford's update, and two of them merge
+	exactly with Chan's pairwise formula, so per-thread or per-block accumulators can be combined without keeping the
+	observations around. Merging in a fixed order gives bit-identical results no matter how the work was scheduled.
+
+	P2Quantile is the P-square estimator of Jain and Chlamtac: five markers are nudged towards their ideal positions
+	with a parabolic fit, which tracks a single quantile in O(1) memory. Unlike the moments it can not be merged, so it
+	has to be fed from one thread (e.g. inside a trial, or while reducing results in trial order).
+
+	MetricSet groups a number of named RunningMoments so a program can track any amount of outputs and print
+	a confidence interval for each of them.
+
+	PrecisionTarget is the stopping rule for sequential sampling (see reduceReplicationsUntil). It is the Chow-Robbins
+	rule: stop at the first n >= minimumCount where z * sqrt((s^2 + 1/n) / n) is below the absolute target, or below the
+	relative target times |mean|. The 1/n term keeps a pilot that happens to have a tiny sample variance from stopping
+	too early, and with it the interval has the requested coverage as the target goes to 0.
+*/
+
+#include <algorithm>
+#include <initializer_list>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <string>
+#include <vector>
+
+class RunningMoments
+{
+public:
+	void add(double value)
+	{
+		observations++;
+		double delta = value - runningMean;
+		runningMean += delta / observations;
+		sumOfSquaredDeviations += delta * (value - runningMean);
+		smallest = std::min(smallest, value);
+		largest = std::max(largest, value);
+	}
+
+	//combines the moments of two disjoint sets of observations, as if all of them had been added to this one
+	void merge(const RunningMoments & other)
+	{
+		if (other.observations == 0) return;
+		if (observations == 0)
+		{
+			*this = other;
+			return;
+		}
+
+		long long combined = observations + other.observations;
+		double delta = other.runningMean - runningMean;
+		runningMean += delta * ((double)other.observations / combined);
+		sumOfSquaredDeviations += other.sumOfSquaredDeviations + delta * delta * ((double)observations * other.observations / combined);
+		observations = combined;
+		smallest = std::min(smallest, other.smallest);
+		largest = std::max(largest, other.largest);
+	}
+
+	void clear() { *this = RunningMoments(); }
+
+	long long count() const { return observations; }
+	double mean() const { return runningMean; }
+	double sumOfSquares() const { return sumOfSquaredDeviations; }
+	double minimum() const { return smallest; }
+	double maximum() const { return largest; }
+
+	//unbiased sample variance, 0 until there are two observations
+	double variance() const { return observations > 1 ? sumOfSquaredDeviations / (observations - 1) : 0.0; }
+	double standardDeviation() const { return sqrt(variance()); }
+	double standardError() const { return observations > 0 ? standardDeviation() / sqrt((double)observations) : 0.0; }
+
+	//half width of the normal confidence interval around the mean, z = 1.96 for alpha = 0.05
+	double halfWidth(double z = 1.96) const { return z * standardError(); }
+
+private:
+	long long observations = 0;
+	double runningMean = 0;
+	double sumOfSquaredDeviations = 0;
+	double smallest = std::numeric_limits<double>::infinity();
+	double largest = -std::numeric_limits<double>::infinity();
+};
+
+class P2Quantile
+{
+public:
+	explicit P2Quantile(double probability = 0.5)
+		: probability(probability)
+	{
+		increments[0] = 0;
+		increments[1] = probability / 2;
+		increments[2] = probability;
+		increments[3] = (1 + probability) / 2;
+		increments[4] = 1;
+	}
+
+	void add(double value)
+	{
+		//the first five observations become the initial markers
+		if (observations < 5)
+		{
+			heights[observations++] = value;
+			if (observations == 5)
+			{
+				std::sort(heights, heights + 5);
+				for (int i = 0; i < 5; i++) positions[i] = i + 1;
+				desired[0] = 1;
+				desired[1] = 1 + 2 * probability;
+				desired[2] = 1 + 4 * probability;
+				desired[3] = 3 + 2 * probability;
+				desired[4] = 5;
+			}
+			return;
+		}
+		observations++;
+
+		//find the cell the value falls in, stretching the outer markers if needed
+		int cell;
+		if (value < heights[0])
+		{
+			heights[0] = value;
+			cell = 0;
+		}
+		else if (value >= heights[4])
+		{
+			heights[4] = value;
+			cell = 3;
+		}
+		else
+		{
+			cell = 0;
+			while (value >= heights[cell + 1]) cell++;
+		}
+
+		for (int i = cell + 1; i < 5; i++) positions[i]++;
+		for (int i = 0; i < 5; i++) desired[i] += increments[i];
+
+		//move the middle markers back towards their desired positions
+		for (int i = 1; i <= 3; i++)
+		{
+			double offset = desired[i] - positions[i];
+			if ((offset >= 1 && positions[i + 1] - positions[i] > 1) || (offset <= -1 && positions[i - 1] - positions[i] < -1))
+			{
+				int step = offset > 0 ? 1 : -1;
+				double candidate = parabolic(i, step);
+				if (heights[i - 1] < candidate && candidate < heights[i + 1]) heights[i] = candidate;
+				else heights[i] = linear(i, step);
+				positions[i] += step;
+			}
+		}
+	}
+
+	long long count() const { return observations; }
+
+	double quantile() const
+	{
+		if (observations == 0) return 0;
+		if (observations >= 5) return heights[2];
+
+		//not enough data for the markers yet, use the exact order statistic
+		double sorted[5];
+		int stored = (int)observations;
+		for (int i = 0; i < stored; i++)
+		{
+			int j = i;
+			for (; j > 0 && sorted[j - 1] > heights[i]; j--) sorted[j] = sorted[j - 1];
+			sorted[j] = heights[i];
+		}
+		int index = (int)std::min<long long>(observations - 1, (long long)(probability * observations));
+		return sorted[index];
+	}
+
+private:
+	double parabolic(int i, int step) const
+	{
+		double span = positions[i + 1] - positions[i - 1];
+		double right = (positions[i] - positions[i - 1] + step) * (heights[i + 1] - heights[i]) / (positions[i + 1] - positions[i]);
+		double left = (positions[i + 1] - positions[i] - step) * (heights[i] - heights[i - 1]) / (positions[i] - positions[i - 1]);
+		return heights[i] + step / span * (right + left);
+	}
+
+	double linear(int i, int step) const
+	{
+		return heights[i] + step * (heights[i + step] - heights[i]) / (positions[i + step] - positions[i]);
+	}
+
+	double probability;
+	long long observations = 0;
+	double heights[5];
+	double positions[5];
+	double desired[5];
+	double increments[5];
+};
+
+struct PrecisionTarget
+{
+	double absoluteHalfWidth; //0 = not used
+	double relativeHalfWidth; //fraction of |mean|, 0 = not used
+	long long minimumCount;
+};
+
+inline PrecisionTarget absolutePrecision(double halfWidth, long long minimumCount = 30) { return PrecisionTarget{ halfWidth, 0, minimumCount }; }
+inline PrecisionTarget relativePrecision(double fraction, long long minimumCount = 30) { return PrecisionTarget{ 0, fraction, minimumCount }; }
+
+//the half width the Chow-Robbins rule compares against the target
+inline double chowRobbinsHalfWidth(const RunningMoments & moments, double z = 1.96)
+{
+	double n = (double)moments.count();
+	return n > 0 ? z * sqrt((moments.variance() + 1 / n) / n) : std::numeric_limits<double>::infinity();
+}
+
+//true when either of the requested targets is met (a target with no absolute and no relative part is always met)
+inline bool meetsPrecision(const RunningMoments & moments, const PrecisionTarget & target, double z = 1.96)
+{
+	if (moments.count() < std::max<long long>(2, target.minimumCount)) return false;
+	if (target.absoluteHalfWidth <= 0 && target.relativeHalfWidth <= 0) return true;
+
+	double halfWidth = chowRobbinsHalfWidth(moments, z);
+	if (target.absoluteHalfWidth > 0 && halfWidth <= target.absoluteHalfWidth) return true;
+	if (target.relativeHalfWidth > 0 && halfWidth <= target.relativeHalfWidth * fabs(moments.mean())) return true;
+	return false;
+}
+
+class MetricSet
+{
+public:
+	MetricSet() {}
+	MetricSet(std::initializer_list<const char *> metricNames)
+		: names(metricNames.begin(), metricNames.end()), moments(metricNames.size())
+	{
+	}
+
+	void add(size_t metric, double value) { moments[metric].add(value); }
+
+	//metric sets being merged must track the same metrics in the same order
+	void merge(const MetricSet & other)
+	{
+		for (size_t m = 0; m < moments.size(); m++) moments[m].merge(other.moments[m]);
+	}
+
+	size_t size() const { return moments.size(); }
+	const std::string & name(size_t metric) const { return names[metric]; }
+	const RunningMoments & operator[](size_t metric) const { return moments[metric]; }
+
+	//true once every metric meets its target, targets has one entry per metric
+	bool meetsPrecision(const PrecisionTarget * targets, double z = 1.96) const
+	{
+		for (size_t m = 0; m < moments.size(); m++)
+		{
+			if (!::meetsPrecision(moments[m], targets[m], z)) return false;
+		}
+		return true;
+	}
+
+	//one line per metric: name, mean +- half width, sample standard deviation
+	void printConfidenceIntervals(std::ostream & out, double z = 1.96) const
+	{
+		for (size_t m = 0; m < moments.size(); m++)
+		{
+			out << names[m] << " over " << moments[m].count() << " observations : "
+				<< moments[m].mean() << " +-" << moments[m].halfWidth(z)
+				<< " (s = " << moments[m].standardDeviation() << ")" << std::endl;
+		}
+	}
+
+private:
+	std::vector<std::string> names;
+	std::vector<RunningMoments> moments;
+};
@@ -0,0 +1,449 @@
+#pragma once
+
+/*
+	Approximate simulators for reaction networks with very large counts, on top of ReactionNetwork.h.
+
+	TauLeapingSimulator   Cao, Gillespie & Petzold (2006). A leap of length tau fires every reaction a Poisson(a_j tau)
+	                      number of times. tau is the largest step that keeps the expected change and the standard
+	                      deviation of every reactant count within epsilon * x_i / g_i (g_i the highest order of the
+	                      reactions consuming species i), so no propensity moves by more than about epsilon of itself.
+	                      The expected change is bounded with the gross flow sum |v_ij| a_j instead of the net drift
+	                      of the paper: at a loaded station arrivals and departures cancel, the net drift is 0 and an
+	                      explicit leap far longer than the turnover time is unstable (its variance blows up).
+	                      Reactions that are within criticalFirings firings of exhausting a reactant are critical:
+	                      they never leap, at most one of them fires per step, exactly. When the leap would be less
+	                      than exactFactor / a0 it isn't worth it and the simulator falls back to exactBurst exact
+	                      SSA steps (direct method). A leap that still drives a count negative is halved and redrawn.
+	HybridSimulator       species with at least fluidThreshold molecules are continuous, a reaction whose reactants
+	                      and products are all continuous is fast and integrated as a fluid ODE (with diffusion, the
+	                      chemical Langevin equation, so queue lengths keep their variance). The slow reactions keep
+	                      their exact firing times: each one fires when its integrated propensity reaches an Exp(1)
+	                      draw. ODE steps keep the gross flow of every continuous species within epsilon of it and
+	                      end exactly on the next slow firing. A species that drops below the threshold is rounded
+	                      back to a whole number.
+
+	Both keep an ApproximationReport, the error budget of the run: how much was leapt or integrated instead of
+	simulated exactly, how many leaps had to be rejected or counts clamped, and the relative propensity changes inside
+	the approximate steps, which are what epsilon bounds and what the bias of the method grows with. Smaller epsilon
+	means more, shorter steps and less bias, compare a few values against exact runs on a smaller population.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <random>
+#include <vector>
+
+#include "ReactionNetwork.h"
+
+struct ApproximationReport
+{
+	double epsilon = 0;
+	long long approximateSteps = 0;     //leaps or fluid steps
+	long long exactSteps = 0;           //reactions fired one at a time
+	long long rejectedSteps = 0;        //leaps halved because a count went negative, fluid steps that had to clamp one
+	double approximateEvents = 0;       //reactions inside approximate steps
+	double exactEvents = 0;
+	double largestPropensityChange = 0; //max over the approximate steps of max_j |a_j(after) - a_j(before)| / a_j(before)
+	double sumPropensityChange = 0;
+
+	void clear()
+	{
+		double keep = epsilon;
+		*this = ApproximationReport();
+		epsilon = keep;
+	}
+
+	void merge(const ApproximationReport & other)
+	{
+		approximateSteps += other.approximateSteps;
+		exactSteps += other.exactSteps;
+		rejectedSteps += other.rejectedSteps;
+		approximateEvents += other.approximateEvents;
+		exactEvents += other.exactEvents;
+		largestPropensityChange = std::max(largestPropensityChange, other.largestPropensityChange);
+		sumPropensityChange += other.sumPropensityChange;
+	}
+
+	double approximateFraction() const
+	{
+		double total = approximateEvents + exactEvents;
+		return total > 0 ? approximateEvents / total : 0;
+	}
+
+	double meanPropensityChange() const { return approximateSteps > 0 ? sumPropensityChange / approximateSteps : 0; }
+
+	void print(std::ostream & out) const
+	{
+		out << "epsilon " << epsilon << " : " << approximateSteps << " approximate steps (" << rejectedSteps << " rejected or clamped), "
+			<< exactSteps << " exact steps, " << approximateFraction() * 100 << "% of the reactions approximated" << std::endl;
+		out << "    propensity change per approximate step, mean " << meanPropensityChange() << " largest " << largestPropensityChange << std::endl;
+	}
+};
+
+class TauLeapingSimulator : public ReactionSimulator
+{
+public:
+	TauLeapingSimulator(const ReactionNetwork & network, double epsilon = 0.03, int criticalFirings = 10, double exactFactor = 10, int exactBurst = 100)
+		: ReactionSimulator(network), criticalFirings(criticalFirings), exactFactor(exactFactor), exactBurst(exactBurst),
+		critical(network.reactionCount()), firings(network.reactionCount()), flow(network.speciesCount()), variance(network.speciesCount()),
+		highestOrder(network.speciesCount(), 0), before(network.reactionCount())
+	{
+		report.epsilon = epsilon;
+		for (int r = 0; r < network.reactionCount(); r++)
+		{
+			int order = 0;
+			for (auto & term : network.reaction(r).reactants) order += term.count;
+			for (auto & term : network.reaction(r).reactants) highestOrder[term.species] = std::max(highestOrder[term.species], order);
+		}
+	}
+
+	void reset(std::default_random_engine &) override
+	{
+		counts = network.initialCounts();
+		time = 0;
+		events = 0;
+		exactStepsLeft = 0;
+		report.clear();
+		for (int r = 0; r < network.reactionCount(); r++) propensities[r] = network.propensity(r, counts);
+	}
+
+	bool step(std::default_random_engine & generator, double endTime) override
+	{
+		double total = 0;
+		for (double a : propensities) total += a;
+		if (total <= 0)
+		{
+			finish(endTime);
+			return false;
+		}
+
+		if (exactStepsLeft > 0)
+		{
+			exactStepsLeft--;
+			return exactStep(generator, endTime, total);
+		}
+
+		double tau = leapSize();
+		if (tau < exactFactor / total)
+		{
+			exactStepsLeft = exactBurst - 1;
+			return exactStep(generator, endTime, total);
+		}
+
+		double criticalTotal = 0;
+		for (int r = 0; r < network.reactionCount(); r++)
+		{
+			if (critical[r]) criticalTotal += propensities[r];
+		}
+
+		while (true)
+		{
+			double criticalTime = criticalTotal > 0 ? exponential(generator) / criticalTotal : std::numeric_limits<double>::infinity();
+			double leap = std::min(tau, criticalTime);
+			bool fireCritical = criticalTime <= tau;
+			if (std::isinf(leap) && std::isinf(endTime))
+			{
+				//no leapable reaction consumes anything and none is critical, so nothing bounds the leap short of endTime
+				return false;
+			}
+			bool reachedEnd = time + leap >= endTime;
+			if (reachedEnd)
+			{
+				leap = endTime - time;
+				fireCritical = false;
+			}
+
+			std::vector<long long> next = counts;
+			double leapt = 0;
+			for (int r = 0; r < network.reactionCount(); r++)
+			{
+				firings[r] = 0;
+				double expected = propensities[r] * leap;
+				if (critical[r] || expected <= 0) continue;
+				std::poisson_distribution<long long> poisson(expected);
+				firings[r] = poisson(generator);
+				for (auto & term : network.reaction(r).change) next[term.species] += firings[r] * term.count;
+				leapt += (double)firings[r];
+			}
+			int criticalFired = fireCritical ? pick(generator, criticalTotal, true) : -1;
+			if (criticalFired >= 0) network.fire(criticalFired, next);
+
+			if (std::any_of(next.begin(), next.end(), [](long long x) { return x < 0; }))
+			{
+				report.rejectedSteps++;
+				tau /= 2;
+				continue;
+			}
+
+			time += leap;
+			counts.swap(next);
+			events += (long long)leapt + (criticalFired >= 0 ? 1 : 0);
+			report.approximateSteps++;
+			report.approximateEvents += leapt;
+			if (criticalFired >= 0) report.exactEvents++;
+			updatePropensities();
+			return !reachedEnd;
+		}
+	}
+
+	const ApproximationReport & approximation() const { return report; }
+	const char * name() const override { return "tau-leaping (Cao-Gillespie-Petzold)"; }
+
+private:
+	//the leap condition, critical reactions are marked and left out of it
+	double leapSize()
+	{
+		std::fill(flow.begin(), flow.end(), 0.0);
+		std::fill(variance.begin(), variance.end(), 0.0);
+		for (int r = 0; r < network.reactionCount(); r++)
+		{
+			//firings left before some reactant runs out
+			long long left = std::numeric_limits<long long>::max();
+			for (auto & term : network.reaction(r).change)
+			{
+				if (term.count < 0) left = std::min(left, counts[term.species] / -term.count);
+			}
+			critical[r] = propensities[r] > 0 && left < criticalFirings;
+			if (critical[r] || propensities[r] <= 0) continue;
+
+			for (auto & term : network.reaction(r).change)
+			{
+				flow[term.species] += std::abs(term.count) * propensities[r];
+				variance[term.species] += (double)term.count * term.count * propensities[r];
+			}
+		}
+
+		double tau = std::numeric_limits<double>::infinity();
+		for (int s = 0; s < network.speciesCount(); s++)
+		{
+			if (highestOrder[s] == 0 || flow[s] == 0) continue;
+			double x = (double)counts[s];
+			//g_i of the paper, taken as if every reaction of the highest order consumed a single molecule of s,
+			//plus the correction for the same species twice (x / (x - 1) of the second order case)
+			double g = highestOrder[s] + (highestOrder[s] > 1 && x > 1 ? (highestOrder[s] - 1) / (x - 1) : 0);
+			double bound = std::max(report.epsilon * x / g, 1.0);
+			tau = std::min(tau, bound / flow[s]);
+			tau = std::min(tau, bound * bound / variance[s]);
+		}
+		return tau;
+	}
+
+	bool exactStep(std::default_random_engine & generator, double endTime, double total)
+	{
+		double next = time + exponential(generator) / total;
+		if (next > endTime)
+		{
+			finish(endTime);
+			return false;
+		}
+		time = next;
+
+		int fired = pick(generator, total, false);
+		network.fire(fired, counts);
+		events++;
+		report.exactSteps++;
+		report.exactEvents++;
+		for (int r : network.dependentsOf(fired)) propensities[r] = network.propensity(r, counts);
+		return true;
+	}
+
+	//reaction drawn by propensity, among the critical ones only if criticalOnly
+	int pick(std::default_random_engine & generator, double total, bool criticalOnly)
+	{
+		double target = uniform(generator) * total;
+		int last = -1;
+		for (int r = 0; r < network.reactionCount(); r++)
+		{
+			if (propensities[r] <= 0 || (criticalOnly && !critical[r])) continue;
+			last = r;
+			target -= propensities[r];
+			if (target < 0) return r;
+		}
+		return last;
+	}
+
+	void updatePropensities()
+	{
+		before = propensities;
+		double largest = 0;
+		for (int r = 0; r < network.reactionCount(); r++)
+		{
+			propensities[r] = network.propensity(r, counts);
+			if (!critical[r] && before[r] > 0) largest = std::max(largest, fabs(propensities[r] - before[r]) / before[r]);
+		}
+		report.largestPropensityChange = std::max(report.largestPropensityChange, largest);
+		report.sumPropensityChange += largest;
+	}
+
+	long long criticalFirings;
+	double exactFactor;
+	int exactBurst;
+	int exactStepsLeft = 0;
+
+	std::exponential_distribution<double> exponential{ 1.0 };
+	std::uniform_real_distribution<double> uniform{ 0.0, 1.0 };
+	std::vector<char> critical;
+	std::vector<long long> firings;
+	std::vector<double> flow;       //molecules per unit time moved in or out of every species by the non critical reactions
+	std::vector<double> variance;
+	std::vector<int> highestOrder;  //largest order of the reactions consuming each species, 0 if none does
+	std::vector<double> before;
+	ApproximationReport report;
+};
+
+class HybridSimulator : public ReactionSimulator
+{
+public:
+	HybridSimulator(const ReactionNetwork & network, double epsilon = 0.03, double fluidThreshold = 1000, bool diffusion = true)
+		: ReactionSimulator(network), fluidThreshold(fluidThreshold), diffusion(diffusion), amounts(network.speciesCount()),
+		fluid(network.speciesCount()), fast(network.reactionCount()), residual(network.reactionCount()),
+		flow(network.speciesCount()), spread(network.speciesCount())
+	{
+		report.epsilon = epsilon;
+	}
+
+	void reset(std::default_random_engine & generator) override
+	{
+		counts = network.initialCounts();
+		amounts.assign(counts.begin(), counts.end());
+		time = 0;
+		events = 0;
+		report.clear();
+		for (double & r : residual) r = exponential(generator);
+	}
+
+	bool step(std::default_random_engine & generator, double endTime) override
+	{
+		//species below the threshold are discrete and hold whole numbers
+		for (int s = 0; s < network.speciesCount(); s++)
+		{
+			fluid[s] = amounts[s] >= fluidThreshold;
+			if (!fluid[s]) amounts[s] = floor(amounts[s] + 0.5);
+		}
+
+		std::fill(flow.begin(), flow.end(), 0.0);
+		std::fill(spread.begin(), spread.end(), 0.0);
+		bool anyFast = false;
+		for (int r = 0; r < network.reactionCount(); r++)
+		{
+			propensities[r] = network.propensity(r, amounts);
+			const Reaction & reaction = network.reaction(r);
+			fast[r] = propensities[r] > 0
+				&& std::all_of(reaction.reactants.begin(), reaction.reactants.end(), [&](const ReactionTerm & term) { return fluid[term.species] != 0; })
+				&& std::all_of(reaction.change.begin(), reaction.change.end(), [&](const ReactionTerm & term) { return fluid[term.species] != 0; });
+			if (!fast[r]) continue;
+
+			anyFast = true;
+			for (auto & term : reaction.change)
+			{
+				flow[term.species] += std::abs(term.count) * propensities[r];
+				spread[term.species] += (double)term.count * term.count * propensities[r];
+			}
+		}
+
+		//the step ends at endTime, when a continuous species has moved by epsilon of itself, or at the next slow firing
+		double dt = endTime - time;
+		bool reachedEnd = true;
+		for (int s = 0; s < network.speciesCount(); s++)
+		{
+			if (!fluid[s]) continue;
+			double bound = report.epsilon * amounts[s];
+			if (flow[s] > 0 && bound / flow[s] < dt)
+			{
+				dt = bound / flow[s];
+				reachedEnd = false;
+			}
+			if (diffusion && spread[s] > 0 && bound * bound / spread[s] < dt)
+			{
+				dt = bound * bound / spread[s];
+				reachedEnd = false;
+			}
+		}
+		int slowFired = -1;
+		for (int r = 0; r < network.reactionCount(); r++)
+		{
+			if (fast[r] || propensities[r] <= 0) continue;
+			if (residual[r] / propensities[r] < dt)
+			{
+				dt = residual[r] / propensities[r];
+				slowFired = r;
+				reachedEnd = false;
+			}
+		}
+		if (std::isinf(dt))
+		{
+			//nothing can happen any more
+			return false;
+		}
+
+		bool clamped = false;
+		for (int r = 0; r < network.reactionCount(); r++)
+		{
+			if (propensities[r] <= 0) continue;
+			if (!fast[r])
+			{
+				if (r != slowFired) residual[r] -= propensities[r] * dt;
+				continue;
+			}
+			double firings = propensities[r] * dt;
+			if (diffusion) firings += sqrt(propensities[r] * dt) * normal(generator);
+			for (auto & term : network.reaction(r).change) amounts[term.species] += firings * term.count;
+			report.approximateEvents += propensities[r] * dt;
+			events += (long long)(propensities[r] * dt + 0.5);
+		}
+		if (slowFired >= 0)
+		{
+			network.fire(slowFired, amounts);
+			residual[slowFired] = exponential(generator);
+			events++;
+			report.exactSteps++;
+			report.exactEvents++;
+		}
+		for (double & amount : amounts)
+		{
+			if (amount < 0)
+			{
+				amount = 0;
+				clamped = true;
+			}
+		}
+		if (clamped) report.rejectedSteps++;
+
+		time += dt;
+		for (int s = 0; s < network.speciesCount(); s++) counts[s] = (long long)floor(amounts[s] + 0.5);
+
+		if (anyFast)
+		{
+			report.approximateSteps++;
+			double largest = 0;
+			for (int r = 0; r < network.reactionCount(); r++)
+			{
+				if (fast[r]) largest = std::max(largest, fabs(network.propensity(r, amounts) - propensities[r]) / propensities[r]);
+			}
+			report.largestPropensityChange = std::max(report.largestPropensityChange, largest);
+			report.sumPropensityChange += largest;
+		}
+		return !reachedEnd;
+	}
+
+	const ApproximationReport & approximation() const { return report; }
+	const char * name() const override { return diffusion ? "hybrid (Langevin fluid + exact)" : "hybrid (ODE fluid + exact)"; }
+
+private:
+	double fluidThreshold;
+	bool diffusion;
+
+	std::exponential_distribution<double> exponential{ 1.0 };
+	std::normal_distribution<double> normal{ 0.0, 1.0 };
+	std::vector<double> amounts;    //counts as reals, whole numbers for discrete species
+	std::vector<char> fluid;
+	std::vector<char> fast;
+	std::vector<double> residual;   //integrated propensity left before each slow reaction fires
+	std::vector<double> flow;
+	std::vector<double> spread;
+	ApproximationReport report;
+};
@@ -0,0 +1,346 @@
+#pragma once
+
+/*
+	Hierarchical timing wheel for deadlines in integer ticks (patience of waiting riders, reservations, ...), kept apart
+	from the event list of the model so a large number of pending timers that mostly get cancelled never touch it.
+
+	Level k has 256 slots of 256^k ticks each, four levels cover 2^32 ticks ahead of the current tick and anything
+	further waits in an overflow list. A timer sits in the slot its deadline falls in on the lowest level that can
+	still tell it apart from the current tick, so everything in level 0 slot (now & 255) is due now. When the current
+	tick enters a new block of level k, the slot of that block is taken apart and its timers move down a level.
+
+	Timers live in a pool and every slot is an intrusive doubly linked list of pool indices, so schedule and cancel are
+	O(1) and allocate nothing once the pool has grown. advanceTo() doesn't walk the ticks in between: an occupancy
+	bitmap per level gives the next tick where a slot has to fire or be taken apart, and it jumps straight there.
+
+	PatienceLine is a first come first served waiting line on top of a wheel: every client gets a deadline when they
+	join and leaves the line when it expires, a client who is served first has their timer cancelled.
+*/
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//index of the lowest set bit, word must not be 0
+inline int lowestSetBit(uint64_t word)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return (int)index;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+class TimingWheel
+{
+public:
+	typedef uint32_t Handle;
+	static const Handle none = UINT32_MAX;
+	static const uint64_t never = UINT64_MAX; //a deadline that is never reached
+
+	explicit TimingWheel(uint64_t start = 0) { clear(start); }
+
+	//drops every timer and restarts the wheel at tick start, keeps the pool
+	void clear(uint64_t start = 0)
+	{
+		current = start;
+		pending = 0;
+		std::fill(heads, heads + listCount, Handle(none));
+		std::fill(&occupied[0][0], &occupied[0][0] + levels * slots / 64, 0);
+		timers.clear();
+		freeList = none;
+	}
+
+	//payload comes back when the timer expires, a deadline that has already passed expires on the next advanceTo
+	Handle schedule(uint64_t deadline, uint64_t payload)
+	{
+		Handle timer = freeList;
+		if (timer != none)
+		{
+			freeList = timers[timer].next;
+		}
+		else
+		{
+			timer = (Handle)timers.size();
+			timers.emplace_back();
+		}
+		timers[timer].deadline = std::max(deadline, current);
+		timers[timer].payload = payload;
+		place(timer);
+		pending++;
+		return timer;
+	}
+
+	//the timer must still be pending
+	void cancel(Handle timer)
+	{
+		unlink(timer);
+		release(timer);
+	}
+
+	//moves the wheel to tick and hands every timer due by then to expire(payload, deadline), in order of deadline
+	//(timers with the same deadline in no particular order), expire may schedule and cancel timers
+	template <typename Expire>
+	void advanceTo(uint64_t tick, Expire expire)
+	{
+		while (true)
+		{
+			size_t slot = (size_t)(current & slotMask);
+			while (heads[slot] != none)
+			{
+				Handle timer = heads[slot];
+				unlink(timer);
+				uint64_t payload = timers[timer].payload;
+				uint64_t deadline = timers[timer].deadline;
+				release(timer);
+				expire(payload, deadline);
+			}
+
+			if (current >= tick) return;
+			if (pending == 0)
+			{
+				current = tick;
+				return;
+			}
+
+			current = tick - current == 1 ? tick : std::min(nextBoundary(), tick);
+			cascade();
+		}
+	}
+
+	uint64_t now() const { return current; }
+	size_t size() const { return pending; }
+
+private:
+	static const int levels = 4;
+	static const int slotBits = 8;
+	static const int slots = 1 << slotBits;
+	static const uint64_t slotMask = slots - 1;
+	static const int overflowList = levels * slots;
+	static const int listCount = levels * slots + 1;
+
+	struct Timer
+	{
+		uint64_t deadline;
+		uint64_t payload;
+		Handle previous;
+		Handle next;
+		int list;
+	};
+
+	void place(Handle timer)
+	{
+		uint64_t deadline = timers[timer].deadline;
+		uint64_t delta = deadline - current;
+		int list = overflowList;
+		for (int level = 0; level < levels; level++)
+		{
+			if (delta < (uint64_t)1 << (slotBits * (level + 1)))
+			{
+				int slot = (int)((deadline >> (slotBits * level)) & slotMask);
+				list = level * slots + slot;
+				occupied[level][slot >> 6] |= (uint64_t)1 << (slot & 63);
+				break;
+			}
+		}
+
+		Timer & node = timers[timer];
+		node.list = list;
+		node.previous = none;
+		node.next = heads[list];
+		if (node.next != none) timers[node.next].previous = timer;
+		heads[list] = timer;
+	}
+
+	void unlink(Handle timer)
+	{
+		Timer & node = timers[timer];
+		if (node.previous != none) timers[node.previous].next = node.next;
+		else heads[node.list] = node.next;
+		if (node.next != none) timers[node.next].previous = node.previous;
+
+		if (heads[node.list] == none && node.list != overflowList)
+		{
+			int slot = node.list & (int)slotMask;
+			occupied[node.list / slots][slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+		}
+	}
+
+	void release(Handle timer)
+	{
+		timers[timer].next = freeList;
+		freeList = timer;
+		pending--;
+	}
+
+	//first occupied slot of a level after slot from, wrapping around, -1 if the level is empty
+	int nextOccupied(int level, int from) const
+	{
+		for (int step = 0; step <= slots / 64; step++)
+		{
+			int word = ((from >> 6) + step) & (slots / 64 - 1);
+			uint64_t bits = occupied[level][word];
+			if (step == 0) bits &= from % 64 == 63 ? 0 : ~(uint64_t)0 << (from % 64 + 1);
+			if (step == slots / 64) bits &= ~(uint64_t)0 >> (63 - from % 64);
+			if (bits) return word * 64 + lowestSetBit(bits);
+		}
+		return -1;
+	}
+
+	//earliest tick after the current one where a level 0 slot fires or a higher slot has to be taken apart
+	uint64_t nextBoundary() const
+	{
+		uint64_t next = never;
+		for (int level = 0; level < levels; level++)
+		{
+			int shift = slotBits * level;
+			int from = (int)((current >> shift) & slotMask);
+			int slot = nextOccupied(level, from);
+			if (slot < 0) continue;
+
+			//a slot at or before the current one belongs to the next turn of its level
+			uint64_t turn = (current >> (shift + slotBits)) + (slot <= from ? 1 : 0);
+			next = std::min(next, (turn << (shift + slotBits)) + ((uint64_t)slot << shift));
+		}
+		if (heads[overflowList] != none)
+		{
+			int shift = slotBits * levels;
+			next = std::min(next, ((current >> shift) + 1) << shift);
+		}
+		return next;
+	}
+
+	//the current tick starts a block of some levels, move the timers of those blocks closer
+	void cascade()
+	{
+		if ((current & (((uint64_t)1 << (slotBits * levels)) - 1)) == 0) redistribute(overflowList);
+		for (int level = levels - 1; level >= 1; level--)
+		{
+			int shift = slotBits * level;
+			if ((current & (((uint64_t)1 << shift) - 1)) != 0) continue;
+			redistribute(level * slots + (int)((current >> shift) & slotMask));
+		}
+	}
+
+	void redistribute(int list)
+	{
+		Handle timer = heads[list];
+		if (timer == none) return;
+		heads[list] = none;
+		if (list != overflowList)
+		{
+			int slot = list & (int)slotMask;
+			occupied[list / slots][slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+		}
+		while (timer != none)
+		{
+			Handle next = timers[timer].next;
+			place(timer);
+			timer = next;
+		}
+	}
+
+	uint64_t current;
+	size_t pending;
+	Handle heads[listCount];
+	uint64_t occupied[levels][slots / 64];
+	std::vector<Timer> timers;
+	Handle freeList;
+};
+
+//waiting line of clients who give up at their deadline (in ticks of the wheel) unless a bike comes first
+template <typename Client>
+class PatienceLine
+{
+public:
+	void clear(uint64_t start = 0)
+	{
+		wheel.clear(start);
+		nodes.clear();
+		first = last = freeList = TimingWheel::none;
+		waiting = 0;
+	}
+
+	void join(const Client & client, uint64_t deadline)
+	{
+		uint32_t node = freeList;
+		if (node != TimingWheel::none)
+		{
+			freeList = nodes[node].next;
+		}
+		else
+		{
+			node = (uint32_t)nodes.size();
+			nodes.emplace_back();
+		}
+		nodes[node].client = client;
+		nodes[node].previous = last;
+		nodes[node].next = TimingWheel::none;
+		nodes[node].timer = deadline == TimingWheel::never ? TimingWheel::none : wheel.schedule(deadline, node);
+		if (last != TimingWheel::none) nodes[last].next = node;
+		else first = node;
+		last = node;
+		waiting++;
+	}
+
+	//the client at the front gets a bike, false if nobody is waiting
+	bool serve(Client & client)
+	{
+		if (first == TimingWheel::none) return false;
+		uint32_t node = first;
+		client = nodes[node].client;
+		if (nodes[node].timer != TimingWheel::none) wheel.cancel(nodes[node].timer);
+		remove(node);
+		return true;
+	}
+
+	//time passes up to tick, every client whose patience runs out by then leaves the line and goes to abandon(client)
+	template <typename Abandon>
+	void advanceTo(uint64_t tick, Abandon abandon)
+	{
+		wheel.advanceTo(tick, [&](uint64_t payload, uint64_t)
+		{
+			uint32_t node = (uint32_t)payload;
+			Client client = nodes[node].client;
+			remove(node);
+			abandon(client);
+		});
+	}
+
+	bool empty() const { return waiting == 0; }
+	size_t size() const { return waiting; }
+
+private:
+	struct Node
+	{
+		Client client;
+		uint32_t previous;
+		uint32_t next;
+		TimingWheel::Handle timer;
+	};
+
+	void remove(uint32_t node)
+	{
+		Node & entry = nodes[node];
+		if (entry.previous != TimingWheel::none) nodes[entry.previous].next = entry.next;
+		else first = entry.next;
+		if (entry.next != TimingWheel::none) nodes[entry.next].previous = entry.previous;
+		else last = entry.previous;
+		entry.next = freeList;
+		freeList = node;
+		waiting--;
+	}
+
+	TimingWheel wheel;
+	std::vector<Node> nodes;
+	uint32_t first = TimingWheel::none;
+	uint32_t last = TimingWheel::none;
+	uint32_t freeList = TimingWheel::none;
+	size_t waiting = 0;
+};
@@ -0,0 +1,252 @@
+#pragma once
+
+/*
+	Recorded station events (trip logs) for trace driven replay, stored in a binary columnar file that is memory mapped
+	on load.
+
+	Every row is one event at one station: class 0 is a bike docked there (the end of a trip) and class c >= 1 a client
+	of class c who wants a bike (the start of one). Rows are sorted by time.
+
+	File layout (little endian, the columns follow the 48 byte header back to back without padding, so each starts
+	aligned for its own element type: times on 8 bytes, stations on 4, classes anywhere):
+		header    magic "TRIPTRCE", version, reserved, row count, station count (largest id + 1), first and last time
+		times     double[rows]
+		stations  uint32_t[rows]
+		classes   uint8_t[rows]
+
+	A replay only touches the columns it reads, straight from the mapping. The time column is sorted, so a time window
+	is found with two binary searches; TripTraceCursor then walks the window and skips the stations the filter leaves
+	out, handing the rest to the event loop without copying them anywhere.
+
+	convertTripCsv() builds the file from a text log ("time,station,class" per line, a header line and lines starting
+	with # are skipped). It splits the rows into one scratch file per column on the way in, so a sorted log of any size
+	converts in constant memory; an unsorted one is sorted in memory before it is written (21 bytes a row, the three
+	columns and an 8 byte index into them).
+*/
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+
+struct TripTraceHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t rows;
+	uint64_t stations;
+	double firstTime;
+	double lastTime;
+};
+
+const uint32_t tripTraceVersion = 1;
+
+struct TripEvent
+{
+	double time;
+	uint32_t station;
+	int eventClass;
+};
+
+//where the columns of a trace with the given number of rows start
+inline uint64_t tripTraceStationsOffset(uint64_t rows) { return sizeof(TripTraceHeader) + rows * sizeof(double); }
+inline uint64_t tripTraceClassesOffset(uint64_t rows) { return tripTraceStationsOffset(rows) + rows * sizeof(uint32_t); }
+
+class TripTrace
+{
+public:
+	//maps the file and checks that the header and the sizes agree
+	bool open(const char * path)
+	{
+		header = TripTraceHeader{};
+		if (!file.open(path) || file.size() < sizeof(TripTraceHeader)) return false;
+
+		memcpy(&header, file.data(), sizeof(header));
+		if (memcmp(header.magic, "TRIPTRCE", 8) != 0 || header.version != tripTraceVersion) return false;
+		if (file.size() < tripTraceClassesOffset(header.rows) + header.rows)
+		{
+			header.rows = 0;
+			return false;
+		}
+
+		times = (const double *)(file.data() + sizeof(header));
+		stations = (const uint32_t *)(file.data() + tripTraceStationsOffset(header.rows));
+		classes = file.data() + tripTraceClassesOffset(header.rows);
+		return true;
+	}
+
+	uint64_t rowCount() const { return header.rows; }
+	uint64_t stationCount() const { return header.stations; }
+	double firstTime() const { return header.firstTime; }
+	double lastTime() const { return header.lastTime; }
+
+	double time(uint64_t row) const { return times[row]; }
+	uint32_t station(uint64_t row) const { return stations[row]; }
+	int eventClass(uint64_t row) const { return classes[row]; }
+
+	//first row at or after time
+	uint64_t lowerBound(double time) const { return std::lower_bound(times, times + header.rows, time) - times; }
+
+private:
+	MappedFile file;
+	TripTraceHeader header = {};
+	const double * times = NULL;
+	const uint32_t * stations = NULL;
+	const uint8_t * classes = NULL;
+};
+
+//the events of [from, to) in time order, only the stations whose entry in stationFilter is set (all without a filter)
+class TripTraceCursor
+{
+public:
+	TripTraceCursor(const TripTrace & trace, double from, double to, const std::vector<char> * stationFilter = NULL)
+		: trace(trace), row(trace.lowerBound(from)), end(trace.lowerBound(to)), stationFilter(stationFilter)
+	{
+	}
+
+	bool next(TripEvent & event)
+	{
+		for (; row < end; row++)
+		{
+			uint32_t station = trace.station(row);
+			if (stationFilter && (station >= stationFilter->size() || !(*stationFilter)[station])) continue;
+			event = TripEvent{ trace.time(row), station, trace.eventClass(row) };
+			row++;
+			return true;
+		}
+		return false;
+	}
+
+private:
+	const TripTrace & trace;
+	uint64_t row;
+	uint64_t end;
+	const std::vector<char> * stationFilter;
+};
+
+//reads the next "time,station,class" row of a log, skipping comments, the header and anything else that doesn't parse
+inline bool readTripRow(FILE * in, double & time, unsigned long & station, unsigned long & eventClass)
+{
+	char line[256];
+	while (fgets(line, sizeof(line), in))
+	{
+		if (line[0] == '#') continue;
+		char * end;
+		time = strtod(line, &end);
+		if (end == line || *end != ',') continue;
+		char * field = end + 1;
+		station = strtoul(field, &end, 10);
+		if (end == field || *end != ',' || station >= UINT32_MAX) continue;
+		field = end + 1;
+		eventClass = strtoul(field, &end, 10);
+		if (end == field || eventClass > UINT8_MAX) continue;
+		return true;
+	}
+	return false;
+}
+
+//appends the whole of the file at path to out
+inline bool appendTripColumn(FILE * out, const std::string & path)
+{
+	FILE * in = fopen(path.c_str(), "rb");
+	if (!in) return false;
+	char buffer[1 << 16];
+	size_t read;
+	bool copied = true;
+	while ((read = fread(buffer, 1, sizeof(buffer), in)) > 0) copied &= fwrite(buffer, 1, read, out) == read;
+	fclose(in);
+	return copied;
+}
+
+//text log to binary trace, returns false if a file can't be read or written
+inline bool convertTripCsv(const char * csvPath, const char * tracePath)
+{
+	FILE * in = fopen(csvPath, "r");
+	if (!in) return false;
+
+	//one pass splits the rows into scratch column files and checks the order
+	std::string scratch[3] = { std::string(tracePath) + ".times.tmp", std::string(tracePath) + ".stations.tmp", std::string(tracePath) + ".classes.tmp" };
+	FILE * columns[3];
+	for (int c = 0; c < 3; c++) columns[c] = fopen(scratch[c].c_str(), "wb");
+
+	TripTraceHeader header = {};
+	memcpy(header.magic, "TRIPTRCE", 8);
+	header.version = tripTraceVersion;
+	bool sorted = true;
+	bool written = columns[0] && columns[1] && columns[2];
+	double time;
+	unsigned long station, eventClass;
+	while (written && readTripRow(in, time, station, eventClass))
+	{
+		if (header.rows == 0) header.firstTime = header.lastTime = time;
+		if (time < header.lastTime) sorted = false;
+		header.firstTime = std::min(header.firstTime, time);
+		header.lastTime = std::max(header.lastTime, time);
+		header.stations = std::max<uint64_t>(header.stations, (uint64_t)station + 1);
+		header.rows++;
+
+		uint32_t stationId = (uint32_t)station;
+		uint8_t classId = (uint8_t)eventClass;
+		written = fwrite(&time, sizeof(time), 1, columns[0]) == 1 && fwrite(&stationId, sizeof(stationId), 1, columns[1]) == 1
+			&& fwrite(&classId, sizeof(classId), 1, columns[2]) == 1;
+	}
+	fclose(in);
+	for (int c = 0; c < 3; c++)
+	{
+		if (columns[c]) written &= fclose(columns[c]) == 0;
+	}
+
+	FILE * out = written ? fopen(tracePath, "wb") : NULL;
+	written = out != NULL && fwrite(&header, sizeof(header), 1, out) == 1;
+	if (written && sorted)
+	{
+		for (int c = 0; c < 3 && written; c++) written = appendTripColumn(out, scratch[c]);
+	}
+	else if (written)
+	{
+		//out of order, read the columns back and write them in time order (stable, so ties keep the order of the log)
+		std::vector<double> times(header.rows);
+		std::vector<uint32_t> stations(header.rows);
+		std::vector<uint8_t> classes(header.rows);
+		FILE * parts[3] = { fopen(scratch[0].c_str(), "rb"), fopen(scratch[1].c_str(), "rb"), fopen(scratch[2].c_str(), "rb") };
+		written = parts[0] && parts[1] && parts[2]
+			&& fread(times.data(), sizeof(double), header.rows, parts[0]) == header.rows
+			&& fread(stations.data(), sizeof(uint32_t), header.rows, parts[1]) == header.rows
+			&& fread(classes.data(), sizeof(uint8_t), header.rows, parts[2]) == header.rows;
+		for (FILE * part : parts)
+		{
+			if (part) fclose(part);
+		}
+
+		std::vector<uint64_t> order(header.rows);
+		for (uint64_t r = 0; r < header.rows; r++) order[r] = r;
+		std::stable_sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) { return times[a] < times[b]; });
+		std::vector<uint8_t> block;
+		for (int c = 0; c < 3 && written; c++)
+		{
+			//one column at a time through a small block
+			for (uint64_t first = 0; first < header.rows && written; first += 1 << 16)
+			{
+				uint64_t last = std::min<uint64_t>(header.rows, first + (1 << 16));
+				block.clear();
+				for (uint64_t r = first; r < last; r++)
+				{
+					const uint8_t * value = c == 0 ? (const uint8_t *)&times[order[r]] : c == 1 ? (const uint8_t *)&stations[order[r]] : &classes[order[r]];
+					size_t size = c == 0 ? sizeof(double) : c == 1 ? sizeof(uint32_t) : sizeof(uint8_t);
+					block.insert(block.end(), value, value + size);
+				}
+				written = fwrite(block.data(), 1, block.size(), out) == block.size();
+			}
+		}
+	}
+	if (out) written &= fclose(out) == 0;
+
+	for (int c = 0; c < 3; c++) remove(scratch[c].c_str());
+	return written;
+}
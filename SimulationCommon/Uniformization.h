@@ -0,0 +1,138 @@
+#pragma once
+
+/*
+	Exact transient solution of a birth-death CTMC by uniformization, the analytical counterpart of the replications
+	of the single station models.
+
+	BirthDeathChain holds the generator truncated to states 0 .. n - 1 as its three diagonals (up and down rate of
+	every state). The up rate of the last state is kept on the diagonal but leads nowhere, so probability that would
+	leave the truncated chain is lost instead of being put somewhere it doesn't belong.
+
+	With a uniformization rate L >= the largest total rate, P = I + Q / L is substochastic and
+		p(t) = sum_k poisson(k; L t) v_k,                v_k = v_0 P^k
+		integral_0^T p(t) dt = 1/L sum_k P(N(L T) > k) v_k   (the occupation measure, expected time in each state)
+	Step k is one pass over the diagonals, branch free over zero padded arrays so the compiler vectorizes it. The
+	poisson weights are evaluated in log space around the mode (exp(-L T) alone underflows for L T > 745) and the tail
+	sums are accumulated from the far end, small terms first.
+
+	Certified truncation: both truncations (the states and the poisson sum) only ever drop nonnegative terms, so every
+	computed probability and occupation time is a lower bound of the exact one. The dropped mass is known exactly,
+	missingTime = T - (sum of all occupation times), and for any set of states A
+		computed occupation(A) <= exact occupation(A) <= computed occupation(A) + missingTime
+	and the same holds for the distribution at T with missingMass = 1 - sum p(T). The bound is reported with the
+	result instead of being assumed from an a priori estimate.
+*/
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+struct BirthDeathChain
+{
+	std::vector<double> up;   //rate from x to x + 1, the last state's leaves the truncated chain
+	std::vector<double> down; //rate from x to x - 1, down[0] must be 0
+
+	int states() const { return (int)up.size(); }
+};
+
+struct TransientSolution
+{
+	std::vector<double> distribution; //p(T)
+	std::vector<double> occupation;   //expected time in every state over [0, T]
+	double missingMass;               //1 - sum of p(T), bounds the error of any probability at T
+	double missingTime;               //T - sum of occupation, bounds the error of any occupation time
+	double uniformizationRate;
+	int steps;                        //mat-vecs, the poisson sum was cut after this many jumps
+};
+
+//poisson probabilities of 0 .. last jumps for the given mean, accurate where they don't underflow
+inline std::vector<double> poissonWeights(double mean, int last)
+{
+	std::vector<double> weights(last + 1, 0.0);
+	if (mean <= 0)
+	{
+		weights[0] = 1;
+		return weights;
+	}
+	double logMean = log(mean);
+	for (int k = 0; k <= last; k++) weights[k] = exp(-mean + k * logMean - lgamma(k + 1.0));
+	return weights;
+}
+
+//enough jumps that the poisson tail beyond them, weighted by the time it could carry, is below epsilon of horizon
+inline int poissonTruncationPoint(double mean, double epsilon)
+{
+	//past the mode the ratio of consecutive weights is mean / (k + 1) < 1, so the tail is below a geometric series
+	int k = (int)mean + 1;
+	double logMean = log(mean);
+	while (true)
+	{
+		double weight = exp(-mean + k * logMean - lgamma(k + 1.0));
+		double ratio = mean / (k + 1.0);
+		double tail = weight * ratio / (1 - ratio);
+		if (tail * (k + 1) < epsilon * std::max(mean, 1.0)) return k;
+		k++;
+	}
+}
+
+//probability of every state at horizon and time spent in it over [0, horizon], starting from initial
+inline TransientSolution solveTransient(const BirthDeathChain & chain, const std::vector<double> & initial, double horizon, double epsilon = 1e-12)
+{
+	int n = chain.states();
+	double rate = 0;
+	for (int x = 0; x < n; x++) rate = std::max(rate, chain.up[x] + chain.down[x]);
+	rate = std::max(rate, 1e-300);
+
+	//coefficients of P = I + Q / rate on padded arrays: new[x] = stay[x] v[x] + fromBelow[x] v[x - 1] + fromAbove[x] v[x + 1]
+	std::vector<double> stay(n), fromBelow(n), fromAbove(n);
+	for (int x = 0; x < n; x++)
+	{
+		stay[x] = 1 - (chain.up[x] + chain.down[x]) / rate;
+		fromBelow[x] = x > 0 ? chain.up[x - 1] / rate : 0;
+		fromAbove[x] = x + 1 < n ? chain.down[x + 1] / rate : 0;
+	}
+
+	double mean = rate * horizon;
+	int last = poissonTruncationPoint(mean, epsilon);
+	std::vector<double> weights = poissonWeights(mean, last);
+
+	//tail[k] = P(N > k) within the truncated sum, from the far end so the small weights are added first
+	std::vector<double> tail(last + 1, 0.0);
+	for (int k = last - 1; k >= 0; k--) tail[k] = tail[k + 1] + weights[k + 1];
+
+	TransientSolution solution;
+	solution.distribution.assign(n, 0.0);
+	solution.occupation.assign(n, 0.0);
+	solution.uniformizationRate = rate;
+	solution.steps = last;
+
+	std::vector<double> current(n + 2, 0.0), next(n + 2, 0.0);
+	for (int x = 0; x < n && x < (int)initial.size(); x++) current[x + 1] = initial[x];
+
+	for (int k = 0; k <= last; k++)
+	{
+		const double * v = current.data() + 1;
+		double weight = weights[k];
+		double held = tail[k] / rate;
+		for (int x = 0; x < n; x++)
+		{
+			solution.distribution[x] += weight * v[x];
+			solution.occupation[x] += held * v[x];
+		}
+		if (k == last) break;
+
+		double * w = next.data() + 1;
+		for (int x = 0; x < n; x++) w[x] = stay[x] * v[x] + fromBelow[x] * v[x - 1] + fromAbove[x] * v[x + 1];
+		current.swap(next);
+	}
+
+	double mass = 0, time = 0;
+	for (int x = 0; x < n; x++)
+	{
+		mass += solution.distribution[x];
+		time += solution.occupation[x];
+	}
+	solution.missingMass = std::max(0.0, 1 - mass);
+	solution.missingTime = std::max(0.0, horizon - time);
+	return solution;
+}
@@ -4,68 +4,126 @@
 	all of the rates (bike arrival, class1/2/3 arrivals). We are able to do this due to superposition ( If we have two independent Poisson
 	processes with rates a and b respectively, then the combined process of the arrivals from both processes is a Poisson process with rate
 	a + b). Once we generate the poisson random number for a given time unit, we use a uniform number generator + the weights of the original
-	events to determine the order of the events. To achieve this we use std::discrete_distribution which allows you to generate a value given
-	a specific weight. The weight used is the rate of the original event. We ran the simulation 10000 times, and then averaged the totalMoney
-	at the end of each run.
+	events to determine the order of the events. The weight used is the rate of the original event, and the classes and their prices are
+	the rider classes of RiderClasses.h (the homework's three, or any number loaded from a file given on the command line), so an event is
+	classified with one alias table lookup and handled from the price tables whatever the number of classes. A client that arrives at an
+	empty station joins the line once and pays the penalty, otherwise takes a bike. We ran the simulation 10000 times, and then averaged
+	the totalMoney at the end of each run.
 
 	Output after 10000 runs:
 	...
-	Total Money at the end of experiment 274.85
-	Total Money at the end of experiment 198.85
-	Total Money at the end of experiment 219.35
-	Average amount of money over 10000 iterations : 214.596
+	Total Money at the end of experiment 258.1
+	Total Money at the end of experiment 260.1
+	Total Money at the end of experiment 239.85
+	Average amount of money over 10000 iterations : 233.021
+
+	With reneging a waiting client gives up after an exponential patience time (mean 0.25 intervals) and a pay per ride
+	rider who does takes the fare along. Now the event times matter, so given the poisson count they are drawn as sorted
+	uniforms over the interval, and the patience deadlines sit in a timing wheel (TimingWheel.h) in ticks of 1/65536
+	interval. Before an event every deadline up to it fires, a client served first has their timer cancelled.
+
+	Output after 10000 runs with reneging:
+	...
+	Total Money at the end of experiment 287.85
+	Total Money at the end of experiment 233.6
+	Average amount of money over 10000 iterations : 282.702
+	Clients who had to wait per run : 427.517
+	Abandoned (lost trips) per run : 231.503, abandonment rate 0.541506
+	Lost revenue per run : 144.726
 */
 
 #include <iostream>
 #include <random>
-#include <queue>
+#include <algorithm>
+#include <math.h>
+#include <vector>
 #include <time.h>
 
+#include "../SimulationCommon/BatchVariates.h"
+#include "../SimulationCommon/ReplicationRunner.h"
+#include "../SimulationCommon/RiderClasses.h"
+#include "../SimulationCommon/TimingWheel.h"
+
 struct Client
 {
 	int type;
 };
 
-int main()
+//what a single trial reports back to the reduction in main
+struct TrialResult
+{
+	double totalMoney;
+	int joined;        //clients who had to wait
+	int abandoned;     //of those, gave up before a bike came (lost trips)
+	double lostRevenue; //fares of the riders who gave up
+};
+
+int main(int argc, char * argv[])
 {
 	const int T = 120;
-	int X[121] = { 0 }; //There are T+1 events
 	const double bikeArrivalRate = 6;
-	//clients have rate r1 = 3, r2 = 1, r3 = 4
-	const double clientRates[4] = { 0, 3.0, 1.0, 4.0 };
 
-	//client class 1/2 pay annually (K1 = 0.5, k2 = .1), total amount is (K1*r1 + K2*r2)
-	//class 3 pays per ride amount k3 = 1.25
+	//the rider classes come from the file given on the command line (see RiderClasses.h for the format), without one
+	//we use the homework's: r1 = 3, r2 = 1, r3 = 4, classes 1/2 pay annually (K1 = 0.5, K2 = .1) and are penalised
+	//c1 = 1.0, c2 = 0.25 when they have to wait, class 3 pays k3 = 1.25 per ride
+	std::vector<RiderClass> riderClasses = homeworkRiderClasses();
+	if (argc >= 2 && !loadRiderClasses(argv[1], riderClasses))
+	{
+		std::cout << "Could not load the rider classes from " << argv[1] << std::endl;
+		return 1;
+	}
+	const StationEvents events(bikeArrivalRate, riderClasses);
+	std::cout << "Rider classes : " << events.classes() << std::endl;
 
-	//when annual members (class 1/2) arrive at empty station, there is penalty c1 = 1.0, c2 = 0.25, c3 = 0
-	const double clientPenalty[4] = { 0, -1.0, -0.25, 0 };
+	//the base seed, every trial derives its own generator from it (see ReplicationRunner.h)
+	const unsigned int baseSeed = (unsigned int)time(0);
 
-	//create and seed the generator
-	std::default_random_engine generator;
-	generator.seed(time(0));
-	
 	//aggregate poisson
-	std::cout << "Aggregate Lambda is : " << bikeArrivalRate + clientRates[1] + clientRates[2] + clientRates[3] << std::endl;
-	std::poisson_distribution<int> poissonRandomVariableGenerator(bikeArrivalRate + clientRates[1] + clientRates[2] + clientRates[3]);
+	std::cout << "Aggregate Lambda is : " << events.totalRate << std::endl;
+
+	//waiting clients give up after an exponential patience time (in poisson intervals), they are lost trips and a pay per
+	//ride rider who gives up takes their fare along; without reneging they wait for as long as it takes
+	const bool useReneging = true;
+	const double meanPatience = 0.25;
 
-	
-/*  std::discrete_distribution produces random integers on the interval [0, n), 
-	where the probability of each individual integer i is defined as the weight of
-	the ith integer divided by the sum of all n weights. */
-	std::discrete_distribution<> weightedDistributionEventGenerator({ bikeArrivalRate, clientRates[1], clientRates[2], clientRates[3] });
+	//patience deadlines are kept in ticks of the timing wheel, a client leaves at most one tick late
+	const double ticksPerUnit = 65536;
 
 	const int numberOfTrials = 10000;
 	double averageMoneyAmount = 0;
+	TrialResult total = {};
 
 	std::cout << "Starting the trials" << std::endl;
 
-	for (int t = 0; t < numberOfTrials; t++)
+	//every trial is independent, so they are spread over all cores and reduced in trial order afterwards
+	std::vector<TrialResult> results = runReplications<TrialResult>(numberOfTrials, baseSeed,
+		[&](std::default_random_engine & generator, int)
 	{
-		//client queue
-		std::queue<Client> line;
+		int X[T + 1] = { 0 }; //There are T+1 events
+
+		std::poisson_distribution<int> poissonRandomVariableGenerator(events.totalRate);
+
+		//the events are classified with the alias table of StationEvents, one uniform each from a batch filled buffer
+		uint64_t streamSeed = generator();
+		streamSeed = (streamSeed << 32) ^ generator();
+		VariateStream classifyGenerator = VariateStream::uniform(mixStreamSeed(streamSeed, 0), 0, 1);
+		VariateStream timeGenerator = VariateStream::uniform(mixStreamSeed(streamSeed, 1), 0, 1);
+		VariateStream patienceGenerator = VariateStream::exponential(mixStreamSeed(streamSeed, 2), 1.0 / meanPatience);
+		std::vector<double> eventTimes;
+
+		//client queue, the patience timers of the clients in it sit in a timing wheel (see TimingWheel.h)
+		PatienceLine<Client> line;
+		TrialResult result = {};
+
+		//a rider who never got a bike doesn't pay for the ride
+		auto abandon = [&](const Client & client)
+		{
+			result.abandoned++;
+			result.lostRevenue += events.fare[client.type];
+		};
 
-		//we can assume total money starts at 0 + the deterministic annual prorated charge of clients classes 1 and 2
-		double totalMoney = (0.5 * clientRates[1]) + (0.1 * clientRates[2]);
+		//we can assume total money starts at 0 + the deterministic annual prorated charge of the members
+		double totalMoney = events.annualCharge;
 		X[0] = 10; //we start with 10 bikes at X(0)
 
 		//for every X[i] to X[T]
@@ -74,13 +132,25 @@ int main()
 			X[i] = X[i - 1]; //new time interval starts with bike amount from prev interval
 			int generatedValue = poissonRandomVariableGenerator(generator);
 			//std::cout << "Generated p.r.v : " << generatedValue << std::endl;
+
+			//with reneging the times matter as well, given the count they are sorted uniforms over the interval
+			if (useReneging)
+			{
+				eventTimes.resize(generatedValue);
+				for (double & eventTime : eventTimes) eventTime = i - 1 + timeGenerator.next();
+				std::sort(eventTimes.begin(), eventTimes.end());
+			}
+
 			for (int rEvent = 0; rEvent < generatedValue; rEvent++)
 			{	
-				//we don't actually care about the actual time an event happened on the interval, we only care about
-				//the order in which they happen, so generate a u.r.v. {0: Bike Arrival, 1: Class1, 2: Class2, 3: Class3)
-				//I don't think it would make a diff if I generated the event times first, sorted them by arrival, and then classified
-				//since the classification itself uses uniform generation + weights, so just generate the events
-				int eventType = weightedDistributionEventGenerator(generator);
+				//classify the event with a u.r.v. {0: Bike Arrival, c: a client of class c}, the classification doesn't
+				//depend on the time, so it can come after the sorted times. Without reneging only the order of the events
+				//matters and no times are drawn, with it the time of the event first lets the clients whose patience ran
+				//out before it leave the line, and a client who has to wait leaves at its time plus its patience
+				uint32_t eventType = events.classify(classifyGenerator.next());
+
+				//anyone whose patience ran out before this event has left
+				if (useReneging) line.advanceTo((uint64_t)(eventTimes[rEvent] * ticksPerUnit), abandon);
 
 				if (eventType == 0) //a bike has arrived
 				{
@@ -88,48 +158,62 @@ int main()
 				}
 
 				//distribute the bikes to any clients waiting
-				while (!line.empty() && X[i] > 0)
+				Client served;
+				while (X[i] > 0 && line.serve(served))
 				{
-					auto client = line.front();
-					line.pop(); //remove from queue
-
 					X[i]--; //decrement bike count
 				}
 
 				if(eventType != 0) //a client has arrived
 				{
-					//if no more bikes, add to queue, else decrement bike count
-					if (X[i] == 0) line.emplace(Client{ eventType });
-					else X[i]--;
-
 					//if a client arrives and there are no bikes
 					if (X[i] == 0)
 					{
-						//add the client into the queue
-						line.emplace(Client{ eventType });
-						//we apply a penalty for waiting in line, for class3 penalty is 0
-						totalMoney += clientPenalty[eventType];
+						//add the client into the queue until their patience runs out
+						uint64_t deadline = useReneging ? (uint64_t)ceil((eventTimes[rEvent] + patienceGenerator.next()) * ticksPerUnit) : TimingWheel::never;
+						line.join(Client{ (int)eventType }, deadline);
+						result.joined++;
+						//we apply a penalty for waiting in line, 0 for pay per ride riders
+						totalMoney += events.penalty[eventType];
 					}
 					else
 					{
 						X[i]--; //otherise just give the client a bike
 					}
 
-					//pay per ride charge for class 3
-					if (eventType == 3)
-					{
-						totalMoney += 1.25;
-					}
+					//pay per ride riders pay their fare, now or once they get a bike
+					totalMoney += events.fare[eventType];
 				}
 			}
 		}
 
+		//whoever runs out of patience after the last event still leaves before the end
+		if (useReneging) line.advanceTo((uint64_t)(T * ticksPerUnit), abandon);
+
+		result.totalMoney = totalMoney - result.lostRevenue;
+		return result;
+	});
+
+	for (auto & result : results)
+	{
+		double totalMoney = result.totalMoney;
+
 		std::cout << "Total Money at the end of experiment " << totalMoney << std::endl;
 		averageMoneyAmount += totalMoney;
+		total.joined += result.joined;
+		total.abandoned += result.abandoned;
+		total.lostRevenue += result.lostRevenue;
 	}
 
 	std::cout << "Average amount of money over " << numberOfTrials << " iterations" << " : "
 		<< (averageMoneyAmount / numberOfTrials) << std::endl;
+	if (useReneging)
+	{
+		std::cout << "Clients who had to wait per run : " << (double)total.joined / numberOfTrials << std::endl;
+		std::cout << "Abandoned (lost trips) per run : " << (double)total.abandoned / numberOfTrials
+			<< ", abandonment rate " << (total.joined > 0 ? (double)total.abandoned / total.joined : 0) << std::endl;
+		std::cout << "Lost revenue per run : " << total.lostRevenue / numberOfTrials << std::endl;
+	}
 
 	return 0;
 }
@@ -20,12 +20,21 @@
 #include <iostream>
 #include <random>
 #include <queue>
+#include <vector>
 #include <time.h>
 
+#include "../SimulationCommon/ReplicationRunner.h"
+
+//what a single trial reports back to the reduction in main
+struct TrialResult
+{
+	double totalMoney;
+	unsigned long numberOfEvents;
+};
+
 int main()
 {
 	const int T = 120;
-	int X[121] = { 0 }; //There are T+1 events
 	const double bikeArrivalRate = 6;
 	//clients have rate r1 = 3, r2 = 1, r3 = 4
 	const double clientRates[4] = { 0, 3.0, 1.0, 4.0 };
@@ -36,18 +45,11 @@ int main()
 	//when annual members (class 1/2) arrive at empty station, there is penalty c1 = 1.0, c2 = 0.25, c3 = 0
 	const double clientPenalty[4] = { 0, -1.0, -0.25, 0 };
 
-	//create and seed the generator
-	std::default_random_engine generator;
-	generator.seed(time(0));
+	//the base seed, every trial derives its own generator from it (see ReplicationRunner.h)
+	const unsigned int baseSeed = (unsigned int)time(0);
 
 	//aggregate poisson
 	std::cout << "Aggregate Lambda is : " << bikeArrivalRate + clientRates[1] + clientRates[2] + clientRates[3] << std::endl;
-	std::poisson_distribution<int> poissonRandomVariableGenerator(bikeArrivalRate + clientRates[1] + clientRates[2] + clientRates[3]);
-
-	/*  std::discrete_distribution produces random integers on the interval [0, n),
-		where the probability of each individual integer i is defined as the weight of
-		the ith integer divided by the sum of all n weights. */
-	std::discrete_distribution<> weightedDistributionEventGenerator({ bikeArrivalRate, clientRates[1], clientRates[2], clientRates[3] });
 
 	const int numberOfTrials = 10000;
 	double averageMoneyAmount = 0;
@@ -55,8 +57,20 @@ int main()
 
 	std::cout << "Starting the trials" << std::endl;
 
-	for (int t = 0; t < numberOfTrials; t++)
+	//every trial is independent, so they are spread over all cores and reduced in trial order afterwards
+	std::vector<TrialResult> results = runReplications<TrialResult>(numberOfTrials, baseSeed,
+		[&](std::default_random_engine & generator, int)
 	{
+		int X[T + 1] = { 0 }; //There are T+1 events
+		unsigned long trialEvents = 0;
+
+		std::poisson_distribution<int> poissonRandomVariableGenerator(bikeArrivalRate + clientRates[1] + clientRates[2] + clientRates[3]);
+
+		/*  std::discrete_distribution produces random integers on the interval [0, n),
+			where the probability of each individual integer i is defined as the weight of
+			the ith integer divided by the sum of all n weights. */
+		std::discrete_distribution<> weightedDistributionEventGenerator({ bikeArrivalRate, clientRates[1], clientRates[2], clientRates[3] });
+
 		//we can assume total money starts at 0 + the deterministic annual prorated charge of clients classes 1 and 2
 		double totalMoney = (0.5 * clientRates[1]) + (0.1 * clientRates[2]);
 		X[0] = 10; //we start with 10 bikes at X(0)
@@ -66,7 +80,7 @@ int main()
 		{
 			X[i] = X[i - 1]; //new time interval starts with bike amount from prev interval
 			int generatedValue = poissonRandomVariableGenerator(generator);
-			numberOfEvents += generatedValue;
+			trialEvents += generatedValue;
 			//std::cout << "Generated p.r.v : " << generatedValue << std::endl;
 			for (int rEvent = 0; rEvent < generatedValue; rEvent++)
 			{
@@ -102,6 +116,14 @@ int main()
 			}
 		}
 
+		return TrialResult{ totalMoney, trialEvents };
+	});
+
+	for (auto & result : results)
+	{
+		double totalMoney = result.totalMoney;
+		numberOfEvents += result.numberOfEvents;
+
 		std::cout << "Total Money at the end of experiment " << totalMoney << std::endl;
 		averageMoneyAmount += totalMoney;
 	}
@@ -6,6 +6,17 @@
 	We found the theta to be 0.5 meaning on average for every 2 arrivals 1 person is serviced
 
 	1.2 average
+
+	The queue can be run by three engines (queueEngine in main):
+	Ticks        the loop below, every time unit samples the arrivals and scans the line
+	EventDriven  jumps from customer to customer and never touches idle time, see runEventDrivenTrial
+	Lindley      long steady state runs, see runLindleyEngine
+
+	With the Lindley engine the tick loop is replaced by the Lindley recursion (see LindleyQueue.h): customers stream
+	through a FIFO single server without being stored, and the time average queue length comes from Little's law.
+	Replications run in parallel and are checked against the Pollaczek-Khinchine value. This gives the queue length in
+	continuous time, the tick loop above samples it once per time unit and lets a customer start service before they
+	arrived within the same unit, so it reads lower (1.2 vs 1.5).
 */
 
 #include <iostream>
@@ -13,19 +24,164 @@
 #include <map>
 #include <time.h>
 
+#include "../SimulationCommon/BatchVariates.h"
+#include "../SimulationCommon/LindleyQueue.h"
+#include "../SimulationCommon/ReplicationRunner.h"
+#include "../SimulationCommon/StreamingStatistics.h"
+
+//pooled statistics of all Lindley replications plus the spread of the per replication queue length
+struct LindleySummary
+{
+	LindleyQueueStatistics pooled;
+	RunningMoments queueLength;
+
+	void merge(const LindleySummary & other)
+	{
+		pooled.merge(other.pooled);
+		queueLength.merge(other.queueLength);
+	}
+};
+
+void runLindleyEngine(unsigned int baseSeed, int numTrials, long long customersPerTrial)
+{
+	const double arrivalRate = 1;
+	const double serviceShape = 3;
+	const double serviceScale = 0.25;
+
+	LindleySummary empty;
+	empty.pooled = LindleyQueueStatistics(0.05, 2048);
+
+	LindleySummary summary = reduceReplications(numTrials, baseSeed, empty,
+		[&](std::default_random_engine & generator, int)
+	{
+		uint64_t seed = generator();
+		seed = (seed << 32) ^ generator();
+		LindleyQueue queue(seed, arrivalRate, serviceShape, serviceScale);
+		LindleyQueueStatistics statistics(0.05, 2048);
+		queue.simulate(customersPerTrial, statistics);
+		return statistics;
+	},
+		[&](LindleySummary & accumulator, const LindleyQueueStatistics & statistics, int)
+	{
+		accumulator.pooled.merge(statistics);
+		accumulator.queueLength.add(statistics.timeAverageQueueLength());
+	}, 1);
+
+	std::cout << "Customers simulated : " << summary.pooled.customers << std::endl;
+	std::cout << "Overall Average Queue Length : " << summary.queueLength.mean() << " +-" << summary.queueLength.halfWidth() << std::endl;
+	std::cout << "Pollaczek-Khinchine Queue Length : " << pollaczekKhinchineQueueLength(arrivalRate, serviceShape, serviceScale) << std::endl;
+	std::cout << "Server Utilization : " << summary.pooled.utilization() << std::endl;
+	std::cout << "Average Wait : " << summary.pooled.meanWait() << std::endl;
+	std::cout << "Probability of No Wait : " << summary.pooled.probabilityOfNoWait() << std::endl;
+	std::cout << "Wait Quantiles (50%, 90%, 99%) : " << summary.pooled.waitQuantile(0.5) << ", "
+		<< summary.pooled.waitQuantile(0.9) << ", " << summary.pooled.waitQuantile(0.99) << std::endl;
+}
+
+enum class QueueEngine { Ticks, EventDriven, Lindley };
+
+struct EventDrivenTrial
+{
+	double sampledQueueLength;      //queue length seen at the end of every time unit, same estimator as the tick loop
+	double timeAverageQueueLength;  //queue length integrated over continuous time
+	long long customers;
+};
+
+/*
+	Event driven version of one tick loop trial over time units 0 .. T. Arrivals are a poisson process (exponential
+	gaps, same as a poisson count per unit with uniform offsets) and every customer is handled once, when they arrive:
+	FIFO with one server means their service start is known right away, so the line is never stored.
+
+	A customer waiting over [arrival, start) is in the line the tick loop sees at the end of the units
+	floor(arrival) .. floor(start) - 1, so the sampled estimator is the sum of floor(start) - floor(arrival) and the
+	continuous one the sum of start - arrival. Both are cut off at the end of the horizon.
+
+	With tickServiceStart the service start follows the tick loop exactly: it scans the line at the start of the unit,
+	so a customer can start at max(server free, start of the arrival unit), even a bit before they arrived. Without
+	it customers start at max(server free, arrival), the continuous time FIFO queue.
+*/
+EventDrivenTrial runEventDrivenTrial(VariateStream & gaps, VariateStream & services, int T, bool tickServiceStart)
+{
+	const double horizon = T + 1;
+
+	EventDrivenTrial result = { 0, 0, 0 };
+	double arrival = gaps.next();
+	double serverFree = 0;
+	double sampledSum = 0;
+	double integral = 0;
+
+	while (arrival < horizon)
+	{
+		double earliestStart = tickServiceStart ? floor(arrival) : arrival;
+		double start = std::max(serverFree, earliestStart);
+		serverFree = start + services.next();
+
+		double clippedStart = std::min(start, horizon);
+		sampledSum += floor(clippedStart) - floor(arrival);
+		integral += std::max(0.0, clippedStart - arrival);
+		result.customers++;
+
+		arrival += gaps.next();
+	}
+
+	result.sampledQueueLength = sampledSum / T;
+	result.timeAverageQueueLength = integral / horizon;
+	return result;
+}
+
 int main()
 {
 	//create and seed the generator
 	std::default_random_engine generator;
 	generator.seed(time(0));
 
-	std::gamma_distribution<double> serviceTimesGenerator(3, 0.25);
+	//gamma service times and uniform arrival offsets are pulled from batch filled buffers
+	VariateStream serviceTimesGenerator = VariateStream::gamma(mixStreamSeed(generator(), 0), 3, 0.25);
 	std::poisson_distribution<int> arrivalGenerator(1);
 
 	//since the range is inclusive, semi arbitrary max value set to avoid using rejection method
-	std::uniform_real_distribution<double> uniformDistributionGenerator(0.0, 1.0);
+	VariateStream uniformDistributionGenerator = VariateStream::uniform(mixStreamSeed(generator(), 1), 0.0, 1.0);
 
 	int numTrials = 100;
+
+	const QueueEngine queueEngine = QueueEngine::EventDriven;
+
+	//Lindley recursion instead of the tick loop, 10^7 customers per trial
+	if (queueEngine == QueueEngine::Lindley)
+	{
+		runLindleyEngine((unsigned int)generator(), numTrials, 10000000);
+		system("pause");
+		return 0;
+	}
+
+	//customer to customer instead of tick to tick, same horizon and trials as the tick loop
+	if (queueEngine == QueueEngine::EventDriven)
+	{
+		VariateStream arrivalGapGenerator = VariateStream::exponential(mixStreamSeed(generator(), 2), 1);
+		double overallSampled[2] = { 0, 0 };
+		double overallContinuous[2] = { 0, 0 };
+		long long customers = 0;
+
+		//tick loop service start first, then the continuous time FIFO queue
+		for (int discipline = 0; discipline < 2; discipline++)
+		{
+			for (int trial = 0; trial < numTrials; trial++)
+			{
+				EventDrivenTrial result = runEventDrivenTrial(arrivalGapGenerator, serviceTimesGenerator, 20000, discipline == 0);
+				overallSampled[discipline] += result.sampledQueueLength;
+				overallContinuous[discipline] += result.timeAverageQueueLength;
+				customers += result.customers;
+			}
+		}
+
+		std::cout << "Customers Served : " << customers << std::endl;
+		std::cout << "Overall Average Queue Length (tick service start, sampled per unit) : " << overallSampled[0] / numTrials << std::endl;
+		std::cout << "Overall Average Queue Length (tick service start, continuous time) : " << overallContinuous[0] / numTrials << std::endl;
+		std::cout << "Overall Average Queue Length (FIFO, sampled per unit) : " << overallSampled[1] / numTrials << std::endl;
+		std::cout << "Overall Average Queue Length (FIFO, continuous time) : " << overallContinuous[1] / numTrials << std::endl;
+		system("pause");
+		return 0;
+	}
+
 	double overallAverageQueueLength = 0;
 	
 	for (int trial = 0; trial < numTrials; trial++)
@@ -45,9 +201,9 @@ int main()
 			//for every arrival, use uniform distribution to determine exact time of arrival
 			for (int j = 0; j < arrivals; j++)
 			{
-				double arrivalTime = i + uniformDistributionGenerator(generator);
+				double arrivalTime = i + uniformDistributionGenerator.next();
 				//generate a service time at the same time as the arrival time, and insert into ordered map
-				line.insert(std::make_pair(arrivalTime, serviceTimesGenerator(generator)));
+				line.insert(std::make_pair(arrivalTime, serviceTimesGenerator.next()));
 			}
 
 			//try to service clients
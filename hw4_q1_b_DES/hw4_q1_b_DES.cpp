@@ -1,180 +1,743 @@
 /*
-	Output after 100 trials:
-	...
-	Total Time Spent with no bikes during trial 30.389
-	Total Time Spent with no bikes during trial 26.5569
-	Total Time Spent with no bikes during trial 28.264
-	Average amount of money over 100 iterations : 360.05
-	Average time spent with no bikes over 100 iterations : 28.8555
-	Average cost of dissatisfaction over 100 iterations : -93.7804 +-2.9717
-
-	Output after 10000 trials:
-	...
-	Total Time Spent with no bikes during trial 35.6788
-	Total Time Spent with no bikes during trial 28.8811
-	Total Time Spent with no bikes during trial 33.8833
-	Average amount of money over 10000 iterations : 361.017
-	Average time spent with no bikes over 10000 iterations : 29.0693
-	Average cost of dissatisfaction over 10000 iterations : -94.4752 +-0.296064
+	Usage:
+		hw4_q1_b_DES                                     synthetic trials of the homework's station
+		hw4_q1_b_DES --synthetic trips.csv stations      write a log of the homework's station at every station
+		hw4_q1_b_DES --convert trips.csv trips.trace     convert a "time,station,class" log (see TripTrace.h)
+		hw4_q1_b_DES --replay trips.trace [--from t] [--to t] [--stations 3,17,42]
+		                                                 replay recorded events instead of the synthetic clocks
+		hw4_q1_b_DES --compare 10 12 [trials]            the difference 12 bikes at the start make against 10, with
+		                                                 common random numbers and antithetic pairs (PairedComparison.h)
+		hw4_q1_b_DES --rare nobikes 60 [samples]         P(time with no bikes over [0, T] >= 60) by importance sampling
+		hw4_q1_b_DES --rare penalised 250 [samples]      and splitting, or of the members penalised (RareEvents.h)
+
+	Output of the default run, sequential stopping with the number of events of every type over [0, T] as control
+	variates (the exact values are 361.319 and 29.125, see BikeStationCTMC, less about 0.04 in time with no bikes for
+	the spell still open at T):
+	Starting the trials
+	Trials used : 2000 (precision targets met)
+	With the arrival counts as control variates :
+	money over 2000 observations : 361.372 +-0.237773 (without controls 362.214 +-1.53387, variance 41.615x lower)
+	time with no bikes over 2000 observations : 28.994 +-0.0738553 (without controls 28.8871 +-0.208856, variance 7.99709x lower)
+	cost of dissatisfaction over 2000 observations : -94.2307 +-0.24003 (without controls -93.8829 +-0.678783, variance 7.99709x lower)
+	Without them :
+	Average amount of money over 2000 iterations : 362.214
+	Average time spent with no bikes over 2000 iterations : 28.8871
+	Average cost of dissatisfaction over 2000 iterations : -93.8829 +-0.678783
+	Over 300 runs of 500 trials the controlled interval for money covered the exact value 95% of the time. With time
+	of day rates it takes 5000 trials (the time with no bikes depends less on the counts once the rates vary).
+
+	With useControlVariates = false the plain intervals have to meet the targets:
+	Starting the trials
+	Trials used : 10000 (precision targets met)
+	Average amount of money over 10000 iterations : 360.82
+	Average time spent with no bikes over 10000 iterations : 29.1092
+	Average cost of dissatisfaction over 10000 iterations : -94.6049 +-0.29888
+
+	With useTimeOfDay = true and useControlVariates = false (the same daily demand with rush hours, piecewise linear,
+	see RateProfile.h), inversion:
+	Trials used : 14000 (precision targets met)
+	Average amount of money over 14000 iterations : 353.366
+	Average time spent with no bikes over 14000 iterations : 28.7332
+	Average cost of dissatisfaction over 14000 iterations : -93.3828 +-0.298585
+	thinning gives the same within the intervals, rejects 6.3% of the candidates and takes about twice as long
+
+	Replay of a synthetic log of 20000 stations (--synthetic, 886 MB of CSV, 437 MB as a trace, 15 sec to convert):
+	Trace : 33604044 events at 20000 stations from 4.53648e-06 to 120
+	Replayed 33604044 events (0 of unknown classes skipped) in 0.681829 sec, 49.2851 million events/sec
+	Per station, cost of dissatisfaction is the penalties actually paid :
+	money over 20000 observations : 360.737 +-0.488268 (s = 35.2304)
+	time with no bikes over 20000 observations : 29.1491 +-0.0651256 (s = 4.69905)
+	cost of dissatisfaction over 20000 observations : -94.9564 +-0.248578 (s = 17.9358)
+
+	12 against 10 bikes at the start (--compare 10 12), the exact differences are 2.0625 and -0.25 (BikeStationCTMC):
+	Comparing 12 against 10 bikes at the start over 10000 trials
+	difference in money :
+	  independent streams : 1.25405 +-0.972677 over 10000 observations
+	  common random numbers : 2.05748 +-0.00883574 over 10000 observations, 12118.6x fewer runs
+	  common, antithetic pairs : 2.06215 +-0.00615561 over 10000 observations, 12484.3x fewer runs
+	difference in time with no bikes :
+	  independent streams : -0.231007 +-0.129483 over 10000 observations
+	  common random numbers : -0.249921 +-0.00344736 over 10000 observations, 1410.76x fewer runs
+	  common, antithetic pairs : -0.249203 +-0.00239076 over 10000 observations, 1466.65x fewer runs
+	50000 station runs in 3.49694 sec
+	With common streams the two stations only differ until the extra bikes are used up, so almost all of the noise
+	cancels; the antithetic pairs halve what is left but cost twice the runs, which about breaks even here.
+
+	Rare events (--rare, 100000 samples), far beyond what plain trials see. The time with no bikes here includes the
+	spell still open at T. The importance sampling tilts the rates apart while the station has bikes and while it is
+	empty, a single tilt of the four rates only reached a relative error of 0.26 for the first case:
+	P(time with no bikes over [0, 120] >= 60) from 10 bikes
+	  plain trials : 0, relative error inf (100000 observations, 5.53414 sec)
+	  tilted rates after 5 cross-entropy iterations, with bikes : 4.83629 3.70311 1.24214 4.95694, empty : 4.84816 2.99685 1.01083 4.01685
+	  importance sampling : 2.91658e-13, relative error 0.00972283 (100000 observations, 8.20065 sec)
+	  18 splitting levels of 5000 paths (log probability) : -24.7125 -23.2404 ... -3.32038 -1.8679 0
+	  splitting : 2.90257e-13, relative error 0.0288993 (20 observations, 64.4912 sec)
+	P(members penalised over [0, 120] >= 250) from 10 bikes
+	  plain trials : 0, relative error inf (100000 observations, 5.79072 sec)
+	  tilted rates after 4 cross-entropy iterations, with bikes : 5.26557 3.41475 1.13147 4.56088, empty : 5.25288 3.81297 1.2733 3.9934
+	  importance sampling : 3.41923e-09, relative error 0.00885924 (100000 observations, 7.94326 sec)
+	  13 splitting levels of 5000 paths (log probability) : -21.4939 -19.5659 ... -2.44317 -0.607588 0
+	  splitting : 3.54199e-09, relative error 0.0233204 (20 observations, 51.0965 sec)
+	At a threshold plain trials can check (time with no bikes >= 40) the three agree, 0.00907 (relative error 0.033),
+	0.00890 (0.0052) and 0.00893 (0.0082). About 116 members are penalised on average, so 50 is not a tail here.
 */
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <random>
-#include <map>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-double calculateSampleVariance(std::vector<double> & costValues, double globalMean)
+#include "../SimulationCommon/BatchVariates.h"
+#include "../SimulationCommon/ControlVariates.h"
+#include "../SimulationCommon/EventList.h"
+#include "../SimulationCommon/PairedComparison.h"
+#include "../SimulationCommon/RareEvents.h"
+#include "../SimulationCommon/RateProfile.h"
+#include "../SimulationCommon/ReplicationRunner.h"
+#include "../SimulationCommon/StreamingStatistics.h"
+#include "../SimulationCommon/TripTrace.h"
+
+//future event list backend, any of the lists in EventList.h can be swapped in here (see EventListBenchmark)
+typedef QuaternaryHeapEventList StationEventList;
+
+//what a single trial reports back to the reduction in main
+struct TrialResult
 {
-	double sampleVariance = 0;
-	for (auto cost : costValues)
+	double totalMoney;
+	double timeSpentWithNoBikes;
+	double rejectedShare; //of the arrival candidates, 0 unless the clocks thin
+	double arrivals[4];   //events of every type over [0, T], the control variates
+};
+
+//everything the trials are reduced into, the plain statistics and the outputs corrected with the arrival counts
+struct StationStatistics
+{
+	MetricSet metrics;
+	ControlVariateSet controlled;
+
+	void merge(const StationStatistics & other)
+	{
+		metrics.merge(other.metrics);
+		controlled.merge(other.controlled);
+	}
+};
+
+//outputs tracked over the trials, see reduceReplications in main
+enum TrialMetric { MoneyMetric, NoBikesMetric, CostMetric, RejectedMetric };
+
+//the station itself, driven by the synthetic clocks of a trial or by a recorded trace
+struct BikeStation
+{
+	explicit BikeStation(const double clientRates[4], int initialBikes = 10)
+	{
+		//we can assume total money starts at 0 + the deterministic annual prorated charge of clients classes 1 and 2
+		totalMoney = (0.5 * clientRates[1]) + (0.1 * clientRates[2]);
+		bikeCount = initialBikes; //we start with 10 bikes at X(0) unless a comparison says otherwise
+		timeSpentWithNoBikes = 0;
+		startOfNoBikes = -1;
+		penalties = 0;
+	}
+
+	//handle the event {0: Bike Arrival, 1: Class1, 2: Class2, 3: Class3)
+	void handle(int eventType, double eventTime, const double clientPenalty[4])
 	{
-		sampleVariance += pow(cost - globalMean, 2);
+		if (eventType == 0) //a bike has arrived
+		{
+			bikeCount++; //increment bike amount
+
+			//if was in state where no bikes, end the interval and record the delta
+			if (startOfNoBikes != -1)
+			{
+				timeSpentWithNoBikes += eventTime - startOfNoBikes; //record the time interval with no bikes
+				startOfNoBikes = -1; //set to -1 to indicate that we are not in a state of no bikes
+			}
+		}
+		else //a client has arrived
+		{
+			//if no more bikes, add to queue, else decrement bike count
+			if (bikeCount > 0)
+			{
+				//if eventType 3 gain $1.25
+				if (eventType == 3)
+				{
+					totalMoney += 1.25;
+				}
+				//decrement the bike count
+				bikeCount--;
+
+				//if no more bikes start the timer
+				if (bikeCount == 0)
+				{
+					startOfNoBikes = eventTime;
+				}
+			}
+			else
+			{
+				//we apply a penalty for waiting in line, for class3 penalty is 0
+				totalMoney += clientPenalty[eventType];
+				penalties += clientPenalty[eventType];
+			}
+		}
 	}
 
-	sampleVariance = sampleVariance / (costValues.size() - 1);
+	double totalMoney;
+	int bikeCount;
+	double timeSpentWithNoBikes;
+	double startOfNoBikes;
+	double penalties;
+};
+
+//one trial of the station over [0, T], the arrivals of event type k come from the stream streams.eventClassSeed(k)
+TrialResult simulateStation(const std::vector<RateProfile> & profiles, const TrialStreams & streams, ArrivalMethod arrivalMethod,
+	int initialBikes, double T, const double clientRates[4], const double clientPenalty[4])
+{
+	//poisson with the rate of its profile, every clock pulls from its own batch filled buffers
+	std::vector<ProfileArrivalClock> clocks;
+	clocks.reserve(profiles.size());
+	for (size_t type = 0; type < profiles.size(); type++) clocks.emplace_back(profiles[type], streams.eventClassSeed(type), arrivalMethod, streams.variates);
+
+	BikeStation station(clientRates, initialBikes);
+
+	//events
+	StationEventList events; //holds arrival time, type, ties come out in scheduling order
+
+	//generate first set of events
+	for (size_t type = 0; type < clocks.size(); type++) events.push(clocks[type].next(0), (int)type);
+
+	TrialResult result = {};
+
+	//while the next event is <= T
+	while (events.top().time <= T)
+	{
+		//consume the event {0: Bike Arrival, 1: Class1, 2: Class2, 3: Class3)
+		FutureEvent event = events.pop();
+		result.arrivals[event.type]++;
+
+		//generate the next event
+		events.push(clocks[event.type].next(event.time), event.type);
 
-	sampleVariance = sqrt(sampleVariance);
+		//handle the current event
+		station.handle(event.type, event.time, clientPenalty);
+	}
 
-	return sampleVariance;
+	double candidates = 0, rejected = 0;
+	for (const ProfileArrivalClock & clock : clocks)
+	{
+		candidates += (double)clock.candidates;
+		rejected += (double)clock.rejected;
+	}
+	result.totalMoney = station.totalMoney;
+	result.timeSpentWithNoBikes = station.timeSpentWithNoBikes;
+	result.rejectedShare = candidates > 0 ? rejected / candidates : 0;
+	return result;
 }
 
-int main()
+//the five runs of a comparison trial
+struct ComparisonTrial
 {
-	const int T = 120;
-	const double bikeArrivalRate = 6;
-	//clients have rate r1 = 3, r2 = 1, r3 = 4
-	const double clientRates[4] = { 0, 3.0, 1.0, 4.0 };
+	TrialResult first;      //first configuration
+	TrialResult unrelated;  //second configuration on unrelated streams
+	TrialResult second;     //second configuration on the streams of first
+	TrialResult firstTwin;  //both again on the antithetic twin of those streams
+	TrialResult secondTwin;
+};
+
+//initial bikes firstBikes against secondBikes under the three pairing schemes of PairedComparison.h
+int compareInitialBikes(int firstBikes, int secondBikes, int numberOfComparisons, unsigned int baseSeed, const std::vector<RateProfile> & profiles,
+	ArrivalMethod arrivalMethod, double T, const double clientRates[4], const double clientPenalty[4])
+{
+	std::cout << "Comparing " << secondBikes << " against " << firstBikes << " bikes at the start over " << numberOfComparisons << " trials" << std::endl;
 
-	//client class 1/2 pay annually (K1 = 0.5, k2 = .1), total amount is (K1*r1 + K2*r2)
-	//class 3 pays per ride amount k3 = 1.25
+	auto start = std::chrono::steady_clock::now();
+	const PairedComparison emptyComparison = { "money", "time with no bikes" };
+	PairedComparison comparison = reduceReplications(numberOfComparisons, baseSeed, emptyComparison,
+		[&](std::default_random_engine & generator, int)
+	{
+		TrialStreams streams{ drawStreamSeed(generator), ClockVariates::Inversion };
+		TrialStreams unrelated{ drawStreamSeed(generator), ClockVariates::Inversion };
+		return ComparisonTrial{
+			simulateStation(profiles, streams, arrivalMethod, firstBikes, T, clientRates, clientPenalty),
+			simulateStation(profiles, unrelated, arrivalMethod, secondBikes, T, clientRates, clientPenalty),
+			simulateStation(profiles, streams, arrivalMethod, secondBikes, T, clientRates, clientPenalty),
+			simulateStation(profiles, streams.antitheticTwin(), arrivalMethod, firstBikes, T, clientRates, clientPenalty),
+			simulateStation(profiles, streams.antitheticTwin(), arrivalMethod, secondBikes, T, clientRates, clientPenalty)
+		};
+	},
+		[](PairedComparison & comparison, const ComparisonTrial & trial, int)
+	{
+		const TrialResult & first = trial.first;
+		const TrialResult & unrelated = trial.unrelated;
+		const TrialResult & second = trial.second;
+		const TrialResult & firstTwin = trial.firstTwin;
+		const TrialResult & secondTwin = trial.secondTwin;
+		comparison.add(PairingScheme::Independent, 0, unrelated.totalMoney - first.totalMoney);
+		comparison.add(PairingScheme::Independent, 1, unrelated.timeSpentWithNoBikes - first.timeSpentWithNoBikes);
+		comparison.add(PairingScheme::Common, 0, second.totalMoney - first.totalMoney);
+		comparison.add(PairingScheme::Common, 1, second.timeSpentWithNoBikes - first.timeSpentWithNoBikes);
+		comparison.add(PairingScheme::CommonAntithetic, 0,
+			0.5 * ((second.totalMoney - first.totalMoney) + (secondTwin.totalMoney - firstTwin.totalMoney)));
+		comparison.add(PairingScheme::CommonAntithetic, 1,
+			0.5 * ((second.timeSpentWithNoBikes - first.timeSpentWithNoBikes) + (secondTwin.timeSpentWithNoBikes - firstTwin.timeSpentWithNoBikes)));
+	});
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	comparison.print(std::cout);
+	std::cout << 5 * numberOfComparisons << " station runs in " << seconds << " sec" << std::endl;
+	return 0;
+}
 
-	//when annual members (class 1/2) arrive at empty station, there is penalty c1 = 1.0, c2 = 0.25, c3 = 0
-	const double clientPenalty[4] = { 0, -1.0, -0.25, 0 };
+//what a rare event estimate is about, the time with no bikes or the members (class 1/2) penalised over [0, T]
+enum class OutageMeasure { TimeWithNoBikes, PenalisedMembers };
 
-	//create and seed the generator
-	std::default_random_engine generator;
-	generator.seed(time(0));
+//the state of the homework's station the rare event estimators carry, and clone when splitting; the arrivals are
+//poisson so the clocks need no state, a clone draws its next events afresh
+struct OutagePath
+{
+	double time;
+	int bikes;
+	double timeWithNoBikes; //including the spell still open, up to time
+	double penalisedMembers;
 
-	//poisson
-	std::exponential_distribution<double> bikeClock(bikeArrivalRate);
-	std::exponential_distribution<double> type1Clock(clientRates[1]);
-	std::exponential_distribution<double> type2Clock(clientRates[2]);
-	std::exponential_distribution<double> type3Clock(clientRates[3]);
+	double measure(OutageMeasure which) const { return which == OutageMeasure::TimeWithNoBikes ? timeWithNoBikes : penalisedMembers; }
+};
 
-	const int numberOfTrials = 100;
-	double averageMoneyAmount = 0;
-	unsigned long numberOfEvents = 0;
+//moves path to its next arrival, or to T, and returns false once it is at T. rates holds the 4 event types while the
+//station has bikes, then the 4 while it is empty (the importance sampling tilts them apart); counts gets the arrival
+bool stepOutagePath(OutagePath & path, const double rates[8], double T, CompactRandomStream & random, double counts[8])
+{
+	int regime = path.bikes == 0 ? 4 : 0;
+	const double * regimeRates = rates + regime;
+	double totalRate = regimeRates[0] + regimeRates[1] + regimeRates[2] + regimeRates[3];
+	double eventTime = path.time + random.exponential(totalRate);
+	double end = std::min(eventTime, T);
+	if (path.bikes == 0) path.timeWithNoBikes += end - path.time;
+	path.time = end;
+	if (eventTime >= T) return false;
+
+	//superposed arrivals, the type is drawn in proportion to the rates
+	double pick = random.uniform() * totalRate;
+	int eventType = 0;
+	while (eventType < 3 && pick >= regimeRates[eventType])
+	{
+		pick -= regimeRates[eventType];
+		eventType++;
+	}
+	counts[regime + eventType]++;
 
-	double averageCostOfDissatisfaction = 0;
-	double averageTimeWithNoBikes = 0;
+	if (eventType == 0) path.bikes++;
+	else if (path.bikes > 0) path.bikes--;
+	else if (eventType != 3) path.penalisedMembers++;
+	return true;
+}
 
-	std::vector<double> costValues;
+/*
+	Importance of a path for the splitting, the log of a normal approximation of the probability that the measure
+	still reaches the threshold: the measure only grows while the station is empty, which takes about bikes / drain
+	more time, and after that it gains mean +- spread^2 per unit time (fitted from the plain trials). 0 once the
+	threshold is reached, which is the target of the splitting. The log probability only falls as the score z of
+	what is still missing rises, so paths are compared on z and a level is turned into its z once.
+*/
+struct OutageImportance
+{
+	OutageMeasure which;
+	double threshold;
+	double T;
+	double mean;
+	double spread;
+	double drain; //clients - bikes per unit time
+
+	double score(const OutagePath & path) const
+	{
+		double missing = threshold - path.measure(which);
+		if (missing <= 0) return -INFINITY;
+		double remaining = T - path.time - (drain > 0 ? path.bikes / drain : 0);
+		if (remaining <= 0) return INFINITY;
+		return (missing - mean * remaining) / (spread * sqrt(remaining));
+	}
 
-	std::cout << "Starting the trials" << std::endl;
+	//log of the normal tail beyond z, its asymptotic series where erfc underflows
+	static double logTail(double z)
+	{
+		if (z == -INFINITY) return 0;
+		if (z < 5) return log(0.5 * erfc(z / sqrt(2.0)));
+		return -0.5 * z * z - log(z * 2.5066282746310002) + log(1 - 1 / (z * z));
+	}
 
-	for (int t = 0; t < numberOfTrials; t++)
+	//the score at which the importance is level, by bisection
+	static double scoreAt(double level)
 	{
-		//we can assume total money starts at 0 + the deterministic annual prorated charge of clients classes 1 and 2
-		double totalMoney = (0.5 * clientRates[1]) + (0.1 * clientRates[2]);
-		int bikeCount = 10; //we start with 10 bikes at X(0)
+		if (level >= 0) return -INFINITY;
+		double low = -40, high = 1e4;
+		for (int i = 0; i < 100; i++)
+		{
+			double middle = 0.5 * (low + high);
+			if (logTail(middle) >= level) low = middle;
+			else high = middle;
+		}
+		return high;
+	}
+
+	double operator()(const OutagePath & path) const { return logTail(score(path)); }
+};
+
+//P(measure over [0, T] >= threshold) by plain trials, importance sampling with a cross-entropy tilt and fixed effort
+//splitting (RareEvents.h), each with its relative error
+int estimateRareOutage(OutageMeasure which, double threshold, int samples, unsigned int baseSeed, int initialBikes, double T,
+	double bikeArrivalRate, const double clientRates[4])
+{
+	//the homework's rates in both regimes
+	const std::vector<double> nominal = { bikeArrivalRate, clientRates[1], clientRates[2], clientRates[3],
+		bikeArrivalRate, clientRates[1], clientRates[2], clientRates[3] };
+	const OutagePath start = { 0, initialBikes, 0, 0 };
+	const char * measureName = which == OutageMeasure::TimeWithNoBikes ? "time with no bikes" : "members penalised";
+	std::cout << "P(" << measureName << " over [0, " << T << "] >= " << threshold << ") from " << initialBikes << " bikes" << std::endl;
+
+	//one whole trial at the given rates, its measure; a rate applies while the station is in its regime
+	auto simulate = [&](const double * rates, CompactRandomStream & random, double * counts, double * exposure)
+	{
+		OutagePath path = start;
+		std::fill(counts, counts + 8, 0.0);
+		while (stepOutagePath(path, rates, T, random, counts)) {}
+		for (int eventType = 0; eventType < 4; eventType++)
+		{
+			exposure[eventType] = T - path.timeWithNoBikes;
+			exposure[4 + eventType] = path.timeWithNoBikes;
+		}
+		return path.measure(which);
+	};
+	auto report = [](const char * method, const RunningMoments & estimates, double seconds)
+	{
+		double relativeError = estimates.mean() > 0 ? estimates.standardError() / estimates.mean() : INFINITY;
+		std::cout << "  " << method << " : " << estimates.mean() << ", relative error " << relativeError
+			<< " (" << estimates.count() << " observations, " << seconds << " sec)" << std::endl;
+	};
+
+	//plain trials, an estimate only once some of them hit; the moments of the measure shape the importance function
+	auto begin = std::chrono::steady_clock::now();
+	const MetricSet emptyPlain = { "hit", "measure" };
+	MetricSet plain = reduceReplications(samples, baseSeed, emptyPlain,
+		[&](std::default_random_engine & generator, int)
+	{
+		CompactRandomStream random(drawStreamSeed(generator));
+		double counts[8], exposure[8];
+		return simulate(nominal.data(), random, counts, exposure);
+	},
+		[&](MetricSet & metrics, double measure, int)
+	{
+		metrics.add(0, measure >= threshold ? 1.0 : 0.0);
+		metrics.add(1, measure);
+	});
+	report("plain trials", plain[0], std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+
+	//importance sampling, the tilt is fitted on its own stream and the weighted trials are independent of it
+	const int crossEntropySamples = 10000;
+	const double rho = 0.1;
+	begin = std::chrono::steady_clock::now();
+	std::vector<double> tilted;
+	int iterations = crossEntropyTilt(nominal, threshold, crossEntropySamples, rho, mixStreamSeed(baseSeed, 1), simulate, tilted);
+	RunningMoments weighted = reduceReplications(samples, baseSeed ^ 0x5DEECE66Du, RunningMoments(),
+		[&](std::default_random_engine & generator, int)
+	{
+		CompactRandomStream random(drawStreamSeed(generator));
+		double counts[8], exposure[8];
+		if (simulate(tilted.data(), random, counts, exposure) < threshold) return 0.0;
+		return exp(poissonLogLikelihoodRatio(nominal.data(), tilted.data(), counts, exposure, 8));
+	},
+		[](RunningMoments & moments, double weight, int) { moments.add(weight); });
+	std::cout << "  tilted rates after " << iterations << " cross-entropy iterations, with bikes : " << tilted[0] << " " << tilted[1]
+		<< " " << tilted[2] << " " << tilted[3] << ", empty : " << tilted[4] << " " << tilted[5] << " " << tilted[6] << " " << tilted[7] << std::endl;
+	report("importance sampling", weighted, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+
+	//fixed effort splitting on the bike count trajectory; independent repetitions of the whole estimator give an
+	//honest relative error
+	const int repetitions = 20;
+	const int effort = std::max(100, samples / 20);
+	const double passFraction = 0.2;
+	begin = std::chrono::steady_clock::now();
+	const OutageImportance importance = { which, threshold, T, plain[1].mean() / T, plain[1].standardDeviation() / sqrt(T),
+		clientRates[1] + clientRates[2] + clientRates[3] - bikeArrivalRate };
+	auto advance = [&](OutagePath & path, double level, CompactRandomStream & random)
+	{
+		double counts[8];
+		double levelScore = OutageImportance::scoreAt(level);
+		double lowest = importance.score(path);
+		while (lowest > levelScore)
+		{
+			bool moving = stepOutagePath(path, nominal.data(), T, random, counts);
+			double current = importance.score(path);
+			if (current <= levelScore) return std::max(level, OutageImportance::logTail(current));
+			lowest = std::min(lowest, current);
+			if (!moving) break;
+		}
+		return OutageImportance::logTail(lowest);
+	};
+	std::vector<double> levels = placeSplittingLevels(start, importance(start), 0.0, effort, passFraction, mixStreamSeed(baseSeed, 2), advance);
+	RunningMoments split = reduceReplications(repetitions, baseSeed ^ 0x2545F491u, RunningMoments(),
+		[&](std::default_random_engine & generator, int)
+	{
+		return fixedEffortSplitting(start, levels, effort, drawStreamSeed(generator), advance);
+	},
+		[](RunningMoments & moments, double estimate, int) { moments.add(estimate); }, 1);
+	std::cout << "  " << levels.size() << " splitting levels of " << effort << " paths (log probability) :";
+	for (double level : levels) std::cout << " " << level;
+	std::cout << std::endl;
+	report("splitting", split, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+	return 0;
+}
 
-		double timeSpentWithNoBikes = 0;
-		double startOfNoBikes = -1;
+//a log of the homework's station repeated at every one of stations stations over (0, T], "time,station,class" rows in
+//time order, for checking the replay against the synthetic trials
+bool writeSyntheticTrips(const char * path, int stations, double T, double bikeArrivalRate, const double clientRates[4], unsigned int seed)
+{
+	FILE * out = fopen(path, "w");
+	if (!out) return false;
 
-		//events
-		std::map<double, int> events; //holds arrival time, type
+	const double rates[4] = { bikeArrivalRate, clientRates[1], clientRates[2], clientRates[3] };
+	std::vector<TripEvent> rows;
+	for (int s = 0; s < stations; s++)
+	{
+		for (int type = 0; type < 4; type++)
+		{
+			VariateStream clock = VariateStream::exponential(mixStreamSeed(seed, s, type), rates[type]);
+			for (double time = clock.next(); time <= T; time += clock.next()) rows.push_back(TripEvent{ time, (uint32_t)s, type });
+		}
+	}
+	std::stable_sort(rows.begin(), rows.end(), [](const TripEvent & a, const TripEvent & b) { return a.time < b.time; });
 
-		//generate first set of events
-		events.insert(std::make_pair(bikeClock(generator), 0));
-		events.insert(std::make_pair(type1Clock(generator), 1));
-		events.insert(std::make_pair(type2Clock(generator), 2));
-		events.insert(std::make_pair(type3Clock(generator), 3));
+	fprintf(out, "time,station,class\n");
+	for (const TripEvent & row : rows) fprintf(out, "%.17g,%u,%d\n", row.time, row.station, row.eventClass);
+	return fclose(out) == 0;
+}
 
-		//while the next event is <= T
-		while (events.begin()->first <= T)
+//replays the events of [from, to) through a BikeStation per station of the trace (or of the filter), every station
+//starting like the homework's at from, and prints the averages over the stations that saw an event
+int replayTrace(const char * tracePath, double from, double to, const std::vector<char> * stationFilter, const double clientRates[4], const double clientPenalty[4])
+{
+	TripTrace trace;
+	if (!trace.open(tracePath))
+	{
+		std::cout << "Could not load " << tracePath << std::endl;
+		return 1;
+	}
+	std::cout << "Trace : " << trace.rowCount() << " events at " << trace.stationCount() << " stations from "
+		<< trace.firstTime() << " to " << trace.lastTime() << std::endl;
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<BikeStation> stations(trace.stationCount(), BikeStation(clientRates));
+	std::vector<char> seen(trace.stationCount(), 0);
+	unsigned long long replayed = 0, skipped = 0;
+	TripTraceCursor cursor(trace, from, to, stationFilter);
+	TripEvent event;
+	while (cursor.next(event))
+	{
+		//classes the station model doesn't know are left out
+		if (event.eventClass > 3)
 		{
-			//{0: Bike Arrival, 1: Class1, 2: Class2, 3: Class3)
-			int eventType = events.begin()->second;
-			double eventTime = events.begin()->first;
+			skipped++;
+			continue;
+		}
+		stations[event.station].handle(event.eventClass, event.time, clientPenalty);
+		seen[event.station] = 1;
+		replayed++;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-			//consume the event
-			events.erase(events.begin());
+	const MetricSet emptyStatistics = { "money", "time with no bikes", "cost of dissatisfaction" };
+	MetricSet statistics = emptyStatistics;
+	for (size_t s = 0; s < stations.size(); s++)
+	{
+		if (!seen[s]) continue;
+		statistics.add(MoneyMetric, stations[s].totalMoney);
+		statistics.add(NoBikesMetric, stations[s].timeSpentWithNoBikes);
+		statistics.add(CostMetric, stations[s].penalties);
+	}
+	std::cout << "Replayed " << replayed << " events (" << skipped << " of unknown classes skipped) in " << seconds << " sec, "
+		<< replayed / seconds / 1e6 << " million events/sec" << std::endl;
+	std::cout << "Per station, cost of dissatisfaction is the penalties actually paid :" << std::endl;
+	statistics.printConfidenceIntervals(std::cout);
+	return 0;
+}
 
-			//generate the next event
-			if (eventType == 0) events.insert(std::make_pair(eventTime + bikeClock(generator), 0));
-			else if (eventType == 1) events.insert(std::make_pair(eventTime + type1Clock(generator), 1));
-			else if (eventType == 2) events.insert(std::make_pair(eventTime + type2Clock(generator), 2));
-			else if (eventType == 3) events.insert(std::make_pair(eventTime + type3Clock(generator), 3));
+int main(int argc, char * argv[])
+{
+	const int T = 120;
+	const double bikeArrivalRate = 6;
+	//clients have rate r1 = 3, r2 = 1, r3 = 4
+	const double clientRates[4] = { 0, 3.0, 1.0, 4.0 };
 
-			//handle the current event
-			if (eventType == 0) //a bike has arrived
-			{
-				bikeCount++; //increment bike amount
-			
-				//if was in state where no bikes, end the interval and record the delta
-				if (startOfNoBikes != -1)
-				{
-					timeSpentWithNoBikes += eventTime - startOfNoBikes; //record the time interval with no bikes
-					startOfNoBikes = -1; //set to -1 to indicate that we are not in a state of no bikes
-				}
-			}
-			else //a client has arrived
+	//client class 1/2 pay annually (K1 = 0.5, k2 = .1), total amount is (K1*r1 + K2*r2)
+	//class 3 pays per ride amount k3 = 1.25
+
+	//when annual members (class 1/2) arrive at empty station, there is penalty c1 = 1.0, c2 = 0.25, c3 = 0
+	const double clientPenalty[4] = { 0, -1.0, -0.25, 0 };
+
+	//time of day rates: off keeps the homework's constant rates, on spreads the same daily demand over days of 24 time
+	//units, bikes and annual members with the rush hours and pay per ride riders around midday (see RateProfile.h)
+	const bool useTimeOfDay = false;
+	const RateProfile::Shape profileShape = RateProfile::Shape::PiecewiseLinear;
+	//exact inversion of the integrated rate, or thinning against the piecewise constant majorant
+	const ArrivalMethod arrivalMethod = ArrivalMethod::Inversion;
+
+	//rate profile of every event type {0: Bike Arrival, 1: Class1, 2: Class2, 3: Class3}
+	std::vector<RateProfile> profiles;
+	profiles.push_back(useTimeOfDay ? rushHourShape(profileShape).scaled(bikeArrivalRate) : RateProfile::constant(bikeArrivalRate));
+	profiles.push_back(useTimeOfDay ? rushHourShape(profileShape).scaled(clientRates[1]) : RateProfile::constant(clientRates[1]));
+	profiles.push_back(useTimeOfDay ? rushHourShape(profileShape).scaled(clientRates[2]) : RateProfile::constant(clientRates[2]));
+	profiles.push_back(useTimeOfDay ? middayShape(profileShape).scaled(clientRates[3]) : RateProfile::constant(clientRates[3]));
+
+	//the base seed, every trial derives its own generator from it (see ReplicationRunner.h)
+	const unsigned int baseSeed = (unsigned int)time(0);
+
+	//trace driven input instead of the synthetic clocks, see the usage at the top
+	if (argc >= 4 && strcmp(argv[1], "--synthetic") == 0)
+	{
+		bool written = writeSyntheticTrips(argv[2], atoi(argv[3]), T, bikeArrivalRate, clientRates, baseSeed);
+		std::cout << (written ? "Wrote " : "Could not write ") << argv[2] << std::endl;
+		return written ? 0 : 1;
+	}
+	else if (argc >= 4 && strcmp(argv[1], "--convert") == 0)
+	{
+		bool converted = convertTripCsv(argv[2], argv[3]);
+		std::cout << (converted ? "Converted " : "Could not convert ") << argv[2] << " to " << argv[3] << std::endl;
+		return converted ? 0 : 1;
+	}
+	else if (argc >= 3 && strcmp(argv[1], "--replay") == 0)
+	{
+		double from = -INFINITY, to = INFINITY;
+		std::vector<char> stationFilter;
+		for (int a = 3; a + 1 < argc; a += 2)
+		{
+			if (strcmp(argv[a], "--from") == 0) from = atof(argv[a + 1]);
+			else if (strcmp(argv[a], "--to") == 0) to = atof(argv[a + 1]);
+			else if (strcmp(argv[a], "--stations") == 0)
 			{
-				//if no more bikes, add to queue, else decrement bike count
-				if (bikeCount > 0)
+				//comma separated ids
+				char * id = argv[a + 1];
+				while (*id)
 				{
-					//if eventType 3 gain $1.25
-					if (eventType == 3)
-					{
-						totalMoney += 1.25;
-					}
-					//decrement the bike count
-					bikeCount--;
-
-					//if no more bikes start the timer
-					if (bikeCount == 0)
-					{
-						startOfNoBikes = eventTime;
-					}
-				}
-				else
-				{
-					//we apply a penalty for waiting in line, for class3 penalty is 0
-					totalMoney += clientPenalty[eventType];
+					char * end;
+					unsigned long station = strtoul(id, &end, 10);
+					if (end == id) break;
+					if (station >= stationFilter.size()) stationFilter.resize(station + 1, 0);
+					stationFilter[station] = 1;
+					id = *end == ',' ? end + 1 : end;
 				}
 			}
 		}
+		return replayTrace(argv[2], from, to, stationFilter.empty() ? NULL : &stationFilter, clientRates, clientPenalty);
+	}
+	else if (argc >= 4 && strcmp(argv[1], "--compare") == 0)
+	{
+		int numberOfComparisons = argc >= 5 ? atoi(argv[4]) : 10000;
+		return compareInitialBikes(atoi(argv[2]), atoi(argv[3]), numberOfComparisons, baseSeed, profiles, arrivalMethod, T, clientRates, clientPenalty);
+	}
+	else if (argc >= 4 && strcmp(argv[1], "--rare") == 0)
+	{
+		//the homework's constant rates whatever useTimeOfDay says, the likelihood ratios assume homogeneous arrivals
+		OutageMeasure which = strcmp(argv[2], "penalised") == 0 ? OutageMeasure::PenalisedMembers : OutageMeasure::TimeWithNoBikes;
+		int samples = argc >= 5 ? atoi(argv[4]) : 100000;
+		return estimateRareOutage(which, atof(argv[3]), samples, baseSeed, 10, T, bikeArrivalRate, clientRates);
+	}
+
+	//with sequential stopping numberOfTrials is only the upper limit, trials are added in batches until every metric
+	//meets its precision target (see reduceReplicationsUntil and PrecisionTarget)
+	const bool useSequentialStopping = true;
+	const int pilotTrials = 1000;
+	const int batchTrials = 1000;
+	//control variates: the arrivals of every event type over [0, T] have known means (the integrated rates), the
+	//outputs are corrected through their correlation with them and the stopping rule uses the corrected intervals
+	const bool useControlVariates = true;
+	std::vector<double> arrivalMeans;
+	for (const RateProfile & profile : profiles) arrivalMeans.push_back(profile.cumulative(T) - profile.cumulative(0));
+
+	const PrecisionTarget precisionTargets[4] = {
+		relativePrecision(0.002), //money within 0.2%
+		absolutePrecision(0.1),   //time with no bikes within 0.1
+		absolutePrecision(0.3),   //cost of dissatisfaction within 0.3
+		absolutePrecision(0.001)  //share of rejected candidates within 0.1 percentage points
+	};
+	double z = 1.96;
 
-		//std::cout << "Total Money at the end of experiment " << totalMoney << std::endl;
-		averageMoneyAmount += totalMoney;
+	const int numberOfTrials = 100000;
 
-		//record the cost for sample variance calculation
-		costValues.push_back((timeSpentWithNoBikes * clientRates[1] * clientPenalty[1]) + (timeSpentWithNoBikes * clientRates[2] * clientPenalty[2]));
+	std::cout << "Starting the trials" << std::endl;
+
+	auto simulateTrial = [&](std::default_random_engine & generator, int)
+	{
+		//every clock pulls from its own batch filled buffers seeded from the trial generator
+		TrialStreams streams{ drawStreamSeed(generator), ClockVariates::Ziggurat };
+		return simulateStation(profiles, streams, arrivalMethod, 10, T, clientRates, clientPenalty);
+	};
+
+	//every trial is folded into its block's statistics as soon as it is done, the blocks are spread over all cores
+	//and merged in order, so memory stays constant no matter how many trials we run
+	const StationStatistics emptyStatistics = {
+		MetricSet{ "money", "time with no bikes", "cost of dissatisfaction", "rejected candidates" },
+		ControlVariateSet({ "money", "time with no bikes", "cost of dissatisfaction" }, arrivalMeans)
+	};
+	auto recordTrial = [&](StationStatistics & statistics, const TrialResult & result, int)
+	{
+		//std::cout << "Total Time Spent with no bikes during trial " << result.timeSpentWithNoBikes << std::endl;
+		double cost = (result.timeSpentWithNoBikes * clientRates[1] * clientPenalty[1]) + (result.timeSpentWithNoBikes * clientRates[2] * clientPenalty[2]);
+		statistics.metrics.add(MoneyMetric, result.totalMoney);
+		statistics.metrics.add(NoBikesMetric, result.timeSpentWithNoBikes);
+		statistics.metrics.add(CostMetric, cost);
+		statistics.metrics.add(RejectedMetric, result.rejectedShare);
+
+		const double responses[3] = { result.totalMoney, result.timeSpentWithNoBikes, cost };
+		statistics.controlled.add(responses, result.arrivals);
+	};
+
+	auto reduceTrialRange = [&](int firstTrial, int trialCount)
+	{
+		return reduceReplicationRange(firstTrial, trialCount, baseSeed, emptyStatistics, simulateTrial, recordTrial);
+	};
 
-		//record for global mean calculation [further down]
-		std::cout << "Total Time Spent with no bikes during trial " << timeSpentWithNoBikes << std::endl;
-		averageTimeWithNoBikes += timeSpentWithNoBikes;
+	int trialsUsed = numberOfTrials;
+	StationStatistics results = useSequentialStopping ?
+		reduceReplicationsUntil(emptyStatistics, reduceTrialRange,
+			[&](const StationStatistics & current)
+	{
+		//the rejected share is no response of the control variates, its plain interval has to meet its target either way
+		return useControlVariates ?
+			current.controlled.meetsPrecision(precisionTargets, z) && meetsPrecision(current.metrics[RejectedMetric], precisionTargets[RejectedMetric], z) :
+			current.metrics.meetsPrecision(precisionTargets, z);
+	},
+			pilotTrials, batchTrials, numberOfTrials, trialsUsed) :
+		reduceTrialRange(0, numberOfTrials);
+	const MetricSet & statistics = results.metrics;
+
+	std::cout << "Trials used : " << trialsUsed << (trialsUsed < numberOfTrials ? " (precision targets met)" : "") << std::endl;
+
+	if (useControlVariates)
+	{
+		std::cout << "With the arrival counts as control variates :" << std::endl;
+		results.controlled.printConfidenceIntervals(std::cout, z);
+		std::cout << "Without them :" << std::endl;
 	}
 
-	std::cout << "Average amount of money over " << numberOfTrials << " iterations" << " : "
-		<< (averageMoneyAmount / numberOfTrials) << std::endl;
+	std::cout << "Average amount of money over " << trialsUsed << " iterations" << " : "
+		<< statistics[MoneyMetric].mean() << std::endl;
 
 	/*std::cout << "Average amount of events over " << numberOfTrials << " iterations" << " : "
 		<< (numberOfEvents / numberOfTrials) << std::endl;*/
 
-	std::cout << "Average time spent with no bikes over " << numberOfTrials << " iterations" << " : "
-		<< (averageTimeWithNoBikes / numberOfTrials) << std::endl;
+	std::cout << "Average time spent with no bikes over " << trialsUsed << " iterations" << " : "
+		<< statistics[NoBikesMetric].mean() << std::endl;
 
-	double globalMeanOfCost = (((averageTimeWithNoBikes / numberOfTrials) * clientRates[1] * clientPenalty[1]) + ((averageTimeWithNoBikes / numberOfTrials) * clientRates[2] * clientPenalty[2]));
+	std::cout << "Average cost of dissatisfaction over " << trialsUsed << " iterations" << " : "
+		<< statistics[CostMetric].mean() << " +-" << statistics[CostMetric].halfWidth(z) << std::endl;
 
-	double sampleVariance = calculateSampleVariance(costValues, globalMeanOfCost);
-
-	double z = 1.96;
-
-	double CI = z * (sampleVariance / sqrt(costValues.size()));
-
-	std::cout << "Average cost of dissatisfaction over " << numberOfTrials << " iterations" << " : "
-		<< globalMeanOfCost << " +-" << CI << std::endl;
+	if (arrivalMethod == ArrivalMethod::Thinning)
+	{
+		std::cout << "Rejected arrival candidates : " << 100 * statistics[RejectedMetric].mean() << "%" << std::endl;
+	}
 
 	std::getchar();
 
@@ -16,71 +16,456 @@
 	Average amount of money over 10000 iterations : 361.833
 	Average time spent with no bikes over 10000 iterations : 29.0333
 	Average cost of dissatisfaction over 10000 iterations : -94.3581 +-0.299109
+
+	With useTimeOfDay = true (the same daily demand with rush hours, piecewise linear, see RateProfile.h):
+	Thinning keeps 87.2986% of the candidates
+	Trials used : 14000 (precision targets met)
+	Average amount of money over 14000 iterations : 353.821
+	Average time spent with no bikes over 14000 iterations : 28.8322
+	Average cost of dissatisfaction over 14000 iterations : -93.7047 +-0.296906
+
+	With useControlVariates = true (ArrivalControl, the exact values are 361.319 and 29.125, see BikeStationCTMC):
+	Trials used : 2000 (precision targets met)
+	With the arrival counts as control variates :
+	money over 2000 observations : 361.374 +-0.236479 (without controls 361.291 +-1.56464, variance 43.7769x lower)
+	time with no bikes over 2000 observations : 29.125 +-0.074836 (without controls 29.146 +-0.204555, variance 7.47137x lower)
+	cost of dissatisfaction over 2000 observations : -94.6562 +-0.243217 (without controls -94.7245 +-0.664805, variance 7.47137x lower)
 */
 
 #include <iostream>
 #include <random>
 #include <queue>
+#include <vector>
+#include <algorithm>
+#include <math.h>
 #include <time.h>
 #include <set>
 
-double calculateSampleVariance(std::vector<double> & costValues, double globalMean)
+#include "../SimulationCommon/BatchVariates.h"
+#include "../SimulationCommon/ControlVariates.h"
+#include "../SimulationCommon/RateProfile.h"
+#include "../SimulationCommon/ReplicationRunner.h"
+#include "../SimulationCommon/RiderClasses.h"
+#include "../SimulationCommon/StreamingStatistics.h"
+
+//what a single trial reports back to the reduction in main
+struct TrialResult
+{
+	double totalMoney;
+	double timeSpentWithNoBikes;
+	unsigned long numberOfEvents;
+	double controls[4]; //see ArrivalControl
+};
+
+//control variates of a trial, sums over the arrivals with known means whatever the number of classes (for the
+//homework's three they span the same space as the count of every class)
+enum ArrivalControl { BikeArrivals, ClientArrivals, FaresOffered, PenaltiesRisked };
+
+//everything the trials are reduced into, the plain statistics and the outputs corrected with the arrival counts
+struct StationStatistics
+{
+	MetricSet metrics;
+	ControlVariateSet controlled;
+
+	void merge(const StationStatistics & other)
+	{
+		metrics.merge(other.metrics);
+		controlled.merge(other.controlled);
+	}
+};
+
+//outputs tracked over the trials, see reduceReplications in main
+enum TrialMetric { MoneyMetric, NoBikesMetric, CostMetric };
+
+//number of replications that run in lockstep, one per double in an AVX-512 register (two AVX2 registers)
+const int laneWidth = 8;
+
+struct LaneGroupResult
+{
+	TrialResult lanes[laneWidth];
+};
+
+//station state of a lane group, one entry per lane, the counts are kept as doubles too (exact up to 2^53) so a lane
+//update is all double arithmetic
+struct LaneGroupState
+{
+	double totalMoney[laneWidth];
+	double bikeCount[laneWidth];
+	double timeSpentWithNoBikes[laneWidth];
+	double startOfNoBikes[laneWidth];
+	double nextEventTime[laneWidth];
+	double events[laneWidth];
+	double controls[4][laneWidth]; //see ArrivalControl
+};
+
+//the events of one step already classified and priced: 1 for a bike or client arrival (both 0 when the lane has no
+//candidate left in the unit or thinning dropped it), the fare and penalty of the candidate's class and how far the
+//lane's next candidate lies (0 once it is done with the unit)
+struct LaneStep
+{
+	double bikeArrived[laneWidth];
+	double clientArrived[laneWidth];
+	double fare[laneWidth];
+	double penalty[laneWidth];
+	double advance[laneWidth];
+};
+
+//the lane update kernels, the scalar one is the reference the vector kernels match bit for bit (every product is
+//with 0 or 1, so they agree even where the compiler fuses a multiply and an add), written with selects rather than
+//branches since the outcomes of a step are close to random
+inline void applyLaneStepScalar(LaneGroupState & state, const LaneStep & step)
+{
+	for (int l = 0; l < laneWidth; l++)
+	{
+		double eventTime = state.nextEventTime[l];
+		bool bikeArrived = step.bikeArrived[l] != 0;
+		bool clientArrived = step.clientArrived[l] != 0;
+		bool served = clientArrived && state.bikeCount[l] > 0;
+		bool penalised = clientArrived && !(state.bikeCount[l] > 0);
+
+		//a bike arrival ends an interval with no bikes
+		bool endsNoBikes = bikeArrived && state.startOfNoBikes[l] >= 0;
+		state.timeSpentWithNoBikes[l] += endsNoBikes ? eventTime - state.startOfNoBikes[l] : 0.0;
+		state.startOfNoBikes[l] = endsNoBikes ? -1.0 : state.startOfNoBikes[l];
+
+		state.bikeCount[l] += step.bikeArrived[l] - (served ? 1.0 : 0.0);
+		state.totalMoney[l] += served ? step.fare[l] : (penalised ? step.penalty[l] : 0.0);
+
+		//the last bike was taken, start the timer
+		state.startOfNoBikes[l] = (served && state.bikeCount[l] == 0) ? eventTime : state.startOfNoBikes[l];
+
+		state.nextEventTime[l] = eventTime + step.advance[l];
+		state.events[l] += step.bikeArrived[l] + step.clientArrived[l];
+		state.controls[BikeArrivals][l] += step.bikeArrived[l];
+		state.controls[ClientArrivals][l] += step.clientArrived[l];
+		state.controls[FaresOffered][l] += step.clientArrived[l] * step.fare[l];
+		state.controls[PenaltiesRisked][l] += step.clientArrived[l] * step.penalty[l];
+	}
+}
+
+#ifdef BATCH_VARIATES_X86
+
+//all 8 lanes in one register, the branches become write masks
+BATCH_VARIATES_TARGET("avx512f")
+inline void applyLaneStepAvx512(LaneGroupState & state, const LaneStep & step)
 {
-	double sampleVariance = 0;
-	for (auto cost : costValues)
+	const __m512d zero = _mm512_setzero_pd();
+	const __m512d one = _mm512_set1_pd(1.0);
+
+	__m512d eventTime = _mm512_loadu_pd(state.nextEventTime);
+	__m512d bike = _mm512_loadu_pd(step.bikeArrived);
+	__m512d client = _mm512_loadu_pd(step.clientArrived);
+	__m512d fare = _mm512_loadu_pd(step.fare);
+	__m512d penalty = _mm512_loadu_pd(step.penalty);
+	__m512d bikeCount = _mm512_loadu_pd(state.bikeCount);
+	__m512d startOfNoBikes = _mm512_loadu_pd(state.startOfNoBikes);
+	__m512d totalMoney = _mm512_loadu_pd(state.totalMoney);
+	__m512d timeSpentWithNoBikes = _mm512_loadu_pd(state.timeSpentWithNoBikes);
+
+	__mmask8 bikeArrived = _mm512_cmp_pd_mask(bike, zero, _CMP_NEQ_OQ);
+	__mmask8 clientArrived = _mm512_cmp_pd_mask(client, zero, _CMP_NEQ_OQ);
+	__mmask8 hasBikes = _mm512_cmp_pd_mask(bikeCount, zero, _CMP_GT_OQ);
+	__mmask8 served = clientArrived & hasBikes;
+	__mmask8 penalised = clientArrived & (__mmask8)~hasBikes;
+
+	__mmask8 endsNoBikes = bikeArrived & _mm512_cmp_pd_mask(startOfNoBikes, zero, _CMP_GE_OQ);
+	timeSpentWithNoBikes = _mm512_mask_add_pd(timeSpentWithNoBikes, endsNoBikes, timeSpentWithNoBikes, _mm512_sub_pd(eventTime, startOfNoBikes));
+	startOfNoBikes = _mm512_mask_mov_pd(startOfNoBikes, endsNoBikes, _mm512_set1_pd(-1.0));
+
+	bikeCount = _mm512_add_pd(bikeCount, _mm512_sub_pd(bike, _mm512_maskz_mov_pd(served, one)));
+	totalMoney = _mm512_mask_add_pd(totalMoney, served, totalMoney, fare);
+	totalMoney = _mm512_mask_add_pd(totalMoney, penalised, totalMoney, penalty);
+	startOfNoBikes = _mm512_mask_mov_pd(startOfNoBikes, served & _mm512_cmp_pd_mask(bikeCount, zero, _CMP_EQ_OQ), eventTime);
+
+	_mm512_storeu_pd(state.nextEventTime, _mm512_add_pd(eventTime, _mm512_loadu_pd(step.advance)));
+	_mm512_storeu_pd(state.bikeCount, bikeCount);
+	_mm512_storeu_pd(state.startOfNoBikes, startOfNoBikes);
+	_mm512_storeu_pd(state.totalMoney, totalMoney);
+	_mm512_storeu_pd(state.timeSpentWithNoBikes, timeSpentWithNoBikes);
+	_mm512_storeu_pd(state.events, _mm512_add_pd(_mm512_loadu_pd(state.events), _mm512_add_pd(bike, client)));
+	_mm512_storeu_pd(state.controls[BikeArrivals], _mm512_add_pd(_mm512_loadu_pd(state.controls[BikeArrivals]), bike));
+	_mm512_storeu_pd(state.controls[ClientArrivals], _mm512_add_pd(_mm512_loadu_pd(state.controls[ClientArrivals]), client));
+	_mm512_storeu_pd(state.controls[FaresOffered], _mm512_add_pd(_mm512_loadu_pd(state.controls[FaresOffered]), _mm512_mul_pd(client, fare)));
+	_mm512_storeu_pd(state.controls[PenaltiesRisked], _mm512_add_pd(_mm512_loadu_pd(state.controls[PenaltiesRisked]), _mm512_mul_pd(client, penalty)));
+}
+
+//two registers of 4 lanes, a mask is all ones or all zeros per lane and picks with a blend
+BATCH_VARIATES_TARGET("avx2")
+inline void applyLaneStepAvx2(LaneGroupState & state, const LaneStep & step)
+{
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d minusOne = _mm256_set1_pd(-1.0);
+
+	for (int h = 0; h < laneWidth; h += 4)
+	{
+		__m256d eventTime = _mm256_loadu_pd(state.nextEventTime + h);
+		__m256d bike = _mm256_loadu_pd(step.bikeArrived + h);
+		__m256d client = _mm256_loadu_pd(step.clientArrived + h);
+		__m256d fare = _mm256_loadu_pd(step.fare + h);
+		__m256d penalty = _mm256_loadu_pd(step.penalty + h);
+		__m256d bikeCount = _mm256_loadu_pd(state.bikeCount + h);
+		__m256d startOfNoBikes = _mm256_loadu_pd(state.startOfNoBikes + h);
+		__m256d totalMoney = _mm256_loadu_pd(state.totalMoney + h);
+		__m256d timeSpentWithNoBikes = _mm256_loadu_pd(state.timeSpentWithNoBikes + h);
+
+		__m256d bikeArrived = _mm256_cmp_pd(bike, zero, _CMP_NEQ_OQ);
+		__m256d clientArrived = _mm256_cmp_pd(client, zero, _CMP_NEQ_OQ);
+		__m256d hasBikes = _mm256_cmp_pd(bikeCount, zero, _CMP_GT_OQ);
+		__m256d served = _mm256_and_pd(clientArrived, hasBikes);
+		__m256d penalised = _mm256_andnot_pd(hasBikes, clientArrived);
+
+		__m256d endsNoBikes = _mm256_and_pd(bikeArrived, _mm256_cmp_pd(startOfNoBikes, zero, _CMP_GE_OQ));
+		timeSpentWithNoBikes = _mm256_blendv_pd(timeSpentWithNoBikes, _mm256_add_pd(timeSpentWithNoBikes, _mm256_sub_pd(eventTime, startOfNoBikes)), endsNoBikes);
+		startOfNoBikes = _mm256_blendv_pd(startOfNoBikes, minusOne, endsNoBikes);
+
+		bikeCount = _mm256_add_pd(bikeCount, _mm256_sub_pd(bike, _mm256_and_pd(served, one)));
+		totalMoney = _mm256_blendv_pd(totalMoney, _mm256_add_pd(totalMoney, fare), served);
+		totalMoney = _mm256_blendv_pd(totalMoney, _mm256_add_pd(totalMoney, penalty), penalised);
+		startOfNoBikes = _mm256_blendv_pd(startOfNoBikes, eventTime, _mm256_and_pd(served, _mm256_cmp_pd(bikeCount, zero, _CMP_EQ_OQ)));
+
+		_mm256_storeu_pd(state.nextEventTime + h, _mm256_add_pd(eventTime, _mm256_loadu_pd(step.advance + h)));
+		_mm256_storeu_pd(state.bikeCount + h, bikeCount);
+		_mm256_storeu_pd(state.startOfNoBikes + h, startOfNoBikes);
+		_mm256_storeu_pd(state.totalMoney + h, totalMoney);
+		_mm256_storeu_pd(state.timeSpentWithNoBikes + h, timeSpentWithNoBikes);
+		_mm256_storeu_pd(state.events + h, _mm256_add_pd(_mm256_loadu_pd(state.events + h), _mm256_add_pd(bike, client)));
+		_mm256_storeu_pd(state.controls[BikeArrivals] + h, _mm256_add_pd(_mm256_loadu_pd(state.controls[BikeArrivals] + h), bike));
+		_mm256_storeu_pd(state.controls[ClientArrivals] + h, _mm256_add_pd(_mm256_loadu_pd(state.controls[ClientArrivals] + h), client));
+		_mm256_storeu_pd(state.controls[FaresOffered] + h, _mm256_add_pd(_mm256_loadu_pd(state.controls[FaresOffered] + h), _mm256_mul_pd(client, fare)));
+		_mm256_storeu_pd(state.controls[PenaltiesRisked] + h, _mm256_add_pd(_mm256_loadu_pd(state.controls[PenaltiesRisked] + h), _mm256_mul_pd(client, penalty)));
+	}
+}
+
+#endif
+
+//same kernel choice as the variates (see activeBatchKernel in BatchVariates.h)
+inline void applyLaneStep(LaneGroupState & state, const LaneStep & step)
+{
+	switch (activeBatchKernel())
+	{
+#ifdef BATCH_VARIATES_X86
+	case BatchKernel::Avx512: applyLaneStepAvx512(state, step); break;
+	case BatchKernel::Avx2: applyLaneStepAvx2(state, step); break;
+#endif
+	default: applyLaneStepScalar(state, step); break;
+	}
+}
+
+/*
+	Runs laneWidth independent replications of the retrospective model in lockstep, with the station state stored as
+	structure of arrays. The aggregate poisson process is generated with exponential gaps of rate lambda, which gives
+	the same number of events per time unit (poisson(lambda)) at the same uniformly spread, sorted times as drawing the
+	count and sorting uniforms. Every step handles the next event of every lane that still has one in the current time
+	unit, lanes that are done with the time unit just sit out the remaining steps.
+
+	A step has two parts. A scalar pass classifies the candidate of every lane with the alias table, thins it and looks
+	up its fare and penalty in the tables of StationEvents (so a step costs the same for 3 classes or 300), those are
+	table reads and profile lookups that don't map onto vector instructions. applyLaneStep then updates the state of
+	all the lanes at once, the bike arrival and client branches as masks. For 100000 trials on one core (gcc -O2,
+	AVX-512) one trial per call takes 17.5 s, lockstep lanes with the scalar update 12.5 s and with the vector update
+	7.9 s, about 2.2x in all: the variates drawn in blocks and the gaps in place of the poisson count and the sort do
+	about half of it, the masked update the other half.
+
+	With time of day rates lambda is the candidate rate of the unit from UnitThinningTable, every unit starts each lane
+	on a fresh gap (the process is memoryless, so dropping the gap that ran past the end of the last unit is exact) and
+	a candidate takes part only if the table keeps it.
+*/
+LaneGroupResult simulateLaneGroup(uint64_t seed, int T, const StationEvents & events, const UnitThinningTable & thinning)
+{
+	//what a served or penalised client of each class adds to the money, 0 for a bike arrival
+	const double * rideFare = events.fare.data();
+	const double * clientPenalty = events.penalty.data();
+
+	//uniforms and gaps are drawn a block of steps at a time, one row of laneWidth values per step, the gaps for rate 1
+	const int stepsPerRefill = 64;
+	BatchRandomEngine engine(seed);
+	double uniforms[laneWidth * stepsPerRefill];
+	double acceptUniforms[laneWidth * stepsPerRefill];
+	double gaps[laneWidth * stepsPerRefill];
+	int step = stepsPerRefill;
+	auto nextStep = [&]()
+	{
+		if (step == stepsPerRefill)
+		{
+			engine.fillUniform(uniforms, laneWidth * stepsPerRefill);
+			engine.fillUniform(acceptUniforms, laneWidth * stepsPerRefill);
+			engine.fillExponential(gaps, laneWidth * stepsPerRefill, 1);
+			step = 0;
+		}
+		return laneWidth * step++;
+	};
+
+	LaneGroupState state;
+	LaneStep laneStep;
+	for (int l = 0; l < laneWidth; l++)
 	{
-		sampleVariance += pow(cost - globalMean, 2);
+		//we can assume total money starts at 0 + the deterministic annual prorated charge of the members
+		state.totalMoney[l] = events.annualCharge;
+		state.bikeCount[l] = 10; //we start with 10 bikes at X(0)
+		state.timeSpentWithNoBikes[l] = 0;
+		state.startOfNoBikes[l] = -1;
+		state.events[l] = 0;
+		for (int c = 0; c < 4; c++) state.controls[c][l] = 0;
 	}
 
-	sampleVariance = sampleVariance / (costValues.size() - 1);
+	for (int i = 1; i <= T; i++)
+	{
+		//events of time unit i fall in (i, i + 1) for i = 1 .. T
+		const double intervalEnd = i + 1;
+		const double unitRate = thinning.unitRate(i);
+		const double * firstGap = gaps + nextStep();
+		for (int l = 0; l < laneWidth; l++) state.nextEventTime[l] = i + firstGap[l] / unitRate;
+		bool anyActive = true;
+
+		while (anyActive)
+		{
+			int row = nextStep();
+			const double * u = uniforms + row;
+			const double * accept = acceptUniforms + row;
+			const double * gap = gaps + row;
+
+			anyActive = false;
+			for (int l = 0; l < laneWidth; l++)
+			{
+				double eventTime = state.nextEventTime[l];
+				bool candidate = eventTime < intervalEnd;
+				uint32_t eventType = thinning.candidate(i, u[l]);
+				bool active = candidate && thinning.accept(i, eventType, eventTime, accept[l]);
+
+				laneStep.bikeArrived[l] = active && eventType == 0 ? 1.0 : 0.0;
+				laneStep.clientArrived[l] = active && eventType != 0 ? 1.0 : 0.0;
+				laneStep.fare[l] = rideFare[eventType];
+				laneStep.penalty[l] = clientPenalty[eventType];
+				laneStep.advance[l] = candidate ? gap[l] / unitRate : 0.0;
+				anyActive |= candidate;
+			}
+			applyLaneStep(state, laneStep);
+		}
+	}
 
-	sampleVariance = sqrt(sampleVariance);
+	LaneGroupResult result;
+	for (int l = 0; l < laneWidth; l++)
+	{
+		result.lanes[l] = TrialResult{ state.totalMoney[l], state.timeSpentWithNoBikes[l], (unsigned long)state.events[l],
+			{ state.controls[BikeArrivals][l], state.controls[ClientArrivals][l], state.controls[FaresOffered][l], state.controls[PenaltiesRisked][l] } };
+	}
+	return result;
+}
 
-	return sampleVariance;
+//runs the trials [firstTrial, firstTrial + numberOfTrials) as lane groups spread over the cores, record(accumulator,
+//result, trialIndex) sees the trials in order within every block of lane groups, same as reduceReplicationRange
+//firstTrial has to be a multiple of laneWidth so a continued run picks up at the start of a lane group
+template <typename Accumulator, typename RecordFunction>
+Accumulator reduceLockstepReplications(int firstTrial, int numberOfTrials, unsigned int baseSeed, int T, const StationEvents & events,
+	const UnitThinningTable & thinning, const Accumulator & empty, RecordFunction record)
+{
+	int firstGroup = firstTrial / laneWidth;
+	int numberOfGroups = (numberOfTrials + laneWidth - 1) / laneWidth;
+	return reduceReplicationRange(firstGroup, numberOfGroups, baseSeed, empty,
+		[&](std::default_random_engine & generator, int)
+	{
+		uint64_t seed = generator();
+		seed = (seed << 32) ^ generator();
+		return simulateLaneGroup(seed, T, events, thinning);
+	},
+		[&](Accumulator & accumulator, const LaneGroupResult & group, int groupIndex)
+	{
+		//the last group can run a few lanes past the range, those are dropped
+		for (int l = 0; l < laneWidth && groupIndex * laneWidth + l < firstTrial + numberOfTrials; l++)
+		{
+			record(accumulator, group.lanes[l], groupIndex * laneWidth + l);
+		}
+	}, 256 / laneWidth);
 }
 
-int main()
+int main(int argc, char * argv[])
 {
 	const int T = 120;
-	int X[121] = { 0 }; //There are T+1 events
 	const double bikeArrivalRate = 6;
-	//clients have rate r1 = 3, r2 = 1, r3 = 4
-	const double clientRates[4] = { 0, 3.0, 1.0, 4.0 };
-
-	//client class 1/2 pay annually (K1 = 0.5, k2 = .1), total amount is (K1*r1 + K2*r2)
-	//class 3 pays per ride amount k3 = 1.25
 
-	//when annual members (class 1/2) arrive at empty station, there is penalty c1 = 1.0, c2 = 0.25, c3 = 0
-	const double clientPenalty[4] = { 0, -1.0, -0.25, 0 };
+	//the rider classes come from the file given on the command line (see RiderClasses.h for the format), without one
+	//we use the homework's: r1 = 3, r2 = 1, r3 = 4, classes 1/2 pay annually (K1 = 0.5, K2 = .1) and are penalised
+	//c1 = 1.0, c2 = 0.25 when they find no bike, class 3 pays k3 = 1.25 per ride
+	std::vector<RiderClass> riderClasses = homeworkRiderClasses();
+	if (argc >= 2 && !loadRiderClasses(argv[1], riderClasses))
+	{
+		std::cout << "Could not load the rider classes from " << argv[1] << std::endl;
+		return 1;
+	}
+	const StationEvents events(bikeArrivalRate, riderClasses);
+	std::cout << "Rider classes : " << events.classes() << std::endl;
+
+	//time of day rates: off keeps the rates constant, on spreads the same daily demand over days of 24 time units, bikes
+	//and members (classes with an annual fee) with the rush hours and pay per ride riders around midday (RateProfile.h)
+	const bool useTimeOfDay = false;
+	const RateProfile::Shape profileShape = RateProfile::Shape::PiecewiseLinear;
+	std::vector<RateProfile> profiles;
+	profiles.push_back(useTimeOfDay ? rushHourShape(profileShape).scaled(bikeArrivalRate) : RateProfile::constant(bikeArrivalRate));
+	for (const RiderClass & riderClass : riderClasses)
+	{
+		RateProfile shape = riderClass.annualFee > 0 ? rushHourShape(profileShape) : middayShape(profileShape);
+		profiles.push_back(useTimeOfDay ? shape.scaled(riderClass.rate) : RateProfile::constant(riderClass.rate));
+	}
+	const UnitThinningTable thinning(profiles, 1, T);
+	if (useTimeOfDay) std::cout << "Thinning keeps " << 100 * thinning.acceptance() << "% of the candidates" << std::endl;
 
-	//create and seed the generator
-	std::default_random_engine generator;
-	generator.seed(time(0));
+	//the base seed, every trial derives its own generator from it (see ReplicationRunner.h)
+	const unsigned int baseSeed = (unsigned int)time(0);
 
 	//aggregate poisson
-	std::cout << "Aggregate Lambda is : " << bikeArrivalRate + clientRates[1] + clientRates[2] + clientRates[3] << std::endl;
-	std::poisson_distribution<int> poissonRandomVariableGenerator(bikeArrivalRate + clientRates[1] + clientRates[2] + clientRates[3]);
-
-	/*  std::discrete_distribution produces random integers on the interval [0, n),
-		where the probability of each individual integer i is defined as the weight of
-		the ith integer divided by the sum of all n weights. */
-	std::discrete_distribution<> weightedDistributionEventGenerator({ bikeArrivalRate, clientRates[1], clientRates[2], clientRates[3] });
-	std::uniform_real_distribution<double> uniformRealGenerator(0, 1);
+	std::cout << "Aggregate Lambda is : " << events.totalRate << std::endl;
+
+	//with sequential stopping numberOfTrials is only the upper limit, trials are added in batches until every metric
+	//meets its precision target (see reduceReplicationsUntil and PrecisionTarget)
+	const bool useSequentialStopping = true;
+	const int pilotTrials = 1000;
+	const int batchTrials = 1000;
+	//control variates: the arrival sums of ArrivalControl have known means (from the integrated rates over the units
+	//1 .. T), the outputs are corrected through their correlation with them and the stopping rule uses the corrected
+	//intervals (see ControlVariates.h)
+	const bool useControlVariates = true;
+	std::vector<double> arrivalMeans(4, 0.0);
+	arrivalMeans[BikeArrivals] = profiles[0].cumulative(T + 1) - profiles[0].cumulative(1);
+	for (int c = 1; c <= events.classes(); c++)
+	{
+		double expected = profiles[c].cumulative(T + 1) - profiles[c].cumulative(1);
+		arrivalMeans[ClientArrivals] += expected;
+		arrivalMeans[FaresOffered] += events.fare[c] * expected;
+		arrivalMeans[PenaltiesRisked] += events.penalty[c] * expected;
+	}
 
-	const int numberOfTrials = 10000;
-	double averageMoneyAmount = 0;
-	double averageCostOfDissatisfaction = 0;
-	double averageTimeWithNoBikes = 0;
-	unsigned long numberOfEvents = 0;
+	const PrecisionTarget precisionTargets[3] = {
+		relativePrecision(0.002), //money within 0.2%
+		absolutePrecision(0.1),   //time with no bikes within 0.1
+		absolutePrecision(0.3)    //cost of dissatisfaction within 0.3
+	};
+	double z = 1.96;
 
-	std::vector<double> costValues;
+	const int numberOfTrials = 100000;
 
 	std::cout << "Starting the trials" << std::endl;
 
-	for (int t = 0; t < numberOfTrials; t++)
+	//run laneWidth replications at a time in lockstep (see simulateLaneGroup) instead of one trial per call
+	const bool useLockstepLanes = true;
+
+	//a single trial, used when the lockstep mode is off
+	auto simulateTrial = [&](std::default_random_engine & generator, int)
 	{
-		//we can assume total money starts at 0 + the deterministic annual prorated charge of clients classes 1 and 2
-		double totalMoney = (0.5 * clientRates[1]) + (0.1 * clientRates[2]);
+		int X[T + 1] = { 0 }; //There are T+1 events
+		unsigned long trialEvents = 0;
+		double controls[4] = { 0 };
+
+		//event times within a time unit, the classification and the thinning of the candidates come from batch filled
+		//buffers of uniforms
+		uint64_t streamSeed = generator();
+		streamSeed = (streamSeed << 32) ^ generator();
+		VariateStream uniformRealGenerator = VariateStream::uniform(mixStreamSeed(streamSeed, 0), 0, 1);
+		VariateStream classifyGenerator = VariateStream::uniform(mixStreamSeed(streamSeed, 1), 0, 1);
+		VariateStream acceptGenerator = VariateStream::uniform(mixStreamSeed(streamSeed, 2), 0, 1);
+
+		//we can assume total money starts at 0 + the deterministic annual prorated charge of the members
+		double totalMoney = events.annualCharge;
 		X[0] = 10; //we start with 10 bikes at X(0)
 		double timeSpentWithNoBikes = 0;
 		double startOfNoBikes = -1;
@@ -89,14 +474,15 @@ int main()
 		for (int i = 1; i <= T; i++)
 		{
 			X[i] = X[i - 1]; //new time interval starts with bike amount from prev interval
+			//candidates of this unit, see UnitThinningTable
+			std::poisson_distribution<int> poissonRandomVariableGenerator(thinning.unitRate(i));
 			int generatedValue = poissonRandomVariableGenerator(generator);
-			numberOfEvents += generatedValue;
 			//std::cout << "Generated p.r.v : " << generatedValue << std::endl;
 
 			//generate the times of the events
 			std::vector<double> eventTimes;
 			for (int e = 0; e < generatedValue; e++)
-				eventTimes.push_back(i + uniformRealGenerator(generator));
+				eventTimes.push_back(i + uniformRealGenerator.next());
 
 			//sort them in ascending order
 			std::sort(eventTimes.begin(), eventTimes.end());
@@ -104,8 +490,13 @@ int main()
 			//classify each event + handle it
 			for (int rEvent = 0; rEvent < generatedValue; rEvent++)
 			{
-				//generate a u.r.v. {0: Bike Arrival, 1: Class1, 2: Class2, 3: Class3)
-				int eventType = weightedDistributionEventGenerator(generator);
+				//0: Bike Arrival, c: a client of class c, unless thinning drops the candidate
+				uint32_t eventType = thinning.candidate(i, classifyGenerator.next());
+				if (!thinning.accept(i, eventType, eventTimes[rEvent], acceptGenerator.next())) continue;
+				trialEvents++;
+				controls[eventType == 0 ? BikeArrivals : ClientArrivals]++;
+				controls[FaresOffered] += events.fare[eventType];
+				controls[PenaltiesRisked] += events.penalty[eventType];
 
 				if (eventType == 0) //a bike has arrived
 				{
@@ -123,11 +514,8 @@ int main()
 					//if no more bikes, add to queue, else decrement bike count
 					if (X[i] > 0)
 					{
-						//if eventType 3 gain $1.25
-						if (eventType == 3)
-						{
-							totalMoney += 1.25;
-						}
+						//pay per ride riders pay their fare
+						totalMoney += events.fare[eventType];
 						//decrement the bike count
 						X[i]--;
 
@@ -139,43 +527,72 @@ int main()
 					}
 					else
 					{
-						//we apply a penalty for waiting in line, for class3 penalty is 0
-						totalMoney += clientPenalty[eventType];
+						//we apply a penalty for not having a bike, 0 for pay per ride riders
+						totalMoney += events.penalty[eventType];
 					}
 				}
 			}
 		}
 
-		//std::cout << "Total Money at the end of experiment " << totalMoney << std::endl;
-		averageMoneyAmount += totalMoney;
+		return TrialResult{ totalMoney, timeSpentWithNoBikes, trialEvents, { controls[0], controls[1], controls[2], controls[3] } };
+	};
 
-		//record the cost for sample variance calculation
-		costValues.push_back((timeSpentWithNoBikes * clientRates[1] * clientPenalty[1]) + (timeSpentWithNoBikes * clientRates[2] * clientPenalty[2]));
+	//every trial is folded into its block's statistics as soon as it is done, the blocks are spread over all cores
+	//and merged in order, so memory stays constant no matter how many trials we run
+	const StationStatistics emptyStatistics = {
+		MetricSet{ "money", "time with no bikes", "cost of dissatisfaction" },
+		ControlVariateSet({ "money", "time with no bikes", "cost of dissatisfaction" }, arrivalMeans)
+	};
+	auto recordTrial = [&](StationStatistics & statistics, const TrialResult & result, int)
+	{
+		//std::cout << "Total Time Spent with no bikes during trial " << result.timeSpentWithNoBikes << std::endl;
+		double cost = result.timeSpentWithNoBikes * events.dissatisfactionRate;
+		statistics.metrics.add(MoneyMetric, result.totalMoney);
+		statistics.metrics.add(NoBikesMetric, result.timeSpentWithNoBikes);
+		statistics.metrics.add(CostMetric, cost);
 
-		//record for global mean calculation [further down]
-		std::cout << "Total Time Spent with no bikes during trial " << timeSpentWithNoBikes << std::endl;
-		averageTimeWithNoBikes += timeSpentWithNoBikes;
+		const double responses[3] = { result.totalMoney, result.timeSpentWithNoBikes, cost };
+		statistics.controlled.add(responses, result.controls);
+	};
+
+	auto reduceTrialRange = [&](int firstTrial, int trialCount)
+	{
+		return useLockstepLanes ?
+			reduceLockstepReplications(firstTrial, trialCount, baseSeed, T, events, thinning, emptyStatistics, recordTrial) :
+			reduceReplicationRange(firstTrial, trialCount, baseSeed, emptyStatistics, simulateTrial, recordTrial);
+	};
+
+	int trialsUsed = numberOfTrials;
+	StationStatistics results = useSequentialStopping ?
+		reduceReplicationsUntil(emptyStatistics, reduceTrialRange,
+			[&](const StationStatistics & current)
+	{
+		return useControlVariates ? current.controlled.meetsPrecision(precisionTargets, z) : current.metrics.meetsPrecision(precisionTargets, z);
+	},
+			pilotTrials, batchTrials, numberOfTrials, trialsUsed) :
+		reduceTrialRange(0, numberOfTrials);
+	const MetricSet & statistics = results.metrics;
+
+	std::cout << "Trials used : " << trialsUsed << (trialsUsed < numberOfTrials ? " (precision targets met)" : "") << std::endl;
+
+	if (useControlVariates)
+	{
+		std::cout << "With the arrival counts as control variates :" << std::endl;
+		results.controlled.printConfidenceIntervals(std::cout, z);
+		std::cout << "Without them :" << std::endl;
 	}
 
-	std::cout << "Average amount of money over " << numberOfTrials << " iterations" << " : "
-		<< (averageMoneyAmount / numberOfTrials) << std::endl;
+	std::cout << "Average amount of money over " << trialsUsed << " iterations" << " : "
+		<< statistics[MoneyMetric].mean() << std::endl;
 
 	/*std::cout << "Average amount of events over " << numberOfTrials << " iterations" << " : "
 		<< (numberOfEvents / numberOfTrials) << std::endl;*/
 
-	std::cout << "Average time spent with no bikes over " << numberOfTrials << " iterations" << " : "
-		<< (averageTimeWithNoBikes / numberOfTrials) << std::endl;
-	
-	double globalMeanOfCost = (((averageTimeWithNoBikes / numberOfTrials) * clientRates[1] * clientPenalty[1]) + ((averageTimeWithNoBikes / numberOfTrials) * clientRates[2] * clientPenalty[2]));
-
-	double sampleVariance = calculateSampleVariance(costValues, globalMeanOfCost);
-
-	double z = 1.96;
+	std::cout << "Average time spent with no bikes over " << trialsUsed << " iterations" << " : "
+		<< statistics[NoBikesMetric].mean() << std::endl;
 
-	double CI = z * (sampleVariance / sqrt(costValues.size()));
-	
-	std::cout << "Average cost of dissatisfaction over " << numberOfTrials << " iterations" << " : "
-		<< globalMeanOfCost << " +-" << CI << std::endl;
+	std::cout << "Average cost of dissatisfaction over " << trialsUsed << " iterations" << " : "
+		<< statistics[CostMetric].mean() << " +-" << statistics[CostMetric].halfWidth(z) << std::endl;
 
 	std::getchar();
 
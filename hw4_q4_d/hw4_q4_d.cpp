@@ -12,17 +12,40 @@
 #include <random>
 #include <time.h>
 
-bool checkAllInfected(std::vector<bool> & population)
+/*
+	Every contact is between two different people picked at random, out of N(N - 1) ordered pairs 2I(N - I) are
+	between an infected and a healthy person, and those transmit with probability infectionRate. Everything else is
+	a wasted contact that only moves the clock.
+
+	So instead of simulating contacts one by one we jump from infection to infection: with I infected the number of
+	contacts up to and including the next infection is geometric with p = infectionRate * 2I(N - I) / (N(N - 1)), and
+	the time they take is the sum of that many exponential(contactRate) gaps, a single gamma(contacts, 1 / contactRate)
+	draw. A trial is N - 1 steps no matter how many contacts there were, which makes N = 10^7 feasible.
+
+	allowSelfContact uses N^2 pairs instead, which matches the original loop where person2 could be the same person
+	as person1 (the numbers at the top were made that way).
+*/
+double timeToFullInfection(std::default_random_engine & generator, long long N, double contactRate, double infectionRate, bool allowSelfContact)
 {
-	for (auto isInfected : population)
+	double pairs = allowSelfContact ? (double)N * N : (double)N * (N - 1);
+	double time = 0;
+
+	for (long long infected = 1; infected < N; infected++)
 	{
-		if (!isInfected)
+		double p = infectionRate * 2.0 * infected * (N - infected) / pairs;
+
+		long long contacts = 1;
+		if (p < 1)
 		{
-			return false;
+			std::geometric_distribution<long long> wastedContacts(p); //failures before the first success
+			contacts += wastedContacts(generator);
 		}
+
+		std::gamma_distribution<double> elapsedTime((double)contacts, 1 / contactRate);
+		time += elapsedTime(generator);
 	}
 
-	return true;
+	return time;
 }
 
 int main() 
@@ -34,36 +57,51 @@ int main()
 	//exponential generator
 	double contactRate = 1, infectionRate = 0.5;
 	std::exponential_distribution<double> exponentialGenerator(contactRate);
-	std::uniform_int_distribution<int> uniformGenerator(0, 99);
+	std::bernoulli_distribution infectionGenerator(infectionRate);
+
+	//jump from infection to infection (see timeToFullInfection) instead of simulating every contact
+	const bool useInfectionSteps = true;
+	const bool allowSelfContact = false;
+	const long long populationSize = 100;
+	std::uniform_int_distribution<long long> uniformGenerator(0, populationSize - 1);
 
 	double totalTime = 0;
 
 	int numTrials = 10000;
 	for (int trial = 0; trial < numTrials; trial++)
 	{
-		std::vector<bool> population(100, false); // initialize population to healthy
-		population[uniformGenerator(generator)] = true; // pick a random person to be infected as per the prompt
-
 		double time = 0;
 
-		// check the whole population if everybody is infected or not then repeat the simulation until everybody is
-		while (!checkAllInfected(population))
+		if (useInfectionSteps)
+		{
+			time = timeToFullInfection(generator, populationSize, contactRate, infectionRate, allowSelfContact);
+		}
+		else
 		{
-			// pick 2 people at random
-			int person1 = uniformGenerator(generator);
-			int person2 = -1;
-			while (person2 < 0 && person2 != person1) { person2 = uniformGenerator(generator); } //make sure they are different people
+			std::vector<bool> population(populationSize, false); // initialize population to healthy
+			population[uniformGenerator(generator)] = true; // pick a random person to be infected as per the prompt
+			long long infected = 1;
 
-			if (population[person1] != population[person2])
+			// keep count of the infected instead of scanning the whole population before every contact
+			while (infected < populationSize)
 			{
-				if (uniformGenerator(generator) < infectionRate * 100)
+				// pick 2 people at random
+				long long person1 = uniformGenerator(generator);
+				long long person2 = uniformGenerator(generator);
+				while (!allowSelfContact && person2 == person1) { person2 = uniformGenerator(generator); } //make sure they are different people
+
+				if (population[person1] != population[person2])
 				{
-					population[person1] = true;
-					population[person2] = true;
+					if (infectionGenerator(generator))
+					{
+						population[person1] = true;
+						population[person2] = true;
+						infected++;
+					}
 				}
+
+				time += exponentialGenerator(generator);
 			}
-			
-			time += exponentialGenerator(generator);
 		}
 
 		totalTime += time;
@@ -76,4 +114,4 @@ int main()
 	std::getchar();
 	
 	return 0;
-}
+}
\ No newline at end of file